@@ -9,11 +9,26 @@
 #include "ns3/point-to-point-module.h"
 #include "ns3/wifi-module.h"
 
-#include <arpa/inet.h>
+#include "ml-firewall-async-client.h"
+#include "ml-firewall-cache.h"
+#include "ml-firewall-enforcer.h"
+#include "ml-firewall-features.h"
+#include "ml-firewall-native.h"
+#include "ml-firewall-online.h"
+#include "ml-firewall-pool.h"
+#include "ml-firewall-reload.h"
+#include "ml-firewall-shadow.h"
+#include "ml-firewall-shard.h"
+
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <iomanip>
 #include <sstream>
 #include <string>
-#include <sys/socket.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <unordered_map>
 
 using namespace ns3;
 
@@ -44,55 +59,493 @@ GetDistrictFromIP(Ipv4Address ip)
         return "Core";
 }
 
-bool
-QueryMLFirewall(uint32_t flowId,
-                Ipv4Address srcIP,
-                Ipv4Address dstIP,
-                uint16_t dstPort,
-                uint32_t txPackets,
-                uint32_t rxPackets,
-                uint64_t txBytes,
-                uint64_t rxBytes,
-                double duration,
-                double throughput,
-                double packetLoss,
-                double delay,
-                double jitter,
-                std::string district)
+// FlowMonitor statistics of a flow so far, in the form the feature
+// extractor takes
+FlowStatsRecord
+MakeFlowStatsRecord(FlowId flowId,
+                    const Ipv4FlowClassifier::FiveTuple& flowTuple,
+                    const FlowMonitor::FlowStats& stats)
 {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0)
+    FlowStatsRecord record;
+    record.flowId = flowId;
+    record.srcAddress = flowTuple.sourceAddress.Get();
+    record.dstAddress = flowTuple.destinationAddress.Get();
+    record.srcPort = flowTuple.sourcePort;
+    record.dstPort = flowTuple.destinationPort;
+    record.protocol = flowTuple.protocol;
+    record.district = mlfw::GetDistrictId(GetDistrictFromIP(flowTuple.sourceAddress));
+    record.txPackets = stats.txPackets;
+    record.rxPackets = stats.rxPackets;
+    record.txBytes = stats.txBytes;
+    record.rxBytes = stats.rxBytes;
+    record.duration = (stats.timeLastRxPacket - stats.timeFirstTxPacket).GetSeconds();
+    record.delaySum = stats.delaySum.GetSeconds();
+    record.jitterSum = stats.jitterSum.GetSeconds();
+    return record;
+}
+
+// Firewall query for a flow from its FlowMonitor statistics so far
+FlowQuery
+MakeFlowQuery(FlowId flowId,
+              const Ipv4FlowClassifier::FiveTuple& flowTuple,
+              const FlowMonitor::FlowStats& stats)
+{
+    return MakeFlowQuery(MakeFlowStatsRecord(flowId, flowTuple, stats));
+}
+
+FlowKey
+MakeFlowKey(const FlowQuery& query)
+{
+    FlowKey key;
+    key.srcAddress = query.srcAddress;
+    key.dstAddress = query.dstAddress;
+    key.srcPort = query.srcPort;
+    key.dstPort = query.dstPort;
+    key.protocol = query.protocol;
+    return key;
+}
+
+// Scores live flows while the simulation runs. Every interval of simulated
+// time it refreshes the monitor's statistics, diffs them against the previous
+// pass and scores only the flows that carried traffic since then, so a pass
+// costs O(active flows) scorer work. The first simulated time each flow is
+// flagged is kept for the post-simulation report, and flagged flows are added
+// to the blocklist enforced on the data path, if one is set.
+class LiveFirewallSampler
+{
+  public:
+    LiveFirewallSampler(Ptr<FlowMonitor> monitor,
+                        Ptr<Ipv4FlowClassifier> classifier,
+                        ShardedFirewallClient& firewall,
+                        VerdictCache& cache,
+                        uint32_t batchSize)
+        : m_monitor(monitor),
+          m_classifier(classifier),
+          m_firewall(firewall),
+          m_cache(cache),
+          m_batchSize(std::max<uint32_t>(1, batchSize))
+    {
+    }
+
+    void SetBlocklist(FlowBlocklist* blocklist)
+    {
+        m_blocklist = blocklist;
+    }
+
+    // Feeds every flow that carried traffic since the previous pass to an
+    // online detector, which scores it and learns it
+    void SetOnlineDetector(HalfSpaceTrees* detector)
+    {
+        m_online = detector;
+    }
+
+    // Hands every verdict of a pass to a shadow scorer comparing it with a
+    // candidate model
+    void SetShadow(ShadowScorer* shadow)
+    {
+        m_shadow = shadow;
+    }
+
+    void Start(Time interval)
+    {
+        m_interval = interval;
+        Simulator::Schedule(interval, &LiveFirewallSampler::Sample, this);
+    }
+
+    // Simulated time the flow was first flagged, if it was
+    bool GetFirstFlagged(FlowId flowId, Time& when) const
+    {
+        auto it = m_firstFlagged.find(flowId);
+        if (it == m_firstFlagged.end())
+        {
+            return false;
+        }
+        when = it->second;
+        return true;
+    }
+
+    uint32_t GetPasses() const
+    {
+        return m_passes;
+    }
+
+    uint64_t GetScoredFlows() const
+    {
+        return m_scoredFlows;
+    }
+
+    uint64_t GetSkippedFlows() const
+    {
+        return m_skippedFlows;
+    }
+
+    uint32_t GetFlaggedFlows() const
+    {
+        return m_firstFlagged.size();
+    }
+
+  private:
+    // Counters of a flow as of the previous pass, and its five-tuple once
+    // the flow was scored: FindFlow() searches the classifier's flows one by
+    // one, and a flow's tuple never changes
+    struct Snapshot
+    {
+        uint32_t txPackets = 0;
+        uint32_t rxPackets = 0;
+        uint32_t lostPackets = 0;
+        bool classified = false;
+        Ipv4FlowClassifier::FiveTuple tuple;
+    };
+
+    void Sample()
+    {
+        m_monitor->CheckForLostPackets();
+        const FlowMonitor::FlowStatsContainer& stats = m_monitor->GetFlowStats();
+
+        std::vector<FlowQuery> changed;
+        for (auto& flow : stats)
+        {
+            Snapshot& last = m_last[flow.first];
+            const FlowMonitor::FlowStats& now = flow.second;
+            uint32_t txDelta = now.txPackets - last.txPackets;
+            uint32_t rxDelta = now.rxPackets - last.rxPackets;
+            uint32_t lostDelta = now.lostPackets - last.lostPackets;
+            if (txDelta == 0 && rxDelta == 0 && lostDelta == 0)
+            {
+                m_skippedFlows++;
+                continue;
+            }
+            last.txPackets = now.txPackets;
+            last.rxPackets = now.rxPackets;
+            last.lostPackets = now.lostPackets;
+            if (!last.classified)
+            {
+                last.tuple = m_classifier->FindFlow(flow.first);
+                last.classified = true;
+            }
+
+            FlowQuery query = MakeFlowQuery(flow.first, last.tuple, now);
+            if (m_online)
+            {
+                double features[mlfw::N_FEATURES];
+                ComputeModelFeatures(query, features);
+                m_online->Update(features);
+            }
+            FlowVerdict verdict;
+            if (m_cache.Lookup(query, verdict))
+            {
+                Record(query, verdict);
+                if (m_shadow)
+                {
+                    m_shadow->Submit(&query, &verdict, 1);
+                }
+                continue;
+            }
+            changed.push_back(query);
+        }
+
+        std::vector<FlowVerdict> verdicts;
+        m_firewall.QueryBatch(changed, verdicts, m_batchSize);
+        for (size_t i = 0; i < changed.size(); i++)
+        {
+            m_cache.Insert(changed[i], verdicts[i]);
+            Record(changed[i], verdicts[i]);
+        }
+        if (m_shadow)
+        {
+            m_shadow->Submit(changed.data(), verdicts.data(), changed.size());
+        }
+        m_scoredFlows += changed.size();
+        m_passes++;
+
+        Simulator::Schedule(m_interval, &LiveFirewallSampler::Sample, this);
+    }
+
+    void Record(const FlowQuery& query, const FlowVerdict& verdict)
+    {
+        if (!verdict.shouldBlock)
+        {
+            return;
+        }
+        m_firstFlagged.emplace(verdict.flowId, Simulator::Now());
+        if (m_blocklist)
+        {
+            m_blocklist->Insert(MakeFlowKey(query));
+        }
+    }
+
+    Ptr<FlowMonitor> m_monitor;
+    Ptr<Ipv4FlowClassifier> m_classifier;
+    ShardedFirewallClient& m_firewall;
+    VerdictCache& m_cache;
+    FlowBlocklist* m_blocklist = nullptr;
+    HalfSpaceTrees* m_online = nullptr;
+    ShadowScorer* m_shadow = nullptr;
+    uint32_t m_batchSize;
+    Time m_interval;
+    std::unordered_map<FlowId, Snapshot> m_last;
+    std::map<FlowId, Time> m_firstFlagged;
+    uint32_t m_passes = 0;
+    uint64_t m_scoredFlows = 0;
+    uint64_t m_skippedFlows = 0;
+};
+
+// Runs several scenarios from one topology. Nodes, addresses and routes are
+// the same for every scenario, so main() builds them once and Fork() then
+// forks a child per scenario and RNG run. The child shares the parent's
+// memory copy-on-write, installs its own traffic and attacks, runs and
+// writes its outputs. At most `parallel` children run at once. A child's
+// console output goes to PREFIX-farm.log. Before it exits, it sends the
+// parent one line of counts, and the parent merges these into a summary.
+//
+// Random streams the topology created before the fork (mobility, channels)
+// start alike in every child; the run number reseeds those created after.
+class ScenarioFarm
+{
+  public:
+    struct Job
+    {
+        std::string scenario;
+        uint32_t run = 1;
+        std::string prefix; // of the job's output files
+    };
+
+    ScenarioFarm(const std::vector<Job>& jobs, uint32_t parallel)
+        : m_jobs(jobs),
+          m_results(jobs.size()),
+          m_parallel(std::max<uint32_t>(1, parallel))
+    {
+    }
+
+    // Forks the children. Returns true in each child, whose job is then
+    // GetJob(), and false in the parent once every child has exited.
+    bool Fork()
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t next = 0;
+        uint32_t running = 0;
+        while (next < m_jobs.size() || running > 0)
+        {
+            if (next < m_jobs.size() && running < m_parallel)
+            {
+                if (StartChild(next))
+                {
+                    return true;
+                }
+                running += m_results[next++].pid > 0;
+                continue;
+            }
+            int status = 0;
+            pid_t pid = waitpid(-1, &status, 0);
+            if (pid < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (pid < 0)
+            {
+                break;
+            }
+            for (Result& result : m_results)
+            {
+                if (result.pid == pid)
+                {
+                    Finish(result, status);
+                    running--;
+                }
+            }
+        }
+        m_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
         return false;
+    }
+
+    // In a child, its job
+    const Job& GetJob() const
+    {
+        return m_jobs[m_child];
+    }
 
-    struct sockaddr_in server;
-    server.sin_addr.s_addr = inet_addr("127.0.0.1");
-    server.sin_family = AF_INET;
-    server.sin_port = htons(8888);
+    // In a child: sends the parent the counts of its run
+    void Report(uint32_t flows,
+                uint32_t attacks,
+                uint32_t blocked,
+                uint32_t blockedAttacks,
+                uint32_t degraded)
+    {
+        std::ostringstream line;
+        line << flows << " " << attacks << " " << blocked << " " << blockedAttacks << " "
+             << degraded << "\n";
+        std::string text = line.str();
+        if (write(m_reportFd, text.data(), text.size()) < 0)
+        {
+            std::cerr << "Cannot report to the scenario farm" << std::endl;
+        }
+    }
 
-    if (connect(sock, (struct sockaddr*)&server, sizeof(server)) < 0)
+    // Children that failed to start, crashed, exited with an error or did
+    // not report
+    uint32_t GetFailures() const
     {
-        close(sock);
+        uint32_t failures = 0;
+        for (const Result& result : m_results)
+        {
+            failures += !result.reported;
+        }
+        return failures;
+    }
+
+    // In the parent, once Fork() has returned
+    void PrintSummary() const
+    {
+        std::cout << "\nScenario farm: " << m_jobs.size() << " runs, up to " << m_parallel
+                  << " at a time, in " << m_seconds << " s (" << GetFailures() << " failed)"
+                  << std::endl;
+        std::cout << std::left << std::setw(24) << "  Output" << std::right << std::setw(8)
+                  << "flows" << std::setw(9) << "attacks" << std::setw(9) << "blocked"
+                  << std::setw(17) << "attacks blocked" << std::setw(10) << "degraded"
+                  << std::setw(10) << "seconds" << std::endl;
+        Result total;
+        for (size_t i = 0; i < m_jobs.size(); i++)
+        {
+            const Result& result = m_results[i];
+            std::cout << "  " << std::left << std::setw(22) << m_jobs[i].prefix << std::right;
+            if (!result.reported)
+            {
+                std::cout << "  failed: " << result.failure << ", see " << m_jobs[i].prefix
+                          << "-farm.log" << std::endl;
+                continue;
+            }
+            PrintCounts(result);
+            total.flows += result.flows;
+            total.attacks += result.attacks;
+            total.blocked += result.blocked;
+            total.blockedAttacks += result.blockedAttacks;
+            total.degraded += result.degraded;
+            total.seconds += result.seconds;
+        }
+        std::cout << "  " << std::left << std::setw(22) << "total" << std::right;
+        PrintCounts(total);
+        std::cout << "  Detection: " << total.blockedAttacks << " of " << total.attacks
+                  << " attack flows blocked, " << total.blocked - total.blockedAttacks
+                  << " normal flows blocked; child output in PREFIX-farm.log" << std::endl;
+    }
+
+  private:
+    struct Result
+    {
+        pid_t pid = -1;
+        int reportFd = -1; // read end of the child's report pipe
+        std::chrono::steady_clock::time_point start;
+        bool reported = false;
+        std::string failure;
+        uint32_t flows = 0;
+        uint32_t attacks = 0;
+        uint32_t blocked = 0;
+        uint32_t blockedAttacks = 0;
+        uint32_t degraded = 0;
+        double seconds = 0.0;
+    };
+
+    // Forks the child of job i. Returns true in the child.
+    bool StartChild(size_t i)
+    {
+        Result& result = m_results[i];
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            result.failure = "cannot create a pipe";
+            return false;
+        }
+        // Or the child would print the parent's buffered output again
+        std::cout.flush();
+        std::cerr.flush();
+        result.start = std::chrono::steady_clock::now();
+        result.pid = fork();
+        if (result.pid == 0)
+        {
+            close(fds[0]);
+            for (const Result& sibling : m_results)
+            {
+                if (sibling.reportFd >= 0)
+                {
+                    close(sibling.reportFd);
+                }
+            }
+            m_child = i;
+            m_reportFd = fds[1];
+            std::string log = m_jobs[i].prefix + "-farm.log";
+            int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd >= 0)
+            {
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+                close(fd);
+            }
+            return true;
+        }
+        close(fds[1]);
+        if (result.pid < 0)
+        {
+            close(fds[0]);
+            result.failure = "cannot fork";
+            return false;
+        }
+        result.reportFd = fds[0];
         return false;
     }
 
-    std::ostringstream json;
-    json << "{\"flowId\":" << flowId << ",\"srcIP\":\"" << srcIP << "\"" << ",\"dstIP\":\"" << dstIP
-         << "\"" << ",\"txPackets\":" << txPackets << ",\"rxPackets\":" << rxPackets
-         << ",\"txBytes\":" << txBytes << ",\"rxBytes\":" << rxBytes << ",\"duration\":" << duration
-         << ",\"throughput\":" << throughput << ",\"packetLoss\":" << packetLoss
-         << ",\"delay\":" << delay << ",\"jitter\":" << jitter << ",\"dstPort\":" << dstPort
-         << ",\"district\":\"" << district << "\"}";
+    // Collects the report of a child that has exited
+    void Finish(Result& result, int status)
+    {
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                       result.start)
+                             .count();
+        std::string text;
+        char buffer[256];
+        ssize_t n;
+        while ((n = read(result.reportFd, buffer, sizeof(buffer))) > 0)
+        {
+            text.append(buffer, n);
+        }
+        close(result.reportFd);
+        result.reportFd = -1;
+        result.pid = -1;
 
-    std::string jsonStr = json.str();
-    send(sock, jsonStr.c_str(), jsonStr.length(), 0);
+        std::istringstream line(text);
+        if (WIFSIGNALED(status))
+        {
+            result.failure = "killed by signal " + std::to_string(WTERMSIG(status));
+        }
+        else if (WEXITSTATUS(status) != 0)
+        {
+            result.failure = "exit status " + std::to_string(WEXITSTATUS(status));
+        }
+        else if (!(line >> result.flows >> result.attacks >> result.blocked >>
+                   result.blockedAttacks >> result.degraded))
+        {
+            result.failure = "no report";
+        }
+        else
+        {
+            result.reported = true;
+        }
+    }
 
-    char buffer[1024] = {0};
-    recv(sock, buffer, sizeof(buffer), 0);
-    close(sock);
+    static void PrintCounts(const Result& result)
+    {
+        std::cout << std::setw(8) << result.flows << std::setw(9) << result.attacks
+                  << std::setw(9) << result.blocked << std::setw(17) << result.blockedAttacks
+                  << std::setw(10) << result.degraded << std::fixed << std::setprecision(1)
+                  << std::setw(10) << result.seconds << std::defaultfloat << std::endl;
+    }
 
-    std::string response(buffer);
-    return response.find("\"shouldBlock\":true") != std::string::npos;
-}
+    std::vector<Job> m_jobs;
+    std::vector<Result> m_results;
+    uint32_t m_parallel;
+    double m_seconds = 0.0;
+    size_t m_child = 0;  // in a child, its job
+    int m_reportFd = -1; // in a child, the write end of its report pipe
+};
 
 int
 main(int argc, char* argv[])
@@ -101,17 +554,328 @@ main(int argc, char* argv[])
     bool generateAttacks = false;
     std::string scenario = "normal";
     double simTime = 180.0;
+    std::string firewallScorer = "service";
+    std::string forestModel = "saved_models/isolation_forest.txt";
+    std::string lofModel = "saved_models/lof_model.txt";
+    uint32_t lofSearchWidth = 0;
+    uint32_t forestTrees = 0;
+    uint32_t forestDepth = 0;
+    std::string forestPrecision = "float32";
+    bool cascade = false;
+    bool onlineDetector = false;
+    uint32_t onlineWindow = 256;
+    double onlineContamination = 0.05;
+    double cascadeBlockMargin = 0.01;
+    double cascadePassMargin = 0.01;
+    uint32_t cascadeChunk = 8;
+    std::string modelBundle = "";
+    double modelReload = 0.0;
+    std::string shadowBundle = "";
+    std::string transport = "tcp";
+    std::string transportPath = "";
+    uint32_t firewallConnections = 4;
+    uint32_t firewallShards = 1;
+    uint32_t firewallBatchSize = 256;
+    std::string firewallProtocol = "auto";
+    uint32_t firewallInFlight = 0;
+    FirewallPolicy firewallPolicy;
+    double firewallBudget = 0.0;
+    std::string modelMetadata = "saved_models/model_metadata.json";
+    std::string verdictCachePath = "";
+    uint32_t verdictCacheSize = 65536;
+    double sampleInterval = 0.0;
+    bool enforce = false;
+    uint32_t analysisThreads = 0;
+    std::string farmScenarios = "";
+    uint32_t farmRuns = 1;
+    uint32_t farmJobs = 0;
 
     CommandLine cmd;
     cmd.AddValue("attacks", "Generate attack traffic patterns", generateAttacks);
     cmd.AddValue("scenario", "Traffic scenario type", scenario);
     cmd.AddValue("time", "Simulation duration in seconds", simTime);
+    cmd.AddValue("firewallScorer",
+                 "Where flows are scored (service = ML firewall service, native = in-process "
+                 "Isolation Forest)",
+                 firewallScorer);
+    cmd.AddValue("forestModel",
+                 "Isolation Forest dump for the native scorer (written by export_models.py)",
+                 forestModel);
+    cmd.AddValue("lofModel",
+                 "LOF dump for the native scorer (written by export_models.py, empty = no LOF)",
+                 lofModel);
+    cmd.AddValue("lofSearchWidth",
+                 "Beam width of approximate LOF neighbor search (0 = exact KD-tree)",
+                 lofSearchWidth);
+    cmd.AddValue("forestTrees",
+                 "Trees of the forest the native scorer keeps (0 = all of them)",
+                 forestTrees);
+    cmd.AddValue("forestDepth",
+                 "Depth the native scorer cuts the trees to (0 = full depth)",
+                 forestDepth);
+    cmd.AddValue("forestPrecision",
+                 "Split thresholds of the native forest (float32, int16, or compiled: code "
+                 "generated by ml-firewall-codegen and linked in)",
+                 forestPrecision);
+    cmd.AddValue("cascade",
+                 "Cascade the native scorer: the forest settles clear-cut flows, often before "
+                 "its last tree, and the LOF decides those near iso_threshold (float32 forest "
+                 "only)",
+                 cascade);
+    cmd.AddValue("cascadeBlockMargin",
+                 "Scores this far below iso_threshold are blocked without the LOF",
+                 cascadeBlockMargin);
+    cmd.AddValue("cascadePassMargin",
+                 "Scores this far above iso_threshold are passed without the LOF",
+                 cascadePassMargin);
+    cmd.AddValue("cascadeChunk",
+                 "Trees walked between checks for an early exit of the cascade",
+                 cascadeChunk);
+    cmd.AddValue("onlineDetector",
+                 "Run Half-Space Trees alongside the firewall, learning from the flows of this "
+                 "run (reported, not enforced)",
+                 onlineDetector);
+    cmd.AddValue("onlineWindow",
+                 "Observations per reference window of the online detector",
+                 onlineWindow);
+    cmd.AddValue("onlineContamination",
+                 "Share of a window the online detector flags",
+                 onlineContamination);
+    cmd.AddValue("modelBundle",
+                 "Model bundle for the native scorer (written by ml-firewall-bundle, "
+                 "empty = the text dumps)",
+                 modelBundle);
+    cmd.AddValue("modelReload",
+                 "Seconds between checks of modelBundle for a retrained model, swapped in "
+                 "without pausing scoring (0 = never)",
+                 modelReload);
+    cmd.AddValue("shadowBundle",
+                 "Bundle of a candidate model scoring every decided flow on a thread of its own, "
+                 "compared with the verdicts in service (empty = no shadow)",
+                 shadowBundle);
+    cmd.AddValue("transport", "ML firewall transport (tcp, unix, shm)", transport);
+    cmd.AddValue("transportPath",
+                 "Unix socket path or shared-memory name of the ML firewall (empty = default)",
+                 transportPath);
+    cmd.AddValue("firewallConnections",
+                 "Persistent connections kept open to the ML firewall",
+                 firewallConnections);
+    cmd.AddValue("firewallShards",
+                 "ML firewall scorers sharing the flows by 5-tuple; shard i listens on the port "
+                 "after shard i-1, or at transportPath-i",
+                 firewallShards);
+    cmd.AddValue("firewallBatchSize",
+                 "Flows scored per ML firewall request (0 = one request per flow)",
+                 firewallBatchSize);
+    cmd.AddValue("firewallProtocol",
+                 "ML firewall wire protocol (auto = binary with JSON fallback, json)",
+                 firewallProtocol);
+    cmd.AddValue("firewallInFlight",
+                 "Pipelined ML firewall requests kept in flight (0 = use batch requests)",
+                 firewallInFlight);
+    cmd.AddValue("firewallTimeout",
+                 "Deadline of one ML firewall attempt in milliseconds (0 = none)",
+                 firewallPolicy.timeoutMs);
+    cmd.AddValue("firewallRetries",
+                 "Retries of a failed ML firewall attempt before falling back",
+                 firewallPolicy.maxRetries);
+    cmd.AddValue("firewallBreaker",
+                 "Consecutive ML firewall failures that open the circuit breaker (0 = never)",
+                 firewallPolicy.breakerThreshold);
+    cmd.AddValue("firewallBudget",
+                 "Wall-clock seconds allowed for ML firewall queries (0 = unlimited)",
+                 firewallBudget);
+    cmd.AddValue("modelMetadata",
+                 "model_metadata.json of the scorer's model (keys the verdict cache)",
+                 modelMetadata);
+    cmd.AddValue("verdictCache",
+                 "File persisting ML firewall verdicts between runs (empty = this run only)",
+                 verdictCachePath);
+    cmd.AddValue("verdictCacheSize", "Verdict cache slots", verdictCacheSize);
+    cmd.AddValue("sampleInterval",
+                 "Seconds of simulated time between live firewall passes (0 = post-simulation only)",
+                 sampleInterval);
+    cmd.AddValue("enforce",
+                 "Drop packets of flows flagged by live sampling at the gateways and core nodes",
+                 enforce);
+    cmd.AddValue("analysisThreads",
+                 "Threads building and scoring the final flow statistics, natively or as "
+                 "concurrent firewall queries (0 = one per hardware thread)",
+                 analysisThreads);
+    cmd.AddValue("farmScenarios",
+                 "Comma-separated scenarios run from one topology, each in a child process "
+                 "forked after routing (dataset = those of Dataset/, empty = just scenario)",
+                 farmScenarios);
+    cmd.AddValue("farmRuns",
+                 "RNG runs 1..farmRuns of each farm scenario; outputs of run r > 1 are named "
+                 "SCENARIO-runR",
+                 farmRuns);
+    cmd.AddValue("farmJobs",
+                 "Farm children running at once (0 = one per hardware thread)",
+                 farmJobs);
     cmd.Parse(argc, argv);
+    firewallPolicy.budgetMs = static_cast<uint32_t>(firewallBudget * 1000);
+
+    FirewallEndpoint endpoint;
+    if (!FirewallEndpoint::Parse(transport, transportPath, endpoint))
+    {
+        std::cerr << "Unknown ML firewall transport: " << transport << std::endl;
+        return 1;
+    }
+
+    // One job per farm scenario and run; normal is the only one without
+    // attacks
+    if (farmScenarios == "dataset")
+    {
+        farmScenarios = "normal,portscan,ddos,ransomware,botnet,medical,grid,supply,finance,"
+                        "recon,mitm6g,sidechannel,slicing,mlpoison,edge,quantum,gpsspoof,"
+                        "blockchain,mixed";
+    }
+    std::vector<ScenarioFarm::Job> farmJobList;
+    std::stringstream farmList(farmScenarios);
+    std::string farmScenario;
+    while (std::getline(farmList, farmScenario, ','))
+    {
+        for (uint32_t run = 1; run <= std::max<uint32_t>(1, farmRuns) && !farmScenario.empty();
+             run++)
+        {
+            ScenarioFarm::Job job;
+            job.scenario = farmScenario;
+            job.run = run;
+            job.prefix = run == 1 ? farmScenario : farmScenario + "-run" + std::to_string(run);
+            farmJobList.push_back(job);
+        }
+    }
+    if (!farmJobList.empty() && endpoint.transport == TRANSPORT_SHM && firewallScorer != "native")
+    {
+        std::cerr << "The shared-memory transport serves one process; farm scenarios over tcp "
+                     "or unix"
+                  << std::endl;
+        return 1;
+    }
+
+    NativeScorer nativeScorer;
+    bool native = firewallScorer == "native";
+    if (native && !modelBundle.empty() && !nativeScorer.LoadBundle(modelBundle))
+    {
+        std::cerr << "Cannot load native scorer from bundle " << modelBundle << std::endl;
+        return 1;
+    }
+    else if (native && modelBundle.empty() && !nativeScorer.Load(forestModel, modelMetadata))
+    {
+        std::cerr << "Cannot load native scorer from " << forestModel << " and " << modelMetadata
+                  << std::endl;
+        return 1;
+    }
+    else if (native && modelBundle.empty() && !lofModel.empty() && !nativeScorer.LoadLof(lofModel))
+    {
+        std::cerr << "Cannot load native LOF from " << lofModel << std::endl;
+        return 1;
+    }
+    else if (native && modelReload > 0 && modelBundle.empty())
+    {
+        std::cerr << "modelReload needs a modelBundle to watch" << std::endl;
+        return 1;
+    }
+    else if (!native && firewallScorer != "service")
+    {
+        std::cerr << "Unknown ML firewall scorer: " << firewallScorer << std::endl;
+        return 1;
+    }
+    else if (forestPrecision != "float32" && forestPrecision != "int16" &&
+             forestPrecision != "compiled")
+    {
+        std::cerr << "Unknown forest precision: " << forestPrecision << std::endl;
+        return 1;
+    }
+    else if (cascade && forestPrecision != "float32")
+    {
+        // The cascade walks the float32 trees itself and would leave the
+        // variant unused
+        std::cerr << "cascade cannot be combined with forestPrecision=" << forestPrecision
+                  << std::endl;
+        return 1;
+    }
+    // Reduces each loaded model to the configured variant
+    auto prepareScorer = [=](NativeScorer& scorer) {
+        if (scorer.GetLof().IsLoaded() && lofSearchWidth > 0)
+        {
+            scorer.UseApproximateLof(lofSearchWidth);
+        }
+        if ((forestTrees > 0 || forestDepth > 0) && !scorer.PruneForest(forestTrees, forestDepth))
+        {
+            return false;
+        }
+        if (cascade &&
+            !scorer.UseCascade(cascadeBlockMargin, cascadePassMargin, cascadeChunk))
+        {
+            return false;
+        }
+        if (forestPrecision == "compiled")
+        {
+            // Only the model the linked code was generated from passes
+            return scorer.UseCompiledForest(mlfw::GetLinkedCompiledForest());
+        }
+        return forestPrecision != "int16" || scorer.UseQuantizedForest();
+    };
+    if (native && !prepareScorer(nativeScorer))
+    {
+        std::cerr << "Cannot build the configured forest variant or cascade" << std::endl;
+        return 1;
+    }
+    // Scored as exported: the variant options above tune the model in service
+    std::shared_ptr<NativeScorer> candidate;
+    if (!shadowBundle.empty())
+    {
+        candidate = std::make_shared<NativeScorer>();
+        if (!candidate->LoadBundle(shadowBundle))
+        {
+            std::cerr << "Cannot load shadow model from bundle " << shadowBundle << std::endl;
+            return 1;
+        }
+    }
 
     std::cout << "Enhanced Smart City Network Simulation" << std::endl;
-    std::cout << "Scenario: " << scenario << std::endl;
-    std::cout << "Attacks: " << (generateAttacks ? "enabled" : "disabled") << std::endl;
+    if (farmJobList.empty())
+    {
+        std::cout << "Scenario: " << scenario << std::endl;
+        std::cout << "Attacks: " << (generateAttacks ? "enabled" : "disabled") << std::endl;
+    }
+    else
+    {
+        std::cout << "Scenario farm: " << farmScenarios << " (" << farmJobList.size()
+                  << " runs)" << std::endl;
+    }
     std::cout << "Duration: " << simTime << " seconds" << std::endl;
+    if (native)
+    {
+        std::cout << "Firewall scorer: native Isolation Forest ("
+                  << nativeScorer.GetForest().GetTrees() << " trees, " << forestPrecision << ")";
+        const LocalOutlierFactor& lof = nativeScorer.GetLof();
+        if (lof.IsLoaded())
+        {
+            std::cout << " and LOF (" << lof.GetSamples() << " samples, "
+                      << (lof.GetSearch() == LocalOutlierFactor::SEARCH_APPROXIMATE ? "HNSW"
+                                                                                    : "KD-tree")
+                      << ")";
+        }
+        if (nativeScorer.GetCascade().IsBuilt())
+        {
+            std::cout << ", cascaded outside [" << nativeScorer.GetCascade().GetLow() << ", "
+                      << nativeScorer.GetCascade().GetHigh() << "]";
+        }
+        std::cout << std::endl;
+        firewallInFlight = 0; // the pipelined client only talks to the service
+    }
+    else
+    {
+        std::cout << "Firewall transport: " << transport << std::endl;
+    }
+    if (candidate)
+    {
+        std::cout << "Shadow model: " << candidate->GetModelVersion() << " trained "
+                  << candidate->GetTrainingDate() << " (" << shadowBundle << ")" << std::endl;
+    }
 
     // NETWORK TOPOLOGY
     // Core infrastructure
@@ -597,6 +1361,32 @@ main(int argc, char* argv[])
     // Enable routing
     Ipv4GlobalRoutingHelper::PopulateRoutingTables();
 
+    // SCENARIO FARM
+    // Everything above is shared by the farm's scenarios; from here on each
+    // runs in a child of its own, which carries on with the rest of main()
+    std::string outputPrefix = scenario;
+    std::unique_ptr<ScenarioFarm> farm;
+    if (!farmJobList.empty())
+    {
+        if (farmJobs == 0)
+        {
+            farmJobs = std::max(1u, std::thread::hardware_concurrency());
+        }
+        farm.reset(new ScenarioFarm(farmJobList, farmJobs));
+        if (!farm->Fork())
+        {
+            farm->PrintSummary();
+            Simulator::Destroy();
+            return farm->GetFailures() > 0 ? 1 : 0;
+        }
+        const ScenarioFarm::Job& job = farm->GetJob();
+        scenario = job.scenario;
+        outputPrefix = job.prefix;
+        generateAttacks = scenario != "normal";
+        RngSeedManager::SetRun(job.run);
+        std::cout << "Scenario: " << scenario << " (run " << job.run << ")" << std::endl;
+    }
+
     //  TRAFFIC PATTERNS
     // 1. Multi-district emergency coordination
     UdpServerHelper emergencyServer(8100);
@@ -1286,7 +2076,7 @@ main(int argc, char* argv[])
     }
 
     // PACKET CAPTURE AND MONITORING
-    std::string pcapPrefix = scenario + "-enhanced-smartcity";
+    std::string pcapPrefix = outputPrefix + "-enhanced-smartcity";
 
     // Enable packet capture for all major links
     // homeFiber.EnablePcapAll(pcapPrefix + "-home");
@@ -1309,7 +2099,7 @@ main(int argc, char* argv[])
 
     // NETWORK ANIMATION
 
-    AnimationInterface anim(scenario + "-enhanced-smartcity.xml");
+    AnimationInterface anim(outputPrefix + "-enhanced-smartcity.xml");
 
     // Enhanced node descriptions
     anim.UpdateNodeDescription(coreNodes.Get(0), "PRIMARY-CORE");
@@ -1461,6 +2251,116 @@ main(int argc, char* argv[])
                   sensors.GetN())
               << " end devices..." << std::endl;
 
+    // AI FIREWALL
+    MLFirewallClient::Protocol protocol = firewallProtocol == "json"
+                                              ? MLFirewallClient::PROTOCOL_JSON
+                                              : MLFirewallClient::PROTOCOL_AUTO;
+    // Watches the bundle from a thread of its own; each batch is scored by
+    // whichever model was in service when it started
+    std::unique_ptr<ModelReloader> reloader;
+    if (native && modelReload > 0)
+    {
+        reloader.reset(new ModelReloader(
+            modelBundle,
+            std::chrono::milliseconds(static_cast<int64_t>(modelReload * 1000)),
+            prepareScorer));
+        if (!reloader->Start())
+        {
+            std::cerr << "Cannot load native scorer from bundle " << modelBundle << std::endl;
+            return 1;
+        }
+    }
+
+    // Safe to call from several threads at once: the models are only read
+    LocalScorer scoreNatively = [&nativeScorer, &reloader](const FlowQuery* queries,
+                                                           size_t count,
+                                                           FlowVerdict* verdicts) {
+        if (reloader)
+        {
+            reloader->Acquire()->ScoreBatch(queries, count, verdicts);
+        }
+        else
+        {
+            nativeScorer.ScoreBatch(queries, count, verdicts);
+        }
+    };
+    std::vector<FirewallEndpoint> shardEndpoints;
+    for (uint32_t i = 0; i < std::max<uint32_t>(1, firewallShards); i++)
+    {
+        shardEndpoints.push_back(mlfw::GetShardEndpoint(endpoint, i));
+    }
+    if (shardEndpoints.size() > 1 && firewallInFlight > 0)
+    {
+        std::cout << "Warning: pipelined requests (firewallInFlight) all go to the first shard"
+                  << std::endl;
+    }
+    ShardedFirewallClient firewall(shardEndpoints, firewallConnections, protocol, firewallPolicy);
+    if (native)
+    {
+        firewall.SetLocalScorer(scoreNatively);
+    }
+    MLFirewallAsyncClient pipelinedFirewall(endpoint,
+                                            firewallConnections,
+                                            firewallInFlight,
+                                            protocol,
+                                            firewallPolicy);
+
+    // The native scorer's tag also tells its variants apart
+    uint32_t modelTag = native ? nativeScorer.GetModelTag() : mlfw::ReadModelTag(modelMetadata);
+    if (modelTag == 0)
+    {
+        std::cout << "Warning: cannot read " << modelMetadata
+                  << "; cached verdicts are not tied to a model version" << std::endl;
+    }
+    VerdictCache verdictCache(modelTag, verdictCacheSize, verdictCachePath);
+
+    LiveFirewallSampler sampler(monitor,
+                                DynamicCast<Ipv4FlowClassifier>(flowMonitor.GetClassifier()),
+                                firewall,
+                                verdictCache,
+                                firewallBatchSize > 0 ? firewallBatchSize : 256);
+    // Learns this run's traffic as it goes: from every live pass, then from
+    // the final flow statistics
+    HalfSpaceTrees online(mlfw::N_FEATURES, 25, 8, onlineWindow, onlineContamination);
+    if (onlineDetector)
+    {
+        sampler.SetOnlineDetector(&online);
+    }
+    // Sees every verdict the firewall gives, live and final, without
+    // delaying any of them
+    std::unique_ptr<ShadowScorer> shadow;
+    if (candidate)
+    {
+        shadow.reset(new ShadowScorer(candidate));
+        sampler.SetShadow(shadow.get());
+    }
+    if (sampleInterval > 0)
+    {
+        sampler.Start(Seconds(sampleInterval));
+    }
+
+    // Data-path enforcement at every district gateway and core node
+    FlowBlocklist blocklist;
+    std::vector<Ptr<FirewallEnforcer>> enforcers;
+    if (enforce)
+    {
+        if (sampleInterval <= 0)
+        {
+            std::cout << "Warning: enforce needs sampleInterval > 0; nothing is flagged before "
+                         "the simulation ends"
+                      << std::endl;
+        }
+        sampler.SetBlocklist(&blocklist);
+        NodeContainer enforcementPoints(homeGW, officeGW, universityGW, iotGW, hospitalGW);
+        enforcementPoints.Add(powerGW);
+        enforcementPoints.Add(financeGW);
+        enforcementPoints.Add(coreNodes);
+        for (uint32_t i = 0; i < enforcementPoints.GetN(); i++)
+        {
+            enforcers.push_back(FirewallEnforcer::Install(enforcementPoints.Get(i), blocklist));
+        }
+    }
+
     // RUN SIMULATION
     Simulator::Stop(Seconds(simTime));
     Simulator::Run();
@@ -1481,51 +2381,228 @@ main(int argc, char* argv[])
 
     uint32_t totalFlows = 0;
     uint32_t blockedFlows = 0;
+    uint32_t degradedFlows = 0;
+    std::map<uint32_t, uint32_t> verdictsByModel; // model tag -> final verdicts
+    uint32_t onlineScored = 0;
+    uint32_t onlineFlagged = 0;
+    uint32_t onlineAlsoBlocked = 0;
+    uint32_t cascadeExits[mlfw::N_CASCADE_STAGES] = {};
+    uint32_t districtFlows[mlfw::N_DISTRICTS] = {};
+    uint32_t districtLofExits[mlfw::N_DISTRICTS] = {};
+    uint32_t flaggedLive = 0;
+    double detectionDelaySum = 0.0;
+
+    // Service seen by the critical districts: delay and loss of the flows the
+    // firewall lets through, and how much flagged traffic was still delivered.
+    // Compare a run with enforce=1 against one without.
+    struct DistrictImpact
+    {
+        uint32_t passedFlows = 0;
+        uint64_t txPackets = 0;
+        uint64_t rxPackets = 0;
+        double delaySum = 0.0;
+        uint32_t flaggedFlows = 0;
+        uint64_t flaggedRxPackets = 0;
+    };
+    std::map<std::string, DistrictImpact> impact = {{"Hospital", {}}, {"PowerGrid", {}}};
+
+    // Gather every flow first so the scorer sees the whole batch at once. In
+    // pipelined mode each flow is submitted as soon as its metrics are ready
+    // and verdicts arrive while the remaining flows are being computed. Flows
+    // answered by the verdict cache are not sent at all.
+    //
+    // The flows are copied out of the map in FlowId order. Their queries are
+    // built, and with the native scorer scored, in chunks on the analysis
+    // pool; every result lands at its flow's index, so the report below
+    // comes out in FlowId order whatever the number of threads.
+    auto analysisStart = std::chrono::steady_clock::now();
+    WorkStealingPool pool(analysisThreads);
+    size_t analysisGrain = firewallBatchSize > 0 ? firewallBatchSize : 256;
+    if (reloader)
+    {
+        verdictCache.SetModelTag(reloader->Acquire()->GetModelTag());
+    }
+    std::vector<std::pair<FlowId, FlowMonitor::FlowStats>> flows(flowStats.begin(),
+                                                                  flowStats.end());
+    std::vector<Ipv4FlowClassifier::FiveTuple> tuples(flows.size());
+    std::vector<FlowQuery> queries(flows.size());
+    std::vector<FlowVerdict> verdicts(flows.size());
+    std::vector<size_t> misses; // indices into queries of flows to score
+
+    // FindFlow() searches the classifier's flows one by one, so this is the
+    // quadratic part of the analysis; the classifier is only read. The
+    // tuples are kept for the export below.
+    pool.ParallelFor(flows.size(), analysisGrain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            tuples[i] = classifier->FindFlow(flows[i].first);
+            queries[i] = MakeFlowQuery(flows[i].first, tuples[i], flows[i].second);
+        }
+    });
 
-    for (auto& flow : flowStats)
+    if (firewallInFlight > 0)
     {
-        Ipv4FlowClassifier::FiveTuple flowTuple = classifier->FindFlow(flow.first);
-        FlowMonitor::FlowStats stats = flow.second;
+        // Live sampling left the scorer connections of firewall open; an
+        // shm ring pair serves one of them or pipelinedFirewall, not both
+        firewall.CloseIdle();
+    }
+    for (size_t index = 0; index < queries.size(); index++)
+    {
+        const FlowQuery& query = queries[index];
+        if (verdictCache.Lookup(query, verdicts[index]))
+        {
+            continue;
+        }
 
-        double duration = (stats.timeLastRxPacket - stats.timeFirstTxPacket).GetSeconds();
-        double throughput = duration > 0 ? (stats.rxBytes * 8.0) / duration : 0.0;
-        double packetLoss = stats.txPackets > 0
-                                ? (double)(stats.txPackets - stats.rxPackets) / stats.txPackets
-                                : 0.0;
-        double avgDelay =
-            stats.rxPackets > 0 ? (stats.delaySum.GetSeconds() / stats.rxPackets) : 0.0;
-        double jitter =
-            stats.rxPackets > 1 ? (stats.jitterSum.GetSeconds() / (stats.rxPackets - 1)) : 0.0;
+        if (firewallInFlight > 0)
+        {
+            pipelinedFirewall.Submit(query, [&, index](const FlowVerdict& verdict) {
+                verdicts[index] = verdict;
+                verdictCache.Insert(queries[index], verdict);
+            });
+        }
+        else
+        {
+            misses.push_back(index);
+        }
+    }
 
-        std::string district = GetDistrictFromIP(flowTuple.sourceAddress);
-
-        // Query ML firewall
-        bool shouldBlock = QueryMLFirewall(flow.first,
-                                           flowTuple.sourceAddress,
-                                           flowTuple.destinationAddress,
-                                           flowTuple.destinationPort,
-                                           stats.txPackets,
-                                           stats.rxPackets,
-                                           stats.txBytes,
-                                           stats.rxBytes,
-                                           duration,
-                                           throughput,
-                                           packetLoss,
-                                           avgDelay,
-                                           jitter,
-                                           district);
+    // Query ML firewall
+    if (firewallInFlight > 0)
+    {
+        pipelinedFirewall.Flush();
+    }
+    else if (native)
+    {
+        std::vector<FlowQuery> missQueries;
+        std::vector<FlowVerdict> missVerdicts(misses.size());
+        for (size_t index : misses)
+        {
+            missQueries.push_back(queries[index]);
+        }
+        pool.ParallelFor(misses.size(), analysisGrain, [&](size_t begin, size_t end) {
+            scoreNatively(&missQueries[begin], end - begin, &missVerdicts[begin]);
+        });
+        for (size_t i = 0; i < misses.size(); i++)
+        {
+            verdicts[misses[i]] = missVerdicts[i];
+            verdictCache.Insert(missQueries[i], missVerdicts[i]);
+        }
+    }
+    else
+    {
+        // Chunks go out from the pool at once, each over a pooled connection
+        // of its shard; over shm the threads take turns on the ring pair
+        pool.ParallelFor(misses.size(), analysisGrain, [&](size_t begin, size_t end) {
+            if (firewallBatchSize > 0)
+            {
+                std::vector<FlowQuery> chunk;
+                std::vector<FlowVerdict> chunkVerdicts;
+                for (size_t i = begin; i < end; i++)
+                {
+                    chunk.push_back(queries[misses[i]]);
+                }
+                firewall.QueryBatch(chunk, chunkVerdicts, firewallBatchSize);
+                for (size_t i = begin; i < end; i++)
+                {
+                    verdicts[misses[i]] = chunkVerdicts[i - begin];
+                }
+                return;
+            }
+            for (size_t i = begin; i < end; i++)
+            {
+                firewall.Query(queries[misses[i]], verdicts[misses[i]]);
+            }
+        });
+        for (size_t index : misses)
+        {
+            verdictCache.Insert(queries[index], verdicts[index]);
+        }
+    }
+
+    double analysisSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - analysisStart).count();
+    if (shadow)
+    {
+        shadow->Submit(queries.data(), verdicts.data(), queries.size());
+    }
+
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+        const FlowQuery& query = queries[i];
+        const FlowMonitor::FlowStats& stats = flows[i].second;
+
+        Time flaggedAt;
+        double detectionDelay = 0.0;
+        bool live = sampler.GetFirstFlagged(query.flowId, flaggedAt);
+        if (live)
+        {
+            detectionDelay = (flaggedAt - stats.timeFirstTxPacket).GetSeconds();
+            flaggedLive++;
+            detectionDelaySum += detectionDelay;
+        }
+
+        std::string srcDistrict = GetDistrictFromIP(Ipv4Address(query.srcAddress));
+        std::string dstDistrict = GetDistrictFromIP(Ipv4Address(query.dstAddress));
+        for (auto& district : impact)
+        {
+            if (srcDistrict != district.first && dstDistrict != district.first)
+            {
+                continue;
+            }
+            DistrictImpact& d = district.second;
+            if (verdicts[i].shouldBlock)
+            {
+                d.flaggedFlows++;
+                d.flaggedRxPackets += stats.rxPackets;
+            }
+            else
+            {
+                d.passedFlows++;
+                d.txPackets += stats.txPackets;
+                d.rxPackets += stats.rxPackets;
+                d.delaySum += stats.delaySum.GetSeconds();
+            }
+        }
+
+        if (onlineDetector)
+        {
+            double features[mlfw::N_FEATURES];
+            ComputeModelFeatures(query, features);
+            double onlineScore = online.Update(features);
+            onlineScored += !std::isnan(onlineScore);
+            if (onlineScore <= 0)
+            {
+                onlineFlagged++;
+                onlineAlsoBlocked += verdicts[i].shouldBlock;
+            }
+        }
 
         totalFlows++;
-        if (shouldBlock)
+        verdictsByModel[verdicts[i].modelTag]++;
+        cascadeExits[verdicts[i].stage]++;
+        districtFlows[query.district]++;
+        districtLofExits[query.district] += verdicts[i].stage == mlfw::STAGE_LOF;
+        if (verdicts[i].degraded)
+        {
+            degradedFlows++;
+        }
+        if (verdicts[i].shouldBlock)
         {
             blockedFlows++;
 
-            std::cout << "[THREAT BLOCKED] Flow " << flow.first << std::endl;
-            std::cout << "  " << flowTuple.sourceAddress << " -> " << flowTuple.destinationAddress
-                      << ":" << flowTuple.destinationPort << std::endl;
-            std::cout << "  District: " << district << std::endl;
-            std::cout << "  Duration: " << duration << "s | Loss: " << packetLoss * 100 << "%"
-                      << std::endl;
+            std::cout << "[THREAT BLOCKED] Flow " << query.flowId
+                      << (verdicts[i].degraded ? " [DEGRADED: fallback verdict]" : "") << std::endl;
+            std::cout << "  " << Ipv4Address(query.srcAddress) << " -> "
+                      << Ipv4Address(query.dstAddress) << ":" << query.dstPort << std::endl;
+            std::cout << "  District: " << mlfw::GetDistrictName(query.district) << std::endl;
+            std::cout << "  Duration: " << query.duration << "s | Loss: " << query.packetLoss * 100
+                      << "%" << std::endl;
+            if (live)
+            {
+                std::cout << "  First flagged at " << flaggedAt.GetSeconds() << "s ("
+                          << detectionDelay << "s after its first packet)" << std::endl;
+            }
         }
     }
 
@@ -1533,18 +2610,145 @@ main(int argc, char* argv[])
     std::cout << "Total flows: " << totalFlows << std::endl;
     std::cout << "Blocked threats: " << blockedFlows << std::endl;
     std::cout << "Protection rate: " << (double)blockedFlows / totalFlows * 100 << "%" << std::endl;
+    std::cout << "Analysis: " << queries.size() << " flows in " << analysisSeconds * 1000
+              << " ms on " << pool.GetThreads() << " threads (" << pool.GetSteals()
+              << " chunks stolen)" << std::endl;
+    std::cout << "Firewall connections opened: " << firewall.GetConnectionsOpened() << " ("
+              << firewall.GetBinaryConnections() << " binary)" << std::endl;
+    if (firewall.GetShards() > 1)
+    {
+        std::cout << "Scorer shards: " << firewall.GetLiveShards() << "/" << firewall.GetShards()
+                  << " live, " << firewall.GetOutages() << " outages; flows scored per shard:";
+        for (uint32_t s = 0; s < firewall.GetShards(); s++)
+        {
+            std::cout << " " << firewall.GetShardFlows(s);
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "Degraded verdicts: " << degradedFlows << " (rule-based fallback, breaker trips: "
+              << firewall.GetBreakerTrips() + pipelinedFirewall.GetBreakerTrips() << ")"
+              << std::endl;
+    if (sampleInterval > 0)
+    {
+        std::cout << "Live sampling: " << sampler.GetPasses() << " passes every " << sampleInterval
+                  << "s, " << sampler.GetScoredFlows() << " flow scorings, "
+                  << sampler.GetSkippedFlows() << " idle flows skipped" << std::endl;
+        std::cout << "Flagged during simulation: " << flaggedLive << " flows";
+        if (flaggedLive > 0)
+        {
+            std::cout << ", mean " << detectionDelaySum / flaggedLive
+                      << "s from first packet to detection";
+        }
+        std::cout << std::endl;
+    }
+    if (reloader)
+    {
+        reloader->Stop();
+        std::cout << "Model reloads: " << reloader->GetSwaps() - 1 << " swaps, "
+                  << reloader->GetFailures() << " bundles rejected; final verdicts by model tag:";
+        for (auto& model : verdictsByModel)
+        {
+            std::cout << " " << std::hex << model.first << std::dec << " (" << model.second << ")";
+        }
+        std::cout << std::endl;
+    }
+    if (onlineDetector)
+    {
+        std::cout << "Online detector: " << online.GetObservations() << " observations, "
+                  << online.GetWindows() << " windows of " << online.GetWindow() << "; "
+                  << onlineFlagged << " of " << onlineScored << " final flows scored flagged ("
+                  << onlineAlsoBlocked << " also blocked by the firewall), "
+                  << online.GetMemoryBytes() << " bytes" << std::endl;
+    }
+    if (cascade && native)
+    {
+        // Verdicts from the cache were not scored again and count as none
+        std::cout << "Cascade exits:";
+        for (uint8_t stage = 0; stage < mlfw::N_CASCADE_STAGES; stage++)
+        {
+            std::cout << " " << mlfw::GetCascadeStageName(stage) << " " << cascadeExits[stage];
+        }
+        std::cout << "; flows reaching the LOF:";
+        for (uint8_t district : {mlfw::DISTRICT_HOSPITAL, mlfw::DISTRICT_POWER_GRID})
+        {
+            std::cout << " " << mlfw::GetDistrictName(district) << " "
+                      << districtLofExits[district] << "/" << districtFlows[district];
+        }
+        std::cout << std::endl;
+    }
+    uint64_t cacheLookups = verdictCache.GetHits() + verdictCache.GetMisses();
+    std::cout << "Verdict cache: " << verdictCache.GetHits() << " hits, "
+              << verdictCache.GetMisses() << " misses ("
+              << (cacheLookups > 0 ? 100.0 * verdictCache.GetHits() / cacheLookups : 0.0)
+              << "% hit rate), " << verdictCache.GetSize() << "/" << verdictCache.GetCapacity()
+              << " entries" << (verdictCache.IsPersistent() ? ", persisted to " + verdictCachePath : "")
+              << std::endl;
+
+    std::cout << "Mitigation impact (enforcement " << (enforce ? "on" : "off") << "):" << std::endl;
+    for (auto& district : impact)
+    {
+        const DistrictImpact& d = district.second;
+        std::cout << "  " << district.first << ": " << d.passedFlows << " passed flows, mean delay "
+                  << (d.rxPackets > 0 ? d.delaySum / d.rxPackets * 1000 : 0.0) << " ms, loss "
+                  << (d.txPackets > 0 ? 100.0 * (d.txPackets - d.rxPackets) / d.txPackets : 0.0)
+                  << "% | " << d.flaggedFlows << " flagged flows, " << d.flaggedRxPackets
+                  << " of their packets delivered" << std::endl;
+    }
+    if (enforce)
+    {
+        uint64_t inspected = 0, dropped = 0;
+        for (auto& enforcer : enforcers)
+        {
+            inspected += enforcer->GetInspectedPackets();
+            dropped += enforcer->GetDroppedPackets();
+        }
+        std::cout << "  Enforcement: " << blocklist.GetSize() << " flows blocklisted, " << dropped
+                  << " of " << inspected << " forwarded packets dropped at " << enforcers.size()
+                  << " nodes" << std::endl;
+    }
 
     // Enhanced flow data export for ML training
-    std::string csvFilename = scenario + "-enhanced-flows.csv";
+    std::string csvFilename = outputPrefix + "-enhanced-flows.csv";
     std::ofstream csvFile(csvFilename);
     csvFile << "FlowId,SrcIP,DstIP,SrcPort,DstPort,Protocol,TxPackets,RxPackets,TxBytes,RxBytes,"
                "Duration,Throughput,PacketLoss,Delay,Jitter,District,TrafficType,Label\n";
 
-    uint32_t normalFlows = 0, attackFlows = 0;
+    // The firewall's raw scores and verdict for every flow, next to its
+    // label, so thresholds can be tuned offline (ml-firewall-sweep) without
+    // re-running the simulation. Scores are NaN where the scorer gave none.
+    // Stage is the cascade stage that settled the flow; the IsoScore of a
+    // flow settled by part of the trees is extrapolated, not exact.
+    std::string scoresFilename = outputPrefix + "-flow-scores.csv";
+    std::ofstream scoresFile(scoresFilename);
+    scoresFile << "FlowId,District,TrafficType,Label,IsoScore,LofFactor,Blocked,Degraded,Stage\n";
+    scoresFile << std::setprecision(9);
+
+    // Final verdicts of the shadow model against those in service, by the
+    // district and traffic type the flow CSV gives each flow
+    struct ShadowTally
+    {
+        uint32_t flows = 0;
+        uint32_t blockedInService = 0; // and passed by the candidate
+        uint32_t blockedByCandidate = 0;
+    };
+    std::map<std::string, ShadowTally> shadowByDistrict, shadowByType;
+    std::string shadowFilename = outputPrefix + "-shadow-verdicts.csv";
+    std::ofstream shadowFile;
+    if (shadow)
+    {
+        shadow->Drain();
+        shadowFile.open(shadowFilename);
+        shadowFile << "FlowId,District,TrafficType,Label,Blocked,IsoScore,ShadowBlocked,"
+                      "ShadowIsoScore,ShadowLofFactor\n"
+                   << std::setprecision(9);
+    }
+
+    uint32_t normalFlows = 0, attackFlows = 0, blockedAttackFlows = 0;
 
-    for (auto& flow : flowStats)
+    for (size_t i = 0; i < flows.size(); i++)
     {
-        Ipv4FlowClassifier::FiveTuple flowTuple = classifier->FindFlow(flow.first);
+        const std::pair<FlowId, FlowMonitor::FlowStats>& flow = flows[i];
+        const Ipv4FlowClassifier::FiveTuple& flowTuple = tuples[i];
         FlowMonitor::FlowStats stats = flow.second;
 
         double duration = (stats.timeLastRxPacket - stats.timeFirstTxPacket).GetSeconds();
@@ -1700,11 +2904,67 @@ main(int argc, char* argv[])
                 << stats.rxBytes << "," << duration << "," << throughput << "," << packetLoss << ","
                 << avgDelay << "," << jitter << "," << district << "," << trafficType << ","
                 << label << "\n";
+        scoresFile << flow.first << "," << district << "," << trafficType << "," << label << ","
+                   << verdicts[i].isoScore << "," << verdicts[i].lofFactor << ","
+                   << verdicts[i].shouldBlock << "," << verdicts[i].degraded << ","
+                   << mlfw::GetCascadeStageName(verdicts[i].stage) << "\n";
+        blockedAttackFlows += label == 1 && verdicts[i].shouldBlock;
+
+        ShadowComparison comparison;
+        if (shadow && !verdicts[i].degraded && shadow->GetComparison(flow.first, comparison))
+        {
+            const FlowVerdict& production = comparison.production;
+            const FlowVerdict& candidate = comparison.candidate;
+            for (ShadowTally* tally : {&shadowByDistrict[district], &shadowByType[trafficType]})
+            {
+                tally->flows++;
+                tally->blockedInService += production.shouldBlock && !candidate.shouldBlock;
+                tally->blockedByCandidate += candidate.shouldBlock && !production.shouldBlock;
+            }
+            shadowFile << flow.first << "," << district << "," << trafficType << "," << label
+                       << "," << production.shouldBlock << "," << production.isoScore << ","
+                       << candidate.shouldBlock << "," << candidate.isoScore << ","
+                       << candidate.lofFactor << "\n";
+        }
     }
     csvFile.close();
+    scoresFile.close();
+
+    if (shadow)
+    {
+        shadowFile.close();
+        uint32_t compared = 0, blockedInService = 0, blockedByCandidate = 0;
+        for (auto& district : shadowByDistrict)
+        {
+            compared += district.second.flows;
+            blockedInService += district.second.blockedInService;
+            blockedByCandidate += district.second.blockedByCandidate;
+        }
+        std::cout << "\nShadow model " << shadow->GetCandidate().GetModelVersion() << ": "
+                  << blockedInService + blockedByCandidate << " of " << compared
+                  << " final verdicts differ (" << blockedInService
+                  << " blocked only in service, " << blockedByCandidate
+                  << " only by the candidate)" << std::endl;
+        std::cout << "  " << shadow->GetCompared() << " verdicts compared during the run, "
+                  << shadow->GetDisagreements() << " differing, " << shadow->GetDropped()
+                  << " dropped; " << shadow->GetSubmitSeconds() * 1000
+                  << " ms handing them over, " << shadow->GetScoreSeconds() * 1000
+                  << " ms scoring on the shadow thread" << std::endl;
+        for (auto* tallies : {&shadowByDistrict, &shadowByType})
+        {
+            std::cout << (tallies == &shadowByDistrict ? "  By district:" : "  By traffic type:");
+            for (auto& tally : *tallies)
+            {
+                std::cout << " " << tally.first << " "
+                          << tally.second.blockedInService + tally.second.blockedByCandidate << "/"
+                          << tally.second.flows;
+            }
+            std::cout << std::endl;
+        }
+    }
 
     // Export XML flow data
-    monitor->SerializeToXmlFile(scenario + "-enhanced-flows.xml", true, true);
+    monitor->SerializeToXmlFile(outputPrefix + "-enhanced-flows.xml", true, true);
 
     // Enhanced summary
     std::cout << "\nEnhanced Smart City Simulation completed!" << std::endl;
@@ -1726,8 +2986,13 @@ main(int argc, char* argv[])
     std::cout << "\nGenerated Files:" << std::endl;
     std::cout << "  PCAP files: " << pcapPrefix << "-*.pcap" << std::endl;
     std::cout << "  Flow CSV: " << csvFilename << std::endl;
-    std::cout << "  Flow XML: " << scenario << "-enhanced-flows.xml" << std::endl;
-    std::cout << "  NetAnim: " << scenario << "-enhanced-smartcity.xml" << std::endl;
+    std::cout << "  Flow scores: " << scoresFilename << std::endl;
+    if (shadow)
+    {
+        std::cout << "  Shadow verdicts: " << shadowFilename << std::endl;
+    }
+    std::cout << "  Flow XML: " << outputPrefix << "-enhanced-flows.xml" << std::endl;
+    std::cout << "  NetAnim: " << outputPrefix << "-enhanced-smartcity.xml" << std::endl;
 
     std::cout << "\nFlow Analysis:" << std::endl;
     std::cout << "  Total flows: " << flowStats.size() << std::endl;
@@ -1738,6 +3003,14 @@ main(int argc, char* argv[])
     {
         std::cout << "  Attack scenarios executed: " << scenario << std::endl;
     }
+    if (farm)
+    {
+        farm->Report(flowStats.size(),
+                     attackFlows,
+                     blockedFlows,
+                     blockedAttackFlows,
+                     degradedFlows);
+    }
 
     Simulator::Destroy();
     return 0;
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Export the models in saved_models/ for the native C++ scorers.
+
+Writes saved_models/isolation_forest.txt, read by ml-firewall-forest.h:
+
+    mlfw-forest 1
+    features 16
+    scaler_mean <16 values>
+    scaler_scale <16 values>
+    estimators <n>
+    average_path_length <c(max_samples)>
+    offset <offset_>
+    tree <node_count>
+    <feature> <threshold> <left> <right> <path_length>    one line per node
+    ...
+
+Nodes are in sklearn's order. Features are already mapped through
+estimators_features_. For a leaf, left and right are -1 and path_length is
+depth + c(n_node_samples) - 1, the amount sklearn adds to a sample's depth
+when it ends there. Floats are written with repr(), so they read back exactly.
+
+Also writes saved_models/lof_model.txt, read by ml-firewall-lof.h:
+
+    mlfw-lof 1
+    features 16
+    scaler_mean <16 values>
+    scaler_scale <16 values>
+    neighbors <n_neighbors_>
+    samples <n_samples_fit_>
+    offset <offset_>
+    <16 coordinates> <k_distance> <lrd>               one line per training sample
+
+Coordinates are the scaled training samples. k_distance is the distance to
+the sample's n_neighbors-th neighbor and lrd its local reachability density,
+both as computed by fit().
+
+ml-firewall-bundle packs both dumps and model_metadata.json into
+saved_models/model_bundle.mlfw, which the native scorer maps instead of
+parsing them.
+
+With --reference, also writes sklearn's decision_function and LOF factor
+(-score_samples) for every row of Dataset/*.csv. ml-firewall-parity compares
+the native scorers against them.
+"""
+
+import argparse
+import glob
+import os
+import pickle
+
+import numpy as np
+import pandas as pd
+from sklearn.ensemble._iforest import _average_path_length
+
+FORMAT_VERSION = 1
+
+
+def load_models(model_dir):
+    """Load the pickled IsolationForest, LocalOutlierFactor and StandardScaler"""
+
+    with open(os.path.join(model_dir, 'isolation_forest_model.pkl'), 'rb') as f:
+        iso = pickle.load(f)
+    with open(os.path.join(model_dir, 'lof_model.pkl'), 'rb') as f:
+        lof = pickle.load(f)
+    with open(os.path.join(model_dir, 'feature_scaler.pkl'), 'rb') as f:
+        scaler = pickle.load(f)
+    return iso, lof, scaler
+
+
+def write_scaler(f, scaler):
+    f.write("scaler_mean " + " ".join(repr(float(v)) for v in scaler.mean_) + "\n")
+    f.write("scaler_scale " + " ".join(repr(float(v)) for v in scaler.scale_) + "\n")
+
+
+def tree_path_lengths(tree):
+    """Per-node depth + c(n_node_samples) - 1, meaningful for leaves"""
+
+    depths = np.zeros(tree.node_count, dtype=np.int64)
+    stack = [(0, 1)]  # sklearn counts the root as depth 1
+    while stack:
+        node, depth = stack.pop()
+        depths[node] = depth
+        if tree.children_left[node] != -1:
+            stack.append((tree.children_left[node], depth + 1))
+            stack.append((tree.children_right[node], depth + 1))
+    return depths + _average_path_length(tree.n_node_samples) - 1.0
+
+
+def export_forest(iso, scaler, path):
+    """Write the scaler and every tree of the forest to path"""
+
+    n_features = iso.n_features_in_
+    with open(path, 'w') as f:
+        f.write(f"mlfw-forest {FORMAT_VERSION}\n")
+        f.write(f"features {n_features}\n")
+        write_scaler(f, scaler)
+        f.write(f"estimators {len(iso.estimators_)}\n")
+        f.write(f"average_path_length {float(_average_path_length([iso._max_samples])[0])!r}\n")
+        f.write(f"offset {float(iso.offset_)!r}\n")
+
+        for estimator, features in zip(iso.estimators_, iso.estimators_features_):
+            tree = estimator.tree_
+            path_lengths = tree_path_lengths(tree)
+            f.write(f"tree {tree.node_count}\n")
+            for node in range(tree.node_count):
+                left = int(tree.children_left[node])
+                if left == -1:
+                    f.write(f"-1 0.0 -1 -1 {float(path_lengths[node])!r}\n")
+                else:
+                    feature = int(features[tree.feature[node]])
+                    f.write(f"{feature} {float(tree.threshold[node])!r} {left} "
+                            f"{int(tree.children_right[node])} 0.0\n")
+
+    print(f"Isolation Forest exported to {path}: {len(iso.estimators_)} trees, "
+          f"{sum(e.tree_.node_count for e in iso.estimators_)} nodes")
+
+
+def export_lof(lof, scaler, path):
+    """Write the scaler and the fitted training samples of the LOF to path"""
+
+    k_distances = lof._distances_fit_X_[:, lof.n_neighbors_ - 1]
+    with open(path, 'w') as f:
+        f.write(f"mlfw-lof {FORMAT_VERSION}\n")
+        f.write(f"features {lof.n_features_in_}\n")
+        write_scaler(f, scaler)
+        f.write(f"neighbors {lof.n_neighbors_}\n")
+        f.write(f"samples {lof.n_samples_fit_}\n")
+        f.write(f"offset {float(lof.offset_)!r}\n")
+        for sample, k_distance, lrd in zip(lof._fit_X, k_distances, lof._lrd):
+            f.write(" ".join(repr(float(v)) for v in sample)
+                    + f" {float(k_distance)!r} {float(lrd)!r}\n")
+
+    print(f"LOF exported to {path}: {lof.n_samples_fit_} samples, "
+          f"{lof.n_neighbors_} neighbors")
+
+
+def dataset_features(df):
+    """16 model features, derived as preprocess_for_service_compatibility() does"""
+
+    df = df.replace([np.inf, -np.inf], np.nan).fillna(0)
+    tx_packets = df['TxPackets'].astype(float)
+    rx_packets = df['RxPackets'].astype(float)
+    tx_bytes = df['TxBytes'].astype(float)
+    rx_bytes = df['RxBytes'].astype(float)
+    duration = df['Duration'].astype(float)
+    throughput = df['Throughput'].astype(float)
+    dst_port = df['DstPort'].astype(float)
+    return np.column_stack([
+        tx_packets, rx_packets, tx_bytes, rx_bytes, duration, throughput,
+        df['PacketLoss'].astype(float), df['Delay'].astype(float), df['Jitter'].astype(float),
+        rx_packets / (tx_packets + 1e-6),
+        rx_bytes / (tx_bytes + 1e-6),
+        tx_bytes / (tx_packets + 1e-6),
+        throughput / (duration + 1e-6),
+        (dst_port <= 1023).astype(int),
+        dst_port.isin([80, 443, 8080]).astype(int),
+        dst_port.isin([31337, 12345]).astype(int),
+    ])
+
+
+def export_reference(iso, lof, scaler, dataset_dir, path):
+    """Write sklearn's decision_function and LOF factor for every dataset row"""
+
+    rows = 0
+    with open(path, 'w') as f:
+        f.write("File,Row,IsoScore,LofFactor\n")
+        for csv in sorted(glob.glob(os.path.join(dataset_dir, '*.csv'))):
+            df = pd.read_csv(csv)
+            scaled = scaler.transform(dataset_features(df))
+            scores = iso.decision_function(scaled)
+            factors = -lof.score_samples(scaled)
+            for row, (score, factor) in enumerate(zip(scores, factors)):
+                f.write(f"{os.path.basename(csv)},{row},{float(score)!r},{float(factor)!r}\n")
+            rows += len(scores)
+
+    print(f"Reference scores for {rows} flows written to {path}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--models', default='saved_models', help='directory of the pickled models')
+    parser.add_argument('--forest', default=None,
+                        help='output tree dump (default: <models>/isolation_forest.txt)')
+    parser.add_argument('--lof', default=None,
+                        help='output LOF dump (default: <models>/lof_model.txt)')
+    parser.add_argument('--reference', default=None,
+                        help='also write sklearn scores of the dataset rows to this CSV')
+    parser.add_argument('--dataset', default='Dataset', help='directory of the flow CSVs')
+    args = parser.parse_args()
+
+    iso, lof, scaler = load_models(args.models)
+    export_forest(iso, scaler, args.forest or os.path.join(args.models, 'isolation_forest.txt'))
+    export_lof(lof, scaler, args.lof or os.path.join(args.models, 'lof_model.txt'))
+    if args.reference:
+        export_reference(iso, lof, scaler, args.dataset, args.reference)
+
+
+if __name__ == '__main__':
+    main()
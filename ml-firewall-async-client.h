@@ -0,0 +1,594 @@
+#ifndef ML_FIREWALL_ASYNC_CLIENT_H
+#define ML_FIREWALL_ASYNC_CLIENT_H
+
+#include "ml-firewall-client.h"
+
+#include <deque>
+#include <functional>
+#include <sys/epoll.h>
+
+// Pipelined client for the ML firewall scorer. Submit() queues a flow on one
+// of a few non-blocking connections and returns as soon as the request is
+// handed to the kernel, so the caller can compute the next flow while earlier
+// ones are in flight. Replies are matched to requests in per-connection FIFO
+// order and delivered to the request's callback from Submit(), Poll() or
+// Flush(). At most maxInFlight requests are outstanding at any time. Socket
+// transports are multiplexed with epoll; a shared-memory endpoint uses a
+// single channel whose rings are polled directly and waited on with a futex.
+//
+// Requests follow the same FirewallPolicy as MLFirewallClient. A request not
+// answered by its deadline fails its connection; the connection's requests
+// are retried after a backoff and, once out of retries or while the breaker
+// is open, answered by the fallback with degraded set.
+class MLFirewallAsyncClient
+{
+  public:
+    typedef std::function<void(const FlowVerdict&)> Callback;
+
+    MLFirewallAsyncClient(const FirewallEndpoint& endpoint = FirewallEndpoint(),
+                          uint32_t connections = 4,
+                          uint32_t maxInFlight = 64,
+                          MLFirewallClient::Protocol protocol = MLFirewallClient::PROTOCOL_AUTO,
+                          const FirewallPolicy& policy = FirewallPolicy())
+        : m_endpoint(endpoint),
+          m_maxInFlight(std::max<uint32_t>(1, maxInFlight)),
+          m_protocol(protocol),
+          m_policy(policy),
+          m_budget(policy),
+          m_breaker(policy.breakerThreshold, policy.breakerCooldownMs),
+          m_fallback(RuleBasedFallback)
+    {
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        m_channels.resize(endpoint.transport == TRANSPORT_SHM ? 1 : std::max<uint32_t>(1, connections));
+    }
+
+    ~MLFirewallAsyncClient()
+    {
+        Flush();
+        for (Channel& channel : m_channels)
+        {
+            mlfw::CloseConnection(channel.conn);
+        }
+        if (m_epoll >= 0)
+        {
+            close(m_epoll);
+        }
+    }
+
+    MLFirewallAsyncClient(const MLFirewallAsyncClient&) = delete;
+    MLFirewallAsyncClient& operator=(const MLFirewallAsyncClient&) = delete;
+
+    // Queues one flow for scoring. Blocks only while the in-flight window is
+    // full. If the scorer cannot be used the callback runs immediately with a
+    // degraded verdict.
+    void Submit(const FlowQuery& query, Callback callback)
+    {
+        while (m_inFlight >= m_maxInFlight)
+        {
+            Poll(-1);
+        }
+
+        Pending pending;
+        pending.query = query;
+        pending.callback = std::move(callback);
+        m_inFlight++;
+        m_peakInFlight = std::max(m_peakInFlight, m_inFlight);
+
+        Dispatch(std::move(pending));
+        Poll(0);
+    }
+
+    // Handles whatever I/O is ready, waiting up to timeoutMs for some
+    // (-1 waits until something happens while requests are in flight).
+    void Poll(int timeoutMs)
+    {
+        RunDueRetries();
+        if (m_inFlight == 0)
+        {
+            return;
+        }
+
+        timeoutMs = BoundWait(timeoutMs);
+        if (m_endpoint.transport == TRANSPORT_SHM)
+        {
+            PollShm(timeoutMs);
+        }
+        else
+        {
+            PollSockets(timeoutMs);
+        }
+        ExpireRequests();
+    }
+
+    // Waits until every submitted flow has received its callback
+    void Flush()
+    {
+        while (m_inFlight > 0)
+        {
+            Poll(-1);
+        }
+    }
+
+    void SetFallback(FallbackScorer fallback)
+    {
+        m_fallback = std::move(fallback);
+    }
+
+    uint32_t GetInFlight() const
+    {
+        return m_inFlight;
+    }
+
+    uint32_t GetPeakInFlight() const
+    {
+        return m_peakInFlight;
+    }
+
+    uint32_t GetDegradedVerdicts() const
+    {
+        return m_degradedVerdicts;
+    }
+
+    uint32_t GetBreakerTrips() const
+    {
+        return m_breaker.GetTrips();
+    }
+
+  private:
+    static const int SHM_WAIT_MS = 100; // bounds the wait between peer checks
+
+    struct Pending
+    {
+        FlowQuery query;
+        Callback callback;
+        uint32_t attempts = 0;
+        FirewallClock::time_point deadline; // of the attempt on the wire
+        FirewallClock::time_point due;      // of the next retry
+    };
+
+    struct Channel
+    {
+        FirewallConnection conn;
+        std::vector<uint8_t> txQueue; // bytes not yet accepted by the kernel
+        size_t txOffset = 0;
+        bool wantWrite = false;
+        std::deque<Pending> pending; // requests awaiting a reply, in send order
+    };
+
+    // Sends one request on the least loaded channel, or retries or falls back
+    // if that is not possible
+    void Dispatch(Pending pending)
+    {
+        if (!m_budget.NextDeadline(pending.deadline))
+        {
+            m_breaker.Latch();
+        }
+        if (!m_breaker.Allow())
+        {
+            Fallback(pending);
+            return;
+        }
+
+        Channel* channel = PickChannel();
+        if (!channel)
+        {
+            Retry(std::move(pending));
+            return;
+        }
+
+        if (channel->conn.binary)
+        {
+            mlfw::AppendScoreRequest(channel->txQueue, &pending.query, 1);
+        }
+        else
+        {
+            std::ostringstream json;
+            mlfw::AppendJson(json, pending.query);
+            json << '\n';
+            std::string line = json.str();
+            channel->txQueue.insert(channel->txQueue.end(), line.begin(), line.end());
+        }
+
+        channel->pending.push_back(std::move(pending));
+        FlushWrites(*channel);
+    }
+
+    void Retry(Pending pending)
+    {
+        if (++pending.attempts > m_policy.maxRetries)
+        {
+            Fallback(pending);
+            return;
+        }
+        pending.due = FirewallClock::now() + m_policy.Backoff(pending.attempts);
+        m_retries.push_back(std::move(pending));
+    }
+
+    void RunDueRetries()
+    {
+        if (m_retries.empty())
+        {
+            return;
+        }
+
+        FirewallClock::time_point now = FirewallClock::now();
+        std::deque<Pending> waiting;
+        std::deque<Pending> due;
+        for (Pending& pending : m_retries)
+        {
+            (pending.due <= now ? due : waiting).push_back(std::move(pending));
+        }
+        m_retries.swap(waiting);
+
+        for (Pending& pending : due)
+        {
+            Dispatch(std::move(pending));
+        }
+    }
+
+    // Shortens a wait so it ends by the earliest request deadline or retry
+    int BoundWait(int timeoutMs) const
+    {
+        FirewallClock::time_point wake = FirewallClock::time_point::max();
+        for (const Channel& channel : m_channels)
+        {
+            if (!channel.pending.empty())
+            {
+                wake = std::min(wake, channel.pending.front().deadline);
+            }
+        }
+        for (const Pending& pending : m_retries)
+        {
+            wake = std::min(wake, pending.due);
+        }
+
+        if (wake == FirewallClock::time_point::max())
+        {
+            return timeoutMs;
+        }
+        int untilWake = mlfw::RemainingMs(wake);
+        return timeoutMs < 0 ? untilWake : std::min(timeoutMs, untilWake);
+    }
+
+    // Fails channels whose oldest request is past its deadline. Replies come
+    // back in order, so the connection cannot be used past a missing one.
+    void ExpireRequests()
+    {
+        FirewallClock::time_point now = FirewallClock::now();
+        for (Channel& channel : m_channels)
+        {
+            if (!channel.pending.empty() && channel.pending.front().deadline <= now)
+            {
+                FailChannel(channel);
+            }
+        }
+    }
+
+    // Picks the open channel with the fewest outstanding requests, opening
+    // channels lazily
+    Channel* PickChannel()
+    {
+        Channel* best = nullptr;
+        for (uint32_t i = 0; i < m_channels.size(); i++)
+        {
+            Channel& channel = m_channels[i];
+            if (!IsOpen(channel) && !Open(i))
+            {
+                continue;
+            }
+            if (!best || channel.pending.size() < best->pending.size())
+            {
+                best = &channel;
+            }
+            if (best->pending.empty())
+            {
+                break;
+            }
+        }
+        return best;
+    }
+
+    bool IsOpen(const Channel& channel) const
+    {
+        return channel.conn.fd >= 0 || channel.conn.shm;
+    }
+
+    bool Open(uint32_t index)
+    {
+        Channel& channel = m_channels[index];
+        FirewallConnection& conn = channel.conn;
+
+        // Connect and negotiate synchronously within one attempt's deadline
+        if (!m_budget.NextDeadline(conn.deadline) || !OpenAndNegotiate(conn))
+        {
+            mlfw::CloseConnection(conn);
+            m_breaker.RecordFailure();
+            return false;
+        }
+        conn.deadline = FirewallClock::time_point::max();
+
+        if (conn.fd >= 0)
+        {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u32 = index;
+            epoll_ctl(m_epoll, EPOLL_CTL_ADD, conn.fd, &event);
+        }
+        channel.wantWrite = false;
+        return true;
+    }
+
+    bool OpenAndNegotiate(FirewallConnection& conn)
+    {
+        if (!mlfw::OpenConnection(conn, m_endpoint))
+        {
+            return false;
+        }
+        if (conn.binary || m_protocol != MLFirewallClient::PROTOCOL_AUTO || m_binaryRejected)
+        {
+            return true;
+        }
+
+        switch (mlfw::SendHello(conn))
+        {
+        case mlfw::HELLO_BINARY:
+            return true;
+        case mlfw::HELLO_JSON:
+            m_binaryRejected = true;
+            return true;
+        case mlfw::HELLO_DROPPED:
+            m_binaryRejected = true;
+            return mlfw::OpenConnection(conn, m_endpoint);
+        case mlfw::HELLO_TIMEOUT:
+            return false;
+        }
+        return false;
+    }
+
+    void PollSockets(int timeoutMs)
+    {
+        struct epoll_event events[16];
+        int n;
+        do
+        {
+            n = epoll_wait(m_epoll, events, 16, timeoutMs);
+        } while (n < 0 && errno == EINTR);
+
+        for (int i = 0; i < n; i++)
+        {
+            Channel& channel = m_channels[events[i].data.u32];
+            if (!IsOpen(channel))
+            {
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                FailChannel(channel);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && !FlushWrites(channel))
+            {
+                continue;
+            }
+            if (events[i].events & EPOLLIN)
+            {
+                ReadReplies(channel);
+            }
+        }
+    }
+
+    // Moves queued requests onto the request ring and takes whatever verdicts
+    // are on the verdict ring, sleeping on the verdict ring when neither
+    // makes progress
+    void PollShm(int timeoutMs)
+    {
+        Channel& channel = m_channels[0];
+        if (!IsOpen(channel))
+        {
+            if (timeoutMs != 0)
+            {
+                // Only retries are waiting
+                std::this_thread::sleep_for(std::chrono::milliseconds(std::max(timeoutMs, 1)));
+            }
+            return;
+        }
+
+        size_t unsent = channel.txQueue.size() - channel.txOffset;
+        FlushWrites(channel);
+        bool progress = channel.txQueue.size() - channel.txOffset != unsent;
+
+        uint32_t inFlight = m_inFlight;
+        ReadReplies(channel);
+        progress = progress || m_inFlight != inFlight;
+
+        if (!progress && timeoutMs != 0 && IsOpen(channel))
+        {
+            if (!channel.conn.shm->ServerAlive())
+            {
+                FailChannel(channel);
+                return;
+            }
+            channel.conn.shm->WaitReadable(timeoutMs < 0 ? SHM_WAIT_MS
+                                                         : std::min(timeoutMs, SHM_WAIT_MS));
+        }
+    }
+
+    // Writes as much of the queue as the socket accepts. Returns false if the
+    // channel failed.
+    bool FlushWrites(Channel& channel)
+    {
+        if (channel.conn.shm)
+        {
+            channel.txOffset += channel.conn.shm->TryWrite(channel.txQueue.data() + channel.txOffset,
+                                                           channel.txQueue.size() - channel.txOffset);
+            if (channel.txOffset == channel.txQueue.size())
+            {
+                channel.txQueue.clear();
+                channel.txOffset = 0;
+            }
+            return true;
+        }
+
+        while (channel.txOffset < channel.txQueue.size())
+        {
+            size_t chunk = channel.txQueue.size() - channel.txOffset;
+            if (channel.conn.transport == TRANSPORT_UNIX)
+            {
+                chunk = std::min(chunk, mlfw::SEQPACKET_MESSAGE_SIZE);
+            }
+            ssize_t n = send(channel.conn.fd,
+                             channel.txQueue.data() + channel.txOffset,
+                             chunk,
+                             MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                SetWantWrite(channel, true);
+                return true;
+            }
+            if (n <= 0)
+            {
+                FailChannel(channel);
+                return false;
+            }
+            channel.txOffset += n;
+        }
+
+        channel.txQueue.clear();
+        channel.txOffset = 0;
+        SetWantWrite(channel, false);
+        return true;
+    }
+
+    void SetWantWrite(Channel& channel, bool wantWrite)
+    {
+        if (channel.wantWrite == wantWrite)
+        {
+            return;
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN | (wantWrite ? uint32_t(EPOLLOUT) : 0u);
+        event.data.u32 = &channel - m_channels.data();
+        epoll_ctl(m_epoll, EPOLL_CTL_MOD, channel.conn.fd, &event);
+        channel.wantWrite = wantWrite;
+    }
+
+    void ReadReplies(Channel& channel)
+    {
+        FirewallConnection& conn = channel.conn;
+        while (mlfw::RecvMore(conn, MSG_DONTWAIT))
+        {
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            FailChannel(channel);
+            return;
+        }
+
+        while (!channel.pending.empty())
+        {
+            FlowVerdict verdict;
+            verdict.flowId = channel.pending.front().query.flowId;
+
+            if (conn.binary)
+            {
+                const size_t replySize = mlfw::HEADER_SIZE + mlfw::VERDICT_RECORD_SIZE;
+                if (conn.rxBuffer.size() < replySize)
+                {
+                    break;
+                }
+                const uint8_t* p = reinterpret_cast<const uint8_t*>(conn.rxBuffer.data());
+                uint32_t count;
+                if (!mlfw::DecodeHeader(p, mlfw::MSG_SCORE_REPLY, count) || count != 1 ||
+                    !mlfw::DecodeScoreReply(p + mlfw::HEADER_SIZE, 1, &verdict))
+                {
+                    FailChannel(channel);
+                    return;
+                }
+                conn.rxBuffer.erase(0, replySize);
+            }
+            else
+            {
+                size_t eol = conn.rxBuffer.find('\n');
+                if (eol == std::string::npos)
+                {
+                    break;
+                }
+                std::string line = conn.rxBuffer.substr(0, eol);
+                conn.rxBuffer.erase(0, eol + 1);
+                if (!mlfw::ParseVerdict(line, verdict))
+                {
+                    // An error reply; retry or fall back as for a lost one
+                    FailChannel(channel);
+                    return;
+                }
+            }
+
+            Pending pending = std::move(channel.pending.front());
+            channel.pending.pop_front();
+            m_breaker.RecordSuccess();
+            Finish(pending, verdict);
+        }
+    }
+
+    void Finish(Pending& pending, const FlowVerdict& verdict)
+    {
+        m_inFlight--;
+        pending.callback(verdict);
+    }
+
+    void Fallback(Pending& pending)
+    {
+        FlowVerdict verdict;
+        verdict.flowId = pending.query.flowId;
+        verdict.degraded = true;
+        if (m_fallback)
+        {
+            m_fallback(pending.query, verdict);
+        }
+        m_degradedVerdicts++;
+        Finish(pending, verdict);
+    }
+
+    // Closes a broken or stalled channel and schedules its outstanding
+    // requests for retry
+    void FailChannel(Channel& channel)
+    {
+        if (channel.conn.fd >= 0)
+        {
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, channel.conn.fd, nullptr);
+        }
+        mlfw::CloseConnection(channel.conn);
+        channel.conn.rxBuffer.clear();
+        channel.txQueue.clear();
+        channel.txOffset = 0;
+        m_breaker.RecordFailure();
+
+        std::deque<Pending> pending;
+        pending.swap(channel.pending);
+        for (Pending& request : pending)
+        {
+            Retry(std::move(request));
+        }
+    }
+
+    FirewallEndpoint m_endpoint;
+    uint32_t m_maxInFlight;
+    MLFirewallClient::Protocol m_protocol;
+    FirewallPolicy m_policy;
+    FirewallBudget m_budget;
+    CircuitBreaker m_breaker;
+    FallbackScorer m_fallback;
+    bool m_binaryRejected = false;
+    int m_epoll = -1;
+    std::vector<Channel> m_channels;
+    std::deque<Pending> m_retries; // requests waiting out a backoff
+    uint32_t m_inFlight = 0;       // submitted requests without a callback yet
+    uint32_t m_peakInFlight = 0;
+    uint32_t m_degradedVerdicts = 0;
+};
+
+#endif // ML_FIREWALL_ASYNC_CLIENT_H
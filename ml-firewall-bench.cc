@@ -0,0 +1,206 @@
+// Throughput of the native feature extraction and Isolation Forest kernels.
+//
+//   g++ -O2 -std=c++17 -o ml-firewall-bench ml-firewall-bench.cc
+//   ./ml-firewall-bench [-n SYNTHETIC_ROWS] Dataset/*.csv
+//
+// Extracts the scaled features of the flow CSVs one flow at a time and with
+// the batched extractor. Then scores the flows, and a synthetic set (10M rows
+// by default) made by perturbing their counters, with every kernel the CPU
+// supports. Batched features must be bit-identical to the per-flow ones and
+// scores to the scalar kernel's; exits with status 1 otherwise.
+
+#include "ml-firewall-dataset.h"
+#include "ml-firewall-native.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+
+const size_t CHUNK_ROWS = 1 << 20;
+
+struct KernelResult
+{
+    IsolationForest::Kernel kernel;
+    std::chrono::nanoseconds elapsed{0};
+    uint64_t blocked = 0;
+    uint64_t differences = 0;
+};
+
+void
+Scale(const IsolationForest& forest, const FlowQuery& query, float* scaled)
+{
+    double features[mlfw::N_FEATURES];
+    ComputeModelFeatures(query, features);
+    forest.GetScaler().Transform(features, scaled);
+}
+
+// Scores rows with every kernel, passes times over, and compares with scalar
+void
+Run(IsolationForest& forest,
+    double isoThreshold,
+    const std::vector<float>& rows,
+    uint32_t passes,
+    std::vector<KernelResult>& results)
+{
+    size_t count = rows.size() / mlfw::N_FEATURES;
+    std::vector<double> reference(count);
+    std::vector<double> scores(count);
+    for (KernelResult& result : results)
+    {
+        forest.SetKernel(result.kernel);
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t pass = 0; pass < passes; pass++)
+        {
+            forest.DecisionFunctionBatch(rows.data(), count, scores.data());
+        }
+        result.elapsed += std::chrono::steady_clock::now() - start;
+
+        if (result.kernel == IsolationForest::KERNEL_SCALAR)
+        {
+            reference = scores;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            result.blocked += scores[i] <= isoThreshold;
+            result.differences += std::memcmp(&scores[i], &reference[i], sizeof(double)) != 0;
+        }
+    }
+}
+
+// Times per-flow and batched extraction of the scaled features, passes times
+// over; true if both produce the same rows
+bool
+CompareExtraction(const IsolationForest& forest,
+                  const std::vector<LabeledFlow>& flows,
+                  uint32_t passes)
+{
+    size_t count = flows.size();
+    std::vector<float> perFlow(count * mlfw::N_FEATURES);
+    std::vector<float> batched(count * mlfw::N_FEATURES);
+    FlowBatch batch;
+    for (const LabeledFlow& flow : flows)
+    {
+        batch.Append(flow.query);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t pass = 0; pass < passes; pass++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            Scale(forest, flows[i].query, &perFlow[i * mlfw::N_FEATURES]);
+        }
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (uint32_t pass = 0; pass < passes; pass++)
+    {
+        ExtractFeatures(batch, 0, count, &forest.GetScaler(), batched.data());
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double scored = double(count) * passes;
+    double perFlowNs = std::chrono::nanoseconds(middle - start).count() / scored;
+    double batchedNs = std::chrono::nanoseconds(end - middle).count() / scored;
+    bool identical =
+        std::memcmp(perFlow.data(), batched.data(), perFlow.size() * sizeof(float)) == 0;
+    std::cout << "Feature extraction: per flow " << perFlowNs << " ns/flow, batched " << batchedNs
+              << " ns/flow (" << perFlowNs / batchedNs << "x), "
+              << (identical ? "identical" : "ROWS DIFFER") << std::endl;
+    return identical;
+}
+
+bool
+Report(const char* name, uint64_t flows, uint32_t passes, const std::vector<KernelResult>& results)
+{
+    bool identical = true;
+    std::cout << name << ": " << flows << " flows";
+    if (passes > 1)
+    {
+        std::cout << ", " << passes << " passes";
+    }
+    std::cout << std::endl;
+    double scored = double(flows) * passes;
+    double scalarNs = results[0].elapsed.count() / scored;
+    for (const KernelResult& result : results)
+    {
+        double ns = result.elapsed.count() / scored;
+        std::cout << "  " << IsolationForest::GetKernelName(result.kernel) << ": " << ns
+                  << " ns/flow (" << scalarNs / ns << "x), " << result.blocked << " blocked, "
+                  << result.differences << " scores differ from scalar" << std::endl;
+        identical = identical && result.differences == 0;
+    }
+    return identical;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    uint64_t syntheticRows = 10000000;
+    std::vector<LabeledFlow> flows;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            syntheticRows = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (!LoadFlowCsv(argv[i], flows))
+        {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    NativeScorer scorer;
+    if (flows.empty() ||
+        !scorer.Load("saved_models/isolation_forest.txt", "saved_models/model_metadata.json"))
+    {
+        std::cerr << "usage: " << argv[0] << " [-n SYNTHETIC_ROWS] FLOWS.csv... "
+                  << "(run from the repository root after export_models.py)" << std::endl;
+        return 2;
+    }
+    IsolationForest forest = scorer.GetForest();
+
+    std::vector<KernelResult> dataset;
+    for (int k = IsolationForest::KERNEL_SCALAR; k <= IsolationForest::DetectKernel(); k++)
+    {
+        KernelResult result;
+        result.kernel = IsolationForest::Kernel(k);
+        dataset.push_back(result);
+    }
+    std::vector<KernelResult> synthetic = dataset;
+
+    std::vector<float> rows(flows.size() * mlfw::N_FEATURES);
+    for (size_t i = 0; i < flows.size(); i++)
+    {
+        Scale(forest, flows[i].query, &rows[i * mlfw::N_FEATURES]);
+    }
+    const uint32_t passes = 2000;
+    bool extracted = CompareExtraction(forest, flows, passes);
+    Run(forest, scorer.GetIsoThreshold(), rows, passes, dataset);
+
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, flows.size() - 1);
+    for (uint64_t done = 0; done < syntheticRows; done += CHUNK_ROWS)
+    {
+        size_t count = std::min<uint64_t>(CHUNK_ROWS, syntheticRows - done);
+        rows.resize(count * mlfw::N_FEATURES);
+        for (size_t i = 0; i < count; i++)
+        {
+            FlowQuery q = flows[pick(rng)].query;
+            mlfw::PerturbFlow(q, rng);
+            Scale(forest, q, &rows[i * mlfw::N_FEATURES]);
+        }
+        Run(forest, scorer.GetIsoThreshold(), rows, 1, synthetic);
+    }
+
+    std::cout << "Forest: " << forest.GetTrees() << " trees, " << forest.GetNodes() << " nodes"
+              << std::endl;
+    bool identical = Report("Dataset", flows.size(), passes, dataset);
+    identical = Report("Synthetic", syntheticRows, 1, synthetic) && identical;
+    return identical && extracted ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+#ifndef ML_FIREWALL_BLOCKLIST_H
+#define ML_FIREWALL_BLOCKLIST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Directional 5-tuple of a flow, host byte order
+struct FlowKey
+{
+    uint32_t srcAddress = 0;
+    uint32_t dstAddress = 0;
+    uint16_t srcPort = 0;
+    uint16_t dstPort = 0;
+    uint8_t protocol = 0;
+
+    bool operator==(const FlowKey& other) const
+    {
+        return srcAddress == other.srcAddress && dstAddress == other.dstAddress &&
+               srcPort == other.srcPort && dstPort == other.dstPort && protocol == other.protocol;
+    }
+};
+
+// Set of flows whose packets are dropped on the data path. Open-addressed
+// with linear probing over a power-of-two table kept at most half full, so a
+// lookup is one hash and, in practice, one or two 16-byte slot compares.
+// Entries are only ever added. Not thread-safe; the simulator is single
+// threaded.
+class FlowBlocklist
+{
+  public:
+    explicit FlowBlocklist(uint32_t initialCapacity = 1024)
+    {
+        uint32_t capacity = 16;
+        while (capacity < initialCapacity)
+        {
+            capacity <<= 1;
+        }
+        m_slots.resize(capacity);
+    }
+
+    // Returns true if the flow was not blocked before
+    bool Insert(const FlowKey& key)
+    {
+        if (2 * (m_size + 1) > m_slots.size())
+        {
+            Grow();
+        }
+
+        Slot& slot = m_slots[Find(key)];
+        if (slot.used)
+        {
+            return false;
+        }
+        slot.key = key;
+        slot.used = true;
+        m_size++;
+        return true;
+    }
+
+    bool Contains(const FlowKey& key) const
+    {
+        return m_slots[Find(key)].used;
+    }
+
+    uint32_t GetSize() const
+    {
+        return m_size;
+    }
+
+  private:
+    struct Slot
+    {
+        FlowKey key;
+        bool used = false;
+    };
+
+    static uint64_t Hash(const FlowKey& key)
+    {
+        uint64_t h = (uint64_t(key.srcAddress) << 32) | key.dstAddress;
+        h ^= (uint64_t(key.srcPort) << 24 | uint64_t(key.dstPort) << 8 | key.protocol) *
+             0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        return h ^ (h >> 32);
+    }
+
+    // Index of the slot holding key, or of the empty slot where it would go
+    size_t Find(const FlowKey& key) const
+    {
+        size_t mask = m_slots.size() - 1;
+        size_t i = Hash(key) & mask;
+        while (m_slots[i].used && !(m_slots[i].key == key))
+        {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void Grow()
+    {
+        std::vector<Slot> old(m_slots.size() * 2);
+        old.swap(m_slots);
+        for (const Slot& slot : old)
+        {
+            if (slot.used)
+            {
+                m_slots[Find(slot.key)] = slot;
+            }
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    uint32_t m_size = 0;
+};
+
+#endif // ML_FIREWALL_BLOCKLIST_H
@@ -0,0 +1,140 @@
+// Packs the exported models into one memory-mapped model bundle.
+//
+//   python3 export_models.py
+//   g++ -O2 -std=c++17 -o ml-firewall-bundle ml-firewall-bundle.cc
+//   ./ml-firewall-bundle [-d MODEL_DIR] [-o BUNDLE] [FLOWS.csv...]
+//
+// Reads isolation_forest.txt, lof_model.txt and model_metadata.json from
+// MODEL_DIR (saved_models by default) and writes BUNDLE (MODEL_DIR/
+// model_bundle.mlfw by default). The bundle is then mapped again and every
+// flow of the CSVs scored with both; exits with status 1 if any score
+// differs. Reports how long each way of loading takes.
+
+#include "ml-firewall-dataset.h"
+#include "ml-firewall-native.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+
+// Milliseconds taken by load, best of a few runs so the page cache is warm
+template <typename F>
+double
+TimeLoad(F load)
+{
+    double best = 0.0;
+    for (int run = 0; run < 5; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        load();
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+// Number of flows whose scores from a and b are not bit-identical
+uint64_t
+CompareScores(const NativeScorer& a, const NativeScorer& b, const std::vector<LabeledFlow>& flows)
+{
+    uint64_t differences = 0;
+    for (const LabeledFlow& flow : flows)
+    {
+        double x[2] = {a.IsoScore(flow.query), a.LofFactor(flow.query)};
+        double y[2] = {b.IsoScore(flow.query), b.LofFactor(flow.query)};
+        differences += std::memcmp(x, y, sizeof(x)) != 0;
+    }
+    return differences;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    std::string modelDir = "saved_models";
+    std::string output;
+    std::vector<LabeledFlow> flows;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+        {
+            modelDir = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (argv[i][0] == '-' || !LoadFlowCsv(argv[i], flows))
+        {
+            std::cerr << "usage: " << argv[0] << " [-d MODEL_DIR] [-o BUNDLE] [FLOWS.csv...]"
+                      << std::endl;
+            return 2;
+        }
+    }
+    if (output.empty())
+    {
+        output = modelDir + "/model_bundle.mlfw";
+    }
+
+    std::string forestPath = modelDir + "/isolation_forest.txt";
+    std::string lofPath = modelDir + "/lof_model.txt";
+    std::string metadataPath = modelDir + "/model_metadata.json";
+    NativeScorer text;
+    if (!text.Load(forestPath, metadataPath))
+    {
+        std::cerr << "Cannot load " << forestPath << " and " << metadataPath
+                  << " (run export_models.py)" << std::endl;
+        return 2;
+    }
+    bool lof = text.LoadLof(lofPath);
+    if (!lof)
+    {
+        std::cerr << "No LOF in " << lofPath << ", packing the forest alone" << std::endl;
+    }
+    if (!text.SaveBundle(output))
+    {
+        std::cerr << "Cannot write " << output << std::endl;
+        return 1;
+    }
+
+    NativeScorer mapped;
+    if (!mapped.LoadBundle(output))
+    {
+        std::cerr << "Cannot read back " << output << std::endl;
+        return 1;
+    }
+    mlfw::ModelBundle bundle;
+    bundle.Open(output);
+    std::cout << "Wrote " << output << ": " << bundle.GetSize() << " bytes, model "
+              << mapped.GetModelVersion() << " (" << mapped.GetTrainingDate() << "), "
+              << mapped.GetForest().GetTrees() << " trees, " << mapped.GetForest().GetNodes()
+              << " nodes, " << mapped.GetLof().GetSamples() << " LOF samples" << std::endl;
+
+    double textMs = TimeLoad([&] {
+        NativeScorer scorer;
+        scorer.Load(forestPath, metadataPath);
+        if (lof)
+        {
+            scorer.LoadLof(lofPath);
+        }
+    });
+    double verifiedMs = TimeLoad([&] {
+        NativeScorer scorer;
+        scorer.LoadBundle(output);
+    });
+    double unverifiedMs = TimeLoad([&] {
+        NativeScorer scorer;
+        scorer.LoadBundle(output, false);
+    });
+    std::cout << "Load: text dumps " << textMs << " ms, bundle " << verifiedMs << " ms ("
+              << unverifiedMs << " ms without the checksum)" << std::endl;
+
+    uint64_t differences = CompareScores(text, mapped, flows);
+    std::cout << flows.size() << " flows scored, " << differences << " differ" << std::endl;
+    return differences == 0 ? 0 : 1;
+}
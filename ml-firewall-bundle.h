@@ -0,0 +1,481 @@
+#ifndef ML_FIREWALL_BUNDLE_H
+#define ML_FIREWALL_BUNDLE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Model bundle: every array and value a native scorer needs, in one file that
+// is mapped read-only and scored from in place. Processes mapping the same
+// bundle share its pages.
+//
+//   header:   magic "MLFWBNDL" | version u32 | sections u32 | size u64 |
+//             checksum u64 | reserved (64 bytes in all)
+//   sections: name char[40] | type u32 | reserved u32 | offset u64 |
+//             bytes u64                  (64 bytes each)
+//   data:     each section's array, aligned to 64 bytes
+//
+// The checksum is FNV-1a over every byte after the header. Sections hold the
+// arrays in the layout the scorers keep in memory, in native byte order;
+// little-endian hosts only.
+
+namespace mlfw
+{
+
+// Element type of a bundle section: kind in the high byte, size in the low
+template <typename T>
+struct BundleType;
+
+template <>
+struct BundleType<uint8_t>
+{
+    static const uint32_t CODE = 0x0101;
+};
+
+template <>
+struct BundleType<int32_t>
+{
+    static const uint32_t CODE = 0x0204;
+};
+
+template <>
+struct BundleType<uint32_t>
+{
+    static const uint32_t CODE = 0x0104;
+};
+
+template <>
+struct BundleType<float>
+{
+    static const uint32_t CODE = 0x0304;
+};
+
+template <>
+struct BundleType<double>
+{
+    static const uint32_t CODE = 0x0308;
+};
+
+// Read-only mapping of a whole file, unmapped when the last array borrowing
+// from it goes away
+class MappedFile
+{
+  public:
+    ~MappedFile()
+    {
+        if (m_data)
+        {
+            munmap(const_cast<uint8_t*>(m_data), m_size);
+        }
+    }
+
+    static std::shared_ptr<const MappedFile> Map(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        struct stat st;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        std::shared_ptr<MappedFile> file(new MappedFile);
+        file->m_data = static_cast<const uint8_t*>(data);
+        file->m_size = st.st_size;
+        return file;
+    }
+
+    const uint8_t* GetData() const
+    {
+        return m_data;
+    }
+
+    size_t GetSize() const
+    {
+        return m_size;
+    }
+
+  private:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// Parameters of a model: owned in a vector while the model is read from a
+// text dump or built, or borrowed from a mapped bundle, which stays mapped
+// as long as the array does. Reads work the same either way; changes go
+// through Own(), which drops borrowed contents.
+template <typename T>
+class ModelArray
+{
+  public:
+    static ModelArray Borrow(std::shared_ptr<const MappedFile> file, const T* data, size_t size)
+    {
+        ModelArray array;
+        array.m_file = std::move(file);
+        array.m_borrowed = data;
+        array.m_borrowedSize = size;
+        return array;
+    }
+
+    bool IsBorrowed() const
+    {
+        return m_borrowed != nullptr;
+    }
+
+    const T* data() const
+    {
+        return m_borrowed ? m_borrowed : m_owned.data();
+    }
+
+    size_t size() const
+    {
+        return m_borrowed ? m_borrowedSize : m_owned.size();
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    const T& operator[](size_t i) const
+    {
+        return data()[i];
+    }
+
+    const T& back() const
+    {
+        return data()[size() - 1];
+    }
+
+    const T* begin() const
+    {
+        return data();
+    }
+
+    const T* end() const
+    {
+        return data() + size();
+    }
+
+    std::vector<T>& Own()
+    {
+        if (m_borrowed)
+        {
+            m_owned.clear();
+            m_borrowed = nullptr;
+            m_borrowedSize = 0;
+            m_file.reset();
+        }
+        return m_owned;
+    }
+
+    void push_back(const T& value)
+    {
+        Own().push_back(value);
+    }
+
+    void assign(size_t count, const T& value)
+    {
+        Own().assign(count, value);
+    }
+
+    void resize(size_t count)
+    {
+        Own().resize(count);
+    }
+
+  private:
+    std::vector<T> m_owned;
+    const T* m_borrowed = nullptr;
+    size_t m_borrowedSize = 0;
+    std::shared_ptr<const MappedFile> m_file;
+};
+
+const char BUNDLE_MAGIC[8] = {'M', 'L', 'F', 'W', 'B', 'N', 'D', 'L'};
+const uint32_t BUNDLE_VERSION = 1;
+const size_t BUNDLE_ALIGN = 64;
+const size_t BUNDLE_NAME_SIZE = 40;
+
+struct BundleHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t sections;
+    uint64_t size;
+    uint64_t checksum;
+    uint8_t reserved[32];
+};
+
+struct BundleSection
+{
+    char name[BUNDLE_NAME_SIZE];
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+static_assert(sizeof(BundleHeader) == 64 && sizeof(BundleSection) == 64,
+              "bundle records are 64 bytes");
+
+inline uint64_t
+BundleChecksum(const uint8_t* data, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        h = (h ^ data[i]) * 0x100000001b3ULL; // FNV-1a
+    }
+    return h;
+}
+
+inline size_t
+BundleAlign(size_t offset)
+{
+    return (offset + BUNDLE_ALIGN - 1) & ~(BUNDLE_ALIGN - 1);
+}
+
+// Collects named arrays and writes them as a bundle
+class BundleWriter
+{
+  public:
+    template <typename T>
+    void Add(const std::string& name, const T* data, size_t count)
+    {
+        Section section;
+        section.name = name;
+        section.type = BundleType<T>::CODE;
+        section.bytes.assign(reinterpret_cast<const uint8_t*>(data),
+                             reinterpret_cast<const uint8_t*>(data + count));
+        m_sections.push_back(section);
+    }
+
+    template <typename T>
+    void Add(const std::string& name, const ModelArray<T>& array)
+    {
+        Add(name, array.data(), array.size());
+    }
+
+    template <typename T>
+    void Add(const std::string& name, const std::vector<T>& array)
+    {
+        Add(name, array.data(), array.size());
+    }
+
+    template <typename T>
+    void AddValue(const std::string& name, T value)
+    {
+        Add(name, &value, 1);
+    }
+
+    void AddString(const std::string& name, const std::string& value)
+    {
+        Add(name, reinterpret_cast<const uint8_t*>(value.data()), value.size());
+    }
+
+    // Writes to a temporary file renamed over path, so a process mapping the
+    // old bundle keeps a consistent view. Returns false on any I/O error or a
+    // name too long for the section table.
+    bool Write(const std::string& path) const
+    {
+        size_t tableSize = m_sections.size() * sizeof(BundleSection);
+        size_t offset = BundleAlign(sizeof(BundleHeader) + tableSize);
+        std::vector<BundleSection> table(m_sections.size());
+        for (size_t i = 0; i < m_sections.size(); i++)
+        {
+            if (m_sections[i].name.size() >= BUNDLE_NAME_SIZE)
+            {
+                return false;
+            }
+            std::memset(&table[i], 0, sizeof(BundleSection));
+            std::memcpy(table[i].name, m_sections[i].name.data(), m_sections[i].name.size());
+            table[i].type = m_sections[i].type;
+            table[i].offset = offset;
+            table[i].bytes = m_sections[i].bytes.size();
+            offset = BundleAlign(offset + table[i].bytes);
+        }
+
+        std::vector<uint8_t> file(offset, 0);
+        std::memcpy(file.data() + sizeof(BundleHeader), table.data(), tableSize);
+        for (size_t i = 0; i < m_sections.size(); i++)
+        {
+            const std::vector<uint8_t>& bytes = m_sections[i].bytes;
+            std::copy(bytes.begin(), bytes.end(), file.begin() + table[i].offset);
+        }
+        BundleHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+        header.version = BUNDLE_VERSION;
+        header.sections = m_sections.size();
+        header.size = file.size();
+        header.checksum =
+            BundleChecksum(file.data() + sizeof(header), file.size() - sizeof(header));
+        std::memcpy(file.data(), &header, sizeof(header));
+
+        std::string tmp = path + ".tmp";
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(file.data()), file.size());
+        out.close();
+        if (!out || std::rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    struct Section
+    {
+        std::string name;
+        uint32_t type;
+        std::vector<uint8_t> bytes;
+    };
+
+    std::vector<Section> m_sections;
+};
+
+// A mapped bundle. Arrays handed out point into the mapping and keep it
+// alive, so the ModelBundle itself can be dropped once the models are loaded.
+class ModelBundle
+{
+  public:
+    // Maps path and checks its header, section table and, with verify, the
+    // checksum. Returns false if any of them is wrong.
+    bool Open(const std::string& path, bool verify = true)
+    {
+        m_file = MappedFile::Map(path);
+        m_header = nullptr;
+        m_sections = nullptr;
+        if (!m_file || m_file->GetSize() < sizeof(BundleHeader) ||
+            __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+        {
+            m_file.reset();
+            return false;
+        }
+
+        const uint8_t* data = m_file->GetData();
+        const BundleHeader* header = reinterpret_cast<const BundleHeader*>(data);
+        size_t tableEnd = sizeof(BundleHeader) + size_t(header->sections) * sizeof(BundleSection);
+        bool valid = std::memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) == 0 &&
+                     header->version == BUNDLE_VERSION && header->size == m_file->GetSize() &&
+                     tableEnd <= header->size;
+        const BundleSection* sections =
+            reinterpret_cast<const BundleSection*>(data + sizeof(BundleHeader));
+        for (uint32_t i = 0; valid && i < header->sections; i++)
+        {
+            valid = sections[i].offset % BUNDLE_ALIGN == 0 && sections[i].offset >= tableEnd &&
+                    sections[i].offset <= header->size &&
+                    sections[i].bytes <= header->size - sections[i].offset &&
+                    sections[i].name[BUNDLE_NAME_SIZE - 1] == '\0';
+        }
+        if (valid && verify)
+        {
+            size_t bytes = header->size - sizeof(BundleHeader);
+            valid = BundleChecksum(data + sizeof(BundleHeader), bytes) == header->checksum;
+        }
+        if (!valid)
+        {
+            m_file.reset();
+            return false;
+        }
+        m_header = header;
+        m_sections = sections;
+        return true;
+    }
+
+    bool IsOpen() const
+    {
+        return m_header != nullptr;
+    }
+
+    bool Has(const std::string& name) const
+    {
+        return Find(name) != nullptr;
+    }
+
+    // Borrows the array of a section. Returns false if it is missing or holds
+    // another type.
+    template <typename T>
+    bool Get(const std::string& name, ModelArray<T>& array) const
+    {
+        const BundleSection* section = Find(name);
+        if (!section || section->type != BundleType<T>::CODE || section->bytes % sizeof(T) != 0)
+        {
+            return false;
+        }
+        const T* data = reinterpret_cast<const T*>(m_file->GetData() + section->offset);
+        array = ModelArray<T>::Borrow(m_file, data, section->bytes / sizeof(T));
+        return true;
+    }
+
+    // Value of a section holding exactly one element
+    template <typename T>
+    bool GetValue(const std::string& name, T& value) const
+    {
+        ModelArray<T> array;
+        if (!Get(name, array) || array.size() != 1)
+        {
+            return false;
+        }
+        value = array[0];
+        return true;
+    }
+
+    std::string GetString(const std::string& name) const
+    {
+        ModelArray<uint8_t> array;
+        return Get(name, array) ? std::string(array.begin(), array.end()) : std::string();
+    }
+
+    uint64_t GetChecksum() const
+    {
+        return m_header ? m_header->checksum : 0;
+    }
+
+    uint64_t GetSize() const
+    {
+        return m_header ? m_header->size : 0;
+    }
+
+  private:
+    const BundleSection* Find(const std::string& name) const
+    {
+        for (uint32_t i = 0; m_header && i < m_header->sections; i++)
+        {
+            if (name == m_sections[i].name)
+            {
+                return &m_sections[i];
+            }
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<const MappedFile> m_file;
+    const BundleHeader* m_header = nullptr;
+    const BundleSection* m_sections = nullptr;
+};
+
+} // namespace mlfw
+
+#endif // ML_FIREWALL_BUNDLE_H
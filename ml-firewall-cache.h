@@ -0,0 +1,437 @@
+#ifndef ML_FIREWALL_CACHE_H
+#define ML_FIREWALL_CACHE_H
+
+#include "ml-firewall-client.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace mlfw
+{
+
+// Value of a top-level string field in a flat JSON document such as
+// model_metadata.json, or "" if it is absent
+inline std::string
+JsonStringField(const std::string& json, const std::string& key)
+{
+    size_t pos = json.find("\"" + key + "\"");
+    if (pos == std::string::npos)
+        return "";
+    pos = json.find(':', pos);
+    size_t open = pos == std::string::npos ? pos : json.find('"', pos);
+    size_t close = open == std::string::npos ? open : json.find('"', open + 1);
+    if (close == std::string::npos)
+        return "";
+    return json.substr(open + 1, close - open - 1);
+}
+
+// Strings of a top-level array field in a flat JSON document, such as
+// feature_names of model_metadata.json; empty if it is absent
+inline std::vector<std::string>
+JsonStringArrayField(const std::string& json, const std::string& key)
+{
+    std::vector<std::string> values;
+    size_t pos = json.find("\"" + key + "\"");
+    pos = pos == std::string::npos ? pos : json.find(':', pos);
+    size_t open = pos == std::string::npos ? pos : json.find('[', pos);
+    size_t end = open == std::string::npos ? open : json.find(']', open);
+    if (end == std::string::npos)
+        return values;
+    for (pos = json.find('"', open); pos < end; pos = json.find('"', pos + 1))
+    {
+        size_t close = json.find('"', pos + 1);
+        if (close == std::string::npos)
+            break;
+        values.push_back(json.substr(pos + 1, close - pos - 1));
+        pos = close;
+    }
+    return values;
+}
+
+// Value of a top-level numeric field in a flat JSON document, or NaN if it
+// is absent
+inline double
+JsonNumberField(const std::string& json, const std::string& key)
+{
+    size_t pos = json.find("\"" + key + "\"");
+    pos = pos == std::string::npos ? pos : json.find(':', pos);
+    if (pos == std::string::npos)
+        return NAN;
+    char* end = nullptr;
+    double value = std::strtod(json.c_str() + pos + 1, &end);
+    return end != json.c_str() + pos + 1 ? value : NAN;
+}
+
+inline uint64_t
+Mix64(uint64_t x)
+{
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+inline uint64_t
+HashString(const std::string& s, uint64_t h = 0xcbf29ce484222325ULL)
+{
+    for (unsigned char c : s)
+    {
+        h = (h ^ c) * 0x100000001b3ULL; // FNV-1a
+    }
+    return h;
+}
+
+// Model tag of a model_version and training_date; never 0
+inline uint32_t
+MakeModelTag(const std::string& version, const std::string& trained)
+{
+    uint32_t tag = static_cast<uint32_t>(Mix64(HashString(version + "|" + trained)));
+    return tag != 0 ? tag : 1;
+}
+
+// Identifies the model that produced a verdict: model_version and
+// training_date of model_metadata.json, so a retrained model invalidates
+// cached verdicts even if its version string was not bumped. Returns 0 if
+// the file cannot be read.
+inline uint32_t
+ReadModelTag(const std::string& metadataPath)
+{
+    std::ifstream file(metadataPath);
+    if (!file)
+        return 0;
+    std::stringstream text;
+    text << file.rdbuf();
+    return MakeModelTag(JsonStringField(text.str(), "model_version"),
+                        JsonStringField(text.str(), "training_date"));
+}
+
+} // namespace mlfw
+
+// Verdict cache in front of the ML firewall client. Entries are keyed on the
+// flow's 5-tuple, a fingerprint of its 16 model features quantized to
+// 1/stepsPerOctave of an octave (about 4% at the default 16 steps), and the
+// model tag, so re-running a scenario with the same seed answers identical
+// flows without contacting the scorer.
+//
+// The table is open-addressed with linear probing over a power-of-two number
+// of slots. A key whose probe window is full replaces the entry in its home
+// slot. The table lives on the heap, or in a file mapped with MAP_SHARED so
+// it survives between runs; the file is in native byte order and is rebuilt
+// if its layout does not match. Only one process at a time writes the file
+// (flock); others map it copy-on-write and keep their additions private.
+// Degraded verdicts are never cached. Not thread-safe.
+class VerdictCache
+{
+  public:
+    VerdictCache(uint32_t modelTag,
+                 uint64_t capacity = 1 << 16,
+                 const std::string& path = "",
+                 uint32_t stepsPerOctave = 16)
+        : m_modelTag(modelTag),
+          m_stepsPerOctave(stepsPerOctave)
+    {
+        uint64_t slots = 1;
+        while (slots < capacity)
+        {
+            slots <<= 1;
+        }
+        if (path.empty() || !MapFile(path, slots))
+        {
+            m_heap.resize(RegionSize(slots) / sizeof(uint64_t));
+            m_header = reinterpret_cast<Header*>(m_heap.data());
+            InitHeader(slots);
+        }
+        m_entries = reinterpret_cast<Entry*>(m_header + 1);
+        m_mask = m_header->capacity - 1;
+    }
+
+    ~VerdictCache()
+    {
+        if (m_mapped)
+        {
+            munmap(m_header, RegionSize(m_header->capacity));
+        }
+        if (m_fd >= 0)
+        {
+            close(m_fd); // releases the lock
+        }
+    }
+
+    VerdictCache(const VerdictCache&) = delete;
+    VerdictCache& operator=(const VerdictCache&) = delete;
+
+    // Fills verdict and returns true on a hit
+    bool Lookup(const FlowQuery& query, FlowVerdict& verdict)
+    {
+        Entry key = MakeKey(query);
+        uint64_t home = Hash(key) & m_mask;
+        for (uint32_t i = 0; i < MAX_PROBE; i++)
+        {
+            const Entry& slot = m_entries[(home + i) & m_mask];
+            if (!(slot.flags & OCCUPIED))
+            {
+                break;
+            }
+            if (SameKey(slot, key))
+            {
+                verdict = FlowVerdict();
+                verdict.flowId = query.flowId;
+                verdict.shouldBlock = slot.flags & SHOULD_BLOCK;
+                verdict.isoScore = slot.isoScore;
+                verdict.lofFactor = slot.lofFactor;
+                verdict.modelTag = m_modelTag;
+                m_hits++;
+                return true;
+            }
+        }
+        m_misses++;
+        return false;
+    }
+
+    // Remembers a verdict obtained from the scorer. A verdict from another
+    // model than the cache's means the scorer has swapped models: the cache
+    // takes the new tag, so the replaced model's entries stop matching.
+    void Insert(const FlowQuery& query, const FlowVerdict& verdict)
+    {
+        if (verdict.degraded)
+        {
+            return;
+        }
+        if (verdict.modelTag != 0)
+        {
+            m_modelTag = verdict.modelTag;
+        }
+
+        Entry entry = MakeKey(query);
+        entry.flags = OCCUPIED | (verdict.shouldBlock ? SHOULD_BLOCK : 0);
+        entry.isoScore = verdict.isoScore;
+        entry.lofFactor = verdict.lofFactor;
+
+        uint64_t home = Hash(entry) & m_mask;
+        for (uint32_t i = 0; i < MAX_PROBE; i++)
+        {
+            Entry& slot = m_entries[(home + i) & m_mask];
+            if (!(slot.flags & OCCUPIED))
+            {
+                m_header->count++;
+                slot = entry;
+                return;
+            }
+            if (SameKey(slot, entry))
+            {
+                slot = entry;
+                return;
+            }
+        }
+        m_entries[home] = entry;
+        m_evictions++;
+    }
+
+    // Keys further lookups and inserts on another model
+    void SetModelTag(uint32_t modelTag)
+    {
+        m_modelTag = modelTag;
+    }
+
+    uint32_t GetModelTag() const
+    {
+        return m_modelTag;
+    }
+
+    uint64_t GetHits() const
+    {
+        return m_hits;
+    }
+
+    uint64_t GetMisses() const
+    {
+        return m_misses;
+    }
+
+    uint64_t GetEvictions() const
+    {
+        return m_evictions;
+    }
+
+    uint64_t GetSize() const
+    {
+        return m_header->count;
+    }
+
+    uint64_t GetCapacity() const
+    {
+        return m_header->capacity;
+    }
+
+    // True if entries are written back to the cache file
+    bool IsPersistent() const
+    {
+        return m_mapped && m_locked;
+    }
+
+  private:
+    static const uint32_t MAGIC = 0x43564c4d; // "MLVC"
+    static const uint32_t VERSION = 1;
+    static const uint32_t MAX_PROBE = 16;
+    static const uint8_t OCCUPIED = 0x1;
+    static const uint8_t SHOULD_BLOCK = 0x2;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t entrySize;
+        uint32_t reserved;
+        uint64_t capacity;
+        uint64_t count;
+    };
+
+    struct Entry
+    {
+        uint32_t srcAddress;
+        uint32_t dstAddress;
+        uint16_t srcPort;
+        uint16_t dstPort;
+        uint8_t protocol;
+        uint8_t flags;
+        uint16_t reserved;
+        uint32_t modelTag;
+        float isoScore;
+        uint64_t fingerprint;
+        float lofFactor;
+        uint32_t padding;
+    };
+
+    static size_t RegionSize(uint64_t capacity)
+    {
+        return sizeof(Header) + capacity * sizeof(Entry);
+    }
+
+    void InitHeader(uint64_t capacity)
+    {
+        std::memset(m_header, 0, RegionSize(capacity));
+        m_header->magic = MAGIC;
+        m_header->version = VERSION;
+        m_header->entrySize = sizeof(Entry);
+        m_header->capacity = capacity;
+    }
+
+    bool MapFile(const std::string& path, uint64_t capacity)
+    {
+        m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            return false;
+        }
+        m_locked = flock(m_fd, LOCK_EX | LOCK_NB) == 0;
+
+        size_t size = RegionSize(capacity);
+        struct stat st;
+        bool valid = fstat(m_fd, &st) == 0 && static_cast<size_t>(st.st_size) == size;
+        if (valid)
+        {
+            Header header;
+            valid = pread(m_fd, &header, sizeof(header), 0) == sizeof(header) &&
+                    header.magic == MAGIC && header.version == VERSION &&
+                    header.entrySize == sizeof(Entry) && header.capacity == capacity;
+        }
+        if (!valid && (!m_locked || ftruncate(m_fd, 0) != 0 || ftruncate(m_fd, size) != 0))
+        {
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+
+        void* base =
+            mmap(nullptr, size, PROT_READ | PROT_WRITE, m_locked ? MAP_SHARED : MAP_PRIVATE, m_fd, 0);
+        if (base == MAP_FAILED)
+        {
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        m_header = static_cast<Header*>(base);
+        m_mapped = true;
+        if (!valid)
+        {
+            InitHeader(capacity);
+        }
+        return true;
+    }
+
+    Entry MakeKey(const FlowQuery& query) const
+    {
+        Entry key;
+        std::memset(&key, 0, sizeof(key));
+        key.srcAddress = query.srcAddress;
+        key.dstAddress = query.dstAddress;
+        key.srcPort = query.srcPort;
+        key.dstPort = query.dstPort;
+        key.protocol = query.protocol;
+        key.modelTag = m_modelTag;
+        key.fingerprint = Fingerprint(query);
+        return key;
+    }
+
+    // Hash of the features quantized on a log scale, so the bucket width is
+    // relative to the value for counters and rates alike
+    uint64_t Fingerprint(const FlowQuery& query) const
+    {
+        float features[mlfw::N_FEATURES];
+        ComputeModelFeatures(query, features);
+
+        uint64_t h = 0;
+        for (int i = 0; i < mlfw::N_FEATURES; i++)
+        {
+            double x = features[i];
+            int64_t q = std::isfinite(x) ? std::llround(std::log2(1.0 + std::fabs(x)) * m_stepsPerOctave)
+                                         : INT64_MAX;
+            h = mlfw::Mix64(h ^ static_cast<uint64_t>(x < 0 ? -q : q));
+        }
+        return h;
+    }
+
+    static uint64_t Hash(const Entry& key)
+    {
+        uint64_t h = (uint64_t(key.srcAddress) << 32) | key.dstAddress;
+        h = mlfw::Mix64(h ^ ((uint64_t(key.srcPort) << 32) | (uint64_t(key.dstPort) << 16) |
+                             key.protocol));
+        return mlfw::Mix64(h ^ key.fingerprint ^ key.modelTag);
+    }
+
+    static bool SameKey(const Entry& a, const Entry& b)
+    {
+        return a.fingerprint == b.fingerprint && a.srcAddress == b.srcAddress &&
+               a.dstAddress == b.dstAddress && a.srcPort == b.srcPort && a.dstPort == b.dstPort &&
+               a.protocol == b.protocol && a.modelTag == b.modelTag;
+    }
+
+    uint32_t m_modelTag;
+    uint32_t m_stepsPerOctave;
+    Header* m_header = nullptr;
+    Entry* m_entries = nullptr;
+    uint64_t m_mask = 0;
+    std::vector<uint64_t> m_heap; // backing store when not mapped
+    int m_fd = -1;
+    bool m_mapped = false;
+    bool m_locked = false;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_evictions = 0;
+};
+
+#endif // ML_FIREWALL_CACHE_H
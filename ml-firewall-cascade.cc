@@ -0,0 +1,210 @@
+// Exit rates and speed of the cascaded native scorer.
+//
+//   python3 export_models.py
+//   g++ -O2 -std=c++17 -o ml-firewall-cascade ml-firewall-cascade.cc
+//   ./ml-firewall-cascade [-n SYNTHETIC_ROWS] [-c CHUNK] Dataset/*.csv
+//
+// Scores the flows of the CSVs, and a synthetic set (100k rows by default)
+// made by perturbing them, with the full ensemble (every tree and the LOF
+// for every flow) and then cascaded at several margins around iso_threshold,
+// walking the trees CHUNK at a time (8 by default). For each margin it
+// reports the share of flows settled by part of the trees, by the whole
+// forest and by the LOF, the trees walked per flow, ns/flow, and the flows
+// of the Hospital and PowerGrid districts that reached the LOF. Exits with
+// status 1 if a cascaded decision differs from the one the full scores
+// give for the same band.
+
+#include "ml-firewall-dataset.h"
+#include "ml-firewall-native.h"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+
+// Both scores of every flow, from the full ensemble
+struct Reference
+{
+    std::vector<double> isoScores;
+    std::vector<double> lofFactors;
+};
+
+// ns/flow scoring the queries with scorer, best of three passes; verdicts
+// are those of the last pass
+double
+Time(const NativeScorer& scorer,
+     const std::vector<FlowQuery>& queries,
+     std::vector<FlowVerdict>& verdicts)
+{
+    verdicts.resize(queries.size());
+    double best = 0.0;
+    for (int pass = 0; pass < 3; pass++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        scorer.ScoreBatch(queries.data(), queries.size(), verdicts.data());
+        double ns = std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count();
+        best = pass == 0 ? ns : std::min(best, ns);
+    }
+    return best / queries.size();
+}
+
+// Decision the cascade must reach for flow i, from its full scores
+bool
+ExpectedBlock(const NativeScorer& scorer, const Reference& reference, size_t i)
+{
+    double score = reference.isoScores[i];
+    const ForestCascade& cascade = scorer.GetCascade();
+    if (score < cascade.GetLow() || score > cascade.GetHigh())
+    {
+        return score <= scorer.GetIsoThreshold();
+    }
+    return reference.lofFactors[i] >= scorer.GetLofThreshold();
+}
+
+// Scores queries with the full ensemble and cascaded at each margin; false
+// if a cascaded decision is not the expected one
+bool
+Report(const char* title,
+       const NativeScorer& full,
+       const std::vector<double>& margins,
+       uint32_t chunk,
+       const std::vector<FlowQuery>& queries)
+{
+    size_t count = queries.size();
+    Reference reference;
+    for (const FlowQuery& query : queries)
+    {
+        reference.isoScores.push_back(full.IsoScore(query));
+        reference.lofFactors.push_back(full.LofFactor(query));
+    }
+    std::vector<FlowVerdict> verdicts;
+    double fullNs = Time(full, queries, verdicts);
+    std::cout << title << ": " << count << " flows, full ensemble " << std::fixed
+              << std::setprecision(1) << fullNs << " ns/flow" << std::endl;
+    std::cout << std::right << std::setw(8) << "margin" << std::setw(8) << "trees%"
+              << std::setw(9) << "forest%" << std::setw(7) << "lof%" << std::setw(13)
+              << "trees/flow" << std::setw(10) << "ns/flow" << std::setw(9) << "speedup"
+              << std::setw(11) << "vs forest" << std::setw(16) << "Hospital lof%"
+              << std::setw(17) << "PowerGrid lof%" << std::endl;
+
+    bool exact = true;
+    for (double margin : margins)
+    {
+        NativeScorer cascaded = full;
+        cascaded.UseCascade(margin, margin, chunk);
+        double ns = Time(cascaded, queries, verdicts);
+
+        uint64_t stages[mlfw::N_CASCADE_STAGES] = {};
+        uint64_t trees = 0, changed = 0, wrong = 0;
+        uint64_t districtFlows[mlfw::N_DISTRICTS] = {}, districtLof[mlfw::N_DISTRICTS] = {};
+        std::vector<float> scaled(count * mlfw::N_FEATURES);
+        std::vector<double> scores(count);
+        std::vector<uint8_t> exits(count);
+        FlowBatch batch;
+        for (const FlowQuery& query : queries)
+        {
+            batch.Append(query);
+        }
+        ExtractFeatures(batch, 0, count, &full.GetForest().GetScaler(), scaled.data());
+        cascaded.GetCascade().Score(cascaded.GetForest(), scaled.data(), count, scores.data(),
+                                    exits.data(), &trees);
+        for (size_t i = 0; i < count; i++)
+        {
+            stages[verdicts[i].stage]++;
+            bool forestBlock = reference.isoScores[i] <= full.GetIsoThreshold();
+            changed += verdicts[i].shouldBlock != forestBlock;
+            wrong += verdicts[i].shouldBlock != ExpectedBlock(cascaded, reference, i);
+            districtFlows[queries[i].district]++;
+            districtLof[queries[i].district] += verdicts[i].stage == mlfw::STAGE_LOF;
+        }
+        exact = exact && wrong == 0;
+
+        auto percent = [&](uint64_t n, uint64_t of) { return of > 0 ? 100.0 * n / of : 0.0; };
+        std::cout << std::setprecision(3) << std::setw(8) << margin << std::setprecision(1)
+                  << std::setw(8) << percent(stages[mlfw::STAGE_TREES], count) << std::setw(9)
+                  << percent(stages[mlfw::STAGE_FOREST], count) << std::setw(7)
+                  << percent(stages[mlfw::STAGE_LOF], count) << std::setw(13)
+                  << double(trees) / count << std::setw(10) << ns << std::setw(8)
+                  << fullNs / ns << "x" << std::setw(11) << changed << std::setw(16)
+                  << percent(districtLof[mlfw::DISTRICT_HOSPITAL],
+                             districtFlows[mlfw::DISTRICT_HOSPITAL])
+                  << std::setw(17)
+                  << percent(districtLof[mlfw::DISTRICT_POWER_GRID],
+                             districtFlows[mlfw::DISTRICT_POWER_GRID])
+                  << std::endl;
+        if (wrong > 0)
+        {
+            std::cout << "  " << wrong << " cascaded decisions differ from the full scores'"
+                      << std::endl;
+        }
+    }
+    std::cout << std::defaultfloat;
+    return exact;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    uint64_t syntheticRows = 100000;
+    uint32_t chunk = 8;
+    std::vector<LabeledFlow> flows;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            syntheticRows = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            chunk = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!LoadFlowCsv(argv[i], flows))
+        {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    NativeScorer full;
+    if (flows.empty() ||
+        !full.Load("saved_models/isolation_forest.txt", "saved_models/model_metadata.json") ||
+        !full.LoadLof("saved_models/lof_model.txt"))
+    {
+        std::cerr << "usage: " << argv[0] << " [-n SYNTHETIC_ROWS] [-c CHUNK] FLOWS.csv... "
+                  << "(run from the repository root after export_models.py)" << std::endl;
+        return 2;
+    }
+    std::cout << "Forest: " << full.GetForest().GetTrees() << " trees, iso_threshold "
+              << full.GetIsoThreshold() << "; LOF: " << full.GetLof().GetSamples()
+              << " samples, lof_threshold " << full.GetLofThreshold() << "; chunk " << chunk
+              << " trees" << std::endl;
+    std::cout << "Exits: trees = settled by part of the trees, forest = by all of them, "
+              << "lof = in the band, scored by the LOF; vs forest = decisions that differ "
+              << "from the forest alone" << std::endl;
+
+    std::vector<FlowQuery> queries;
+    for (const LabeledFlow& flow : flows)
+    {
+        queries.push_back(flow.query);
+    }
+    std::vector<FlowQuery> synthetic;
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, flows.size() - 1);
+    for (uint64_t i = 0; i < syntheticRows; i++)
+    {
+        FlowQuery q = flows[pick(rng)].query;
+        mlfw::PerturbFlow(q, rng);
+        q.flowId = i;
+        synthetic.push_back(q);
+    }
+
+    std::vector<double> margins = {0.0, 0.005, 0.01, 0.02, 0.05};
+    bool exact = Report("Dataset", full, margins, chunk, queries);
+    exact = Report("Synthetic", full, margins, chunk, synthetic) && exact;
+    return exact ? 0 : 1;
+}
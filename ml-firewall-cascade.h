@@ -0,0 +1,198 @@
+#ifndef ML_FIREWALL_CASCADE_H
+#define ML_FIREWALL_CASCADE_H
+
+#include "ml-firewall-forest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace mlfw
+{
+
+// Stage of a cascaded scorer at which a flow was settled, carried by its
+// verdict. STAGE_NONE: not cascaded (every model scored it).
+enum CascadeStage : uint8_t
+{
+    STAGE_NONE = 0,
+    STAGE_TREES,  // part of the trees proved the score outside the band
+    STAGE_FOREST, // all the trees, score outside the band
+    STAGE_LOF,    // score inside the band, decided by the LOF
+    N_CASCADE_STAGES
+};
+
+inline const char*
+GetCascadeStageName(uint8_t stage)
+{
+    static const char* const names[N_CASCADE_STAGES] = {"none", "trees", "forest", "lof"};
+    return stage < N_CASCADE_STAGES ? names[stage] : names[STAGE_NONE];
+}
+
+} // namespace mlfw
+
+// Isolation Forest stage of a cascaded ensemble. A flow whose decision
+// function falls outside the band [low, high] is settled by the forest:
+// blocked below it, passed above it. Only flows inside the band go on to the
+// LOF, so the k-NN search is paid for the ambiguous flows alone.
+//
+// The trees are walked chunk by chunk. After each chunk, the partial path
+// length plus the shortest and longest leaf path lengths of the trees still
+// to walk bound the final depth; once both bounds normalize to the same side
+// of the band, the remaining trees cannot change the outcome and the flow
+// leaves. Its score is then the partial average extrapolated to all trees,
+// which is only an estimate; flows that walk every tree keep their exact
+// score. Outcomes are the ones full scores would give.
+class ForestCascade
+{
+  public:
+    // Bounds the trees of forest for the band [low, high], to be checked every
+    // chunk trees (rounded up to a multiple of IsolationForest::TREE_GROUP so
+    // the batched kernels can walk each chunk). Returns false if it is not
+    // loaded or low > high.
+    bool Build(const IsolationForest& forest, double low, double high, uint32_t chunk)
+    {
+        *this = ForestCascade();
+        if (!forest.IsLoaded() || !(low <= high))
+        {
+            return false;
+        }
+        uint32_t group = IsolationForest::TREE_GROUP;
+        uint32_t trees = forest.GetTrees();
+        m_low = low;
+        m_high = high;
+        m_chunk = std::max(group, (chunk + group - 1) / group * group);
+        m_restMin.assign(trees + 1, 0.0);
+        m_restMax.assign(trees + 1, 0.0);
+        for (uint32_t t = trees; t-- > 0;)
+        {
+            double shortest, longest;
+            LeafRange(forest, forest.GetTreeRoot(t), shortest, longest);
+            m_restMin[t] = m_restMin[t + 1] + shortest;
+            m_restMax[t] = m_restMax[t + 1] + longest;
+        }
+        return true;
+    }
+
+    bool IsBuilt() const
+    {
+        return !m_restMin.empty();
+    }
+
+    // Scores count flows whose scaled features are stored row after row in
+    // x with forest, the one the cascade was built from. scores[i] is the
+    // decision function (an estimate for flows that left early); stages[i]
+    // is STAGE_TREES or STAGE_FOREST if the flow was settled, STAGE_LOF if
+    // its score is inside the band. Adds the trees walked to *trees if given.
+    void Score(const IsolationForest& forest,
+               const float* x,
+               size_t count,
+               double* scores,
+               uint8_t* stages,
+               uint64_t* trees = nullptr) const
+    {
+        uint32_t features = forest.GetFeatures();
+        uint32_t total = forest.GetTrees();
+        // Flows still walking, packed at the front: their rows, indices and
+        // partial depths
+        std::vector<float> rows(x, x + count * features);
+        std::vector<size_t> index(count);
+        std::vector<double> depths(count, 0.0);
+        for (size_t i = 0; i < count; i++)
+        {
+            index[i] = i;
+        }
+        size_t active = count;
+        for (uint32_t first = 0; first < total && active > 0; first += m_chunk)
+        {
+            uint32_t last = std::min(total, first + m_chunk);
+            forest.AddPathLengths(rows.data(), active, first, last, depths.data());
+            if (trees)
+            {
+                *trees += uint64_t(active) * (last - first);
+            }
+            size_t kept = 0;
+            for (size_t a = 0; a < active; a++)
+            {
+                size_t i = index[a];
+                double depth = depths[a];
+                if (last == total)
+                {
+                    scores[i] = forest.Normalize(depth);
+                    bool inside = scores[i] >= m_low && scores[i] <= m_high;
+                    stages[i] = inside ? mlfw::STAGE_LOF : mlfw::STAGE_FOREST;
+                    continue;
+                }
+                // Slack keeps rounding of the bound sums from settling a
+                // flow whose exact score is on the band's edge
+                if (forest.Normalize(depth + m_restMax[last] + 1e-9) < m_low ||
+                    forest.Normalize(depth + m_restMin[last] - 1e-9) > m_high)
+                {
+                    scores[i] = forest.Normalize(depth / last * total);
+                    stages[i] = mlfw::STAGE_TREES;
+                    continue;
+                }
+                if (kept != a)
+                {
+                    std::copy(&rows[a * features], &rows[(a + 1) * features],
+                              &rows[kept * features]);
+                    index[kept] = i;
+                    depths[kept] = depth;
+                }
+                kept++;
+            }
+            active = kept;
+        }
+    }
+
+    double GetLow() const
+    {
+        return m_low;
+    }
+
+    double GetHigh() const
+    {
+        return m_high;
+    }
+
+    uint32_t GetChunk() const
+    {
+        return m_chunk;
+    }
+
+  private:
+    // Shortest and longest path length of the leaves of the tree at root
+    static void LeafRange(const IsolationForest& forest,
+                          uint32_t root,
+                          double& shortest,
+                          double& longest)
+    {
+        shortest = std::numeric_limits<double>::infinity();
+        longest = -shortest;
+        std::vector<uint32_t> pending(1, root);
+        while (!pending.empty())
+        {
+            uint32_t n = pending.back();
+            pending.pop_back();
+            IsolationForest::Node node = forest.GetNode(n);
+            if (node.left == n)
+            {
+                shortest = std::min(shortest, node.pathLength);
+                longest = std::max(longest, node.pathLength);
+            }
+            else
+            {
+                pending.push_back(node.left);
+                pending.push_back(node.left + 1);
+            }
+        }
+    }
+
+    double m_low = 0.0;
+    double m_high = 0.0;
+    uint32_t m_chunk = 0;
+    std::vector<double> m_restMin; // t: shortest path lengths of trees t.. summed
+    std::vector<double> m_restMax;
+};
+
+#endif // ML_FIREWALL_CASCADE_H
@@ -0,0 +1,1012 @@
+#ifndef ML_FIREWALL_CLIENT_H
+#define ML_FIREWALL_CLIENT_H
+
+#include "ml-firewall-protocol.h"
+#include "ml-firewall-transport.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Flow record sent to the ML firewall for one verdict
+struct FlowQuery
+{
+    uint32_t flowId = 0;
+    uint32_t srcAddress = 0; // host byte order, as Ipv4Address::Get()
+    uint32_t dstAddress = 0;
+    uint16_t srcPort = 0;
+    uint16_t dstPort = 0;
+    uint8_t protocol = 0;
+    uint32_t txPackets = 0;
+    uint32_t rxPackets = 0;
+    uint64_t txBytes = 0;
+    uint64_t rxBytes = 0;
+    double duration = 0.0;
+    double throughput = 0.0;
+    double packetLoss = 0.0;
+    double delay = 0.0;
+    double jitter = 0.0;
+    uint8_t district = mlfw::DISTRICT_CORE;
+};
+
+// Verdict returned by the ML firewall for one flow. Scores are NaN when the
+// scorer did not report them (a JSON service answering only shouldBlock).
+struct FlowVerdict
+{
+    uint32_t flowId = 0;
+    bool shouldBlock = false;
+    bool degraded = false; // produced by the client's fallback, not the scorer
+    float isoScore = NAN;
+    float lofFactor = NAN;
+    uint32_t modelTag = 0; // MakeModelTag() of the model that scored it, 0 if unknown
+    uint8_t stage = 0;     // mlfw::CascadeStage that settled it, STAGE_NONE if not cascaded
+};
+
+// Scores a flow locally when the scorer cannot. Must set shouldBlock; the
+// caller has already marked the verdict degraded.
+typedef std::function<void(const FlowQuery&, FlowVerdict&)> FallbackScorer;
+
+// Scores count flows in-process, all at once. Must set shouldBlock of each
+// verdict.
+typedef std::function<void(const FlowQuery* queries, size_t count, FlowVerdict* verdicts)>
+    LocalScorer;
+
+// Fills the 16 model features in the column order of model_metadata.json,
+// derived the same way as preprocess_for_service_compatibility() in the
+// training notebook. With T = double the derived features are computed at
+// the precision the scorer service uses.
+template <typename T>
+inline void
+ComputeModelFeatures(const FlowQuery& q, T* features)
+{
+    features[mlfw::TX_PACKETS] = q.txPackets;
+    features[mlfw::RX_PACKETS] = q.rxPackets;
+    features[mlfw::TX_BYTES] = q.txBytes;
+    features[mlfw::RX_BYTES] = q.rxBytes;
+    features[mlfw::DURATION] = q.duration;
+    features[mlfw::THROUGHPUT] = q.throughput;
+    features[mlfw::PACKET_LOSS] = q.packetLoss;
+    features[mlfw::DELAY] = q.delay;
+    features[mlfw::JITTER] = q.jitter;
+    features[mlfw::PACKET_DELIVERY_RATIO] = q.rxPackets / (q.txPackets + 1e-6);
+    features[mlfw::BYTE_DELIVERY_RATIO] = q.rxBytes / (q.txBytes + 1e-6);
+    features[mlfw::AVG_PACKET_SIZE] = q.txBytes / (q.txPackets + 1e-6);
+    features[mlfw::THROUGHPUT_EFFICIENCY] = q.throughput / (q.duration + 1e-6);
+    features[mlfw::IS_WELL_KNOWN_PORT] = q.dstPort <= 1023 ? 1 : 0;
+    features[mlfw::IS_WEB_PORT] = (q.dstPort == 80 || q.dstPort == 443 || q.dstPort == 8080) ? 1 : 0;
+    features[mlfw::IS_SUSPICIOUS_PORT] = (q.dstPort == 31337 || q.dstPort == 12345) ? 1 : 0;
+}
+
+// Rule-based pre-scorer used while the scorer is unreachable. Flags only
+// unambiguous signatures so that degraded runs err towards letting traffic
+// through: suspicious ports, probes of at most three packets, and floods of
+// sub-MTU datagrams that mostly never arrive. On Dataset/*.csv it blocks about
+// half of the attack flows and none of the normal ones.
+inline void
+RuleBasedFallback(const FlowQuery& q, FlowVerdict& verdict)
+{
+    float features[mlfw::N_FEATURES];
+    ComputeModelFeatures(q, features);
+
+    bool probe = q.txPackets > 0 && q.txPackets <= 3;
+    bool flood = q.txPackets >= 200 && q.packetLoss >= 0.9 &&
+                 features[mlfw::AVG_PACKET_SIZE] <= 1100;
+    verdict.shouldBlock = features[mlfw::IS_SUSPICIOUS_PORT] != 0 || probe || flood;
+}
+
+// One connection to the scorer, shared by the blocking and the pipelined
+// client. Socket transports use fd; the shared-memory transport uses shm.
+struct FirewallConnection
+{
+    FirewallTransport transport = TRANSPORT_TCP;
+    int fd = -1;
+    std::unique_ptr<mlfw::ShmRingPair> shm;
+    bool binary = false;
+    FirewallClock::time_point deadline = FirewallClock::time_point::max(); // of the current exchange
+    std::string rxBuffer;         // bytes received past the last reply
+    std::vector<uint8_t> txFrame; // reused binary request frame
+    std::vector<uint8_t> rxFrame; // reused binary reply records
+};
+
+namespace mlfw
+{
+
+// Waits until the socket is ready for events. Fails with errno ETIMEDOUT
+// once conn.deadline passes.
+inline bool
+WaitReady(FirewallConnection& conn, short events)
+{
+    while (true)
+    {
+        int waitMs = conn.deadline == FirewallClock::time_point::max() ? -1
+                                                                        : RemainingMs(conn.deadline);
+        if (waitMs == 0)
+        {
+            errno = ETIMEDOUT;
+            return false;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = conn.fd;
+        pfd.events = events;
+        int n = poll(&pfd, 1, waitMs);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n == 0)
+        {
+            errno = ETIMEDOUT;
+        }
+        return n > 0;
+    }
+}
+
+inline bool
+SendAll(FirewallConnection& conn, const void* data, size_t length)
+{
+    if (conn.shm)
+    {
+        return conn.shm->WriteAll(static_cast<const uint8_t*>(data), length, conn.deadline);
+    }
+
+    const char* p = static_cast<const char*>(data);
+    size_t sent = 0;
+    while (sent < length)
+    {
+        size_t chunk = length - sent;
+        if (conn.transport == TRANSPORT_UNIX)
+        {
+            chunk = std::min(chunk, SEQPACKET_MESSAGE_SIZE);
+        }
+        ssize_t n = send(conn.fd, p + sent, chunk, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (!WaitReady(conn, POLLOUT))
+            {
+                return false;
+            }
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+inline bool
+SendLine(FirewallConnection& conn, const std::string& line)
+{
+    std::string framed = line;
+    framed.push_back('\n');
+    return SendAll(conn, framed.data(), framed.size());
+}
+
+// Appends at least one more received byte to conn.rxBuffer, waiting until
+// conn.deadline. With flags == MSG_DONTWAIT returns false and sets errno to
+// EAGAIN if nothing is pending.
+inline bool
+RecvMore(FirewallConnection& conn, int flags = 0)
+{
+    char buffer[4096];
+    if (conn.shm)
+    {
+        size_t n = flags & MSG_DONTWAIT
+                       ? conn.shm->TryRead(reinterpret_cast<uint8_t*>(buffer), sizeof(buffer))
+                       : conn.shm->ReadSome(reinterpret_cast<uint8_t*>(buffer),
+                                            sizeof(buffer),
+                                            conn.deadline);
+        if (n == 0)
+        {
+            if (flags & MSG_DONTWAIT)
+            {
+                errno = EAGAIN;
+            }
+            return false;
+        }
+        conn.rxBuffer.append(buffer, n);
+        return true;
+    }
+
+    while (true)
+    {
+        ssize_t n;
+        if (conn.transport == TRANSPORT_UNIX)
+        {
+            // Size the next message first so it is never truncated
+            ssize_t size = recv(conn.fd, buffer, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+            if (size > 0)
+            {
+                size_t offset = conn.rxBuffer.size();
+                conn.rxBuffer.resize(offset + size);
+                n = recv(conn.fd, &conn.rxBuffer[offset], size, MSG_DONTWAIT);
+                conn.rxBuffer.resize(offset + std::max<ssize_t>(n, 0));
+            }
+            else
+            {
+                n = size;
+            }
+        }
+        else
+        {
+            n = recv(conn.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n > 0)
+            {
+                conn.rxBuffer.append(buffer, n);
+            }
+        }
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !(flags & MSG_DONTWAIT))
+        {
+            if (!WaitReady(conn, POLLIN))
+            {
+                return false;
+            }
+            continue;
+        }
+        if (n == 0)
+        {
+            errno = ECONNRESET;
+        }
+        return n > 0;
+    }
+}
+
+inline bool
+RecvLine(FirewallConnection& conn, std::string& line)
+{
+    size_t eol;
+    while ((eol = conn.rxBuffer.find('\n')) == std::string::npos)
+    {
+        if (!RecvMore(conn))
+        {
+            return false;
+        }
+    }
+
+    line.assign(conn.rxBuffer, 0, eol);
+    conn.rxBuffer.erase(0, eol + 1);
+    return true;
+}
+
+// Reads exactly length bytes, consuming buffered bytes first
+inline bool
+RecvExact(FirewallConnection& conn, uint8_t* data, size_t length)
+{
+    while (conn.rxBuffer.size() < length)
+    {
+        if (!RecvMore(conn))
+        {
+            return false;
+        }
+    }
+
+    std::copy(conn.rxBuffer.begin(), conn.rxBuffer.begin() + length, data);
+    conn.rxBuffer.erase(0, length);
+    return true;
+}
+
+inline void
+CloseConnection(FirewallConnection& conn)
+{
+    if (conn.fd >= 0)
+    {
+        close(conn.fd);
+    }
+    conn.fd = -1;
+    conn.shm.reset();
+}
+
+// Connects a non-blocking socket, waiting for completion until conn.deadline
+inline bool
+ConnectSocket(FirewallConnection& conn, const struct sockaddr* address, socklen_t length)
+{
+    if (connect(conn.fd, address, length) == 0)
+    {
+        return true;
+    }
+    if (errno != EINPROGRESS || !WaitReady(conn, POLLOUT))
+    {
+        return false;
+    }
+
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+    getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+    errno = error;
+    return error == 0;
+}
+
+// Opens a connection over the endpoint's transport, giving up at
+// conn.deadline. Shared-memory connections always speak the binary protocol;
+// socket connections start on JSON. Sockets are left non-blocking.
+inline bool
+OpenConnection(FirewallConnection& conn, const FirewallEndpoint& endpoint)
+{
+    CloseConnection(conn);
+    conn.transport = endpoint.transport;
+    conn.binary = false;
+    conn.rxBuffer.clear();
+
+    if (endpoint.transport == TRANSPORT_SHM)
+    {
+        std::unique_ptr<ShmRingPair> shm(new ShmRingPair());
+        if (!shm->Attach(endpoint.path, conn.deadline))
+        {
+            return false;
+        }
+        conn.shm = std::move(shm);
+        conn.binary = true;
+        return true;
+    }
+
+    if (endpoint.transport == TRANSPORT_UNIX)
+    {
+        conn.fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+        if (conn.fd < 0)
+        {
+            return false;
+        }
+
+        struct sockaddr_un server;
+        std::memset(&server, 0, sizeof(server));
+        server.sun_family = AF_UNIX;
+        std::strncpy(server.sun_path, endpoint.path.c_str(), sizeof(server.sun_path) - 1);
+
+        if (!ConnectSocket(conn, (struct sockaddr*)&server, sizeof(server)))
+        {
+            CloseConnection(conn);
+            return false;
+        }
+    }
+    else
+    {
+        conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (conn.fd < 0)
+        {
+            return false;
+        }
+
+        struct sockaddr_in server;
+        server.sin_addr.s_addr = inet_addr(endpoint.host.c_str());
+        server.sin_family = AF_INET;
+        server.sin_port = htons(endpoint.port);
+
+        if (!ConnectSocket(conn, (struct sockaddr*)&server, sizeof(server)))
+        {
+            CloseConnection(conn);
+            return false;
+        }
+
+        // Requests are small and latency bound
+        int one = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return true;
+}
+
+enum HelloResult
+{
+    HELLO_BINARY,  // scorer switched the connection to binary frames
+    HELLO_JSON,    // scorer answered the hello as a JSON request
+    HELLO_DROPPED, // scorer closed the connection
+    HELLO_TIMEOUT, // no answer before the connection's deadline
+};
+
+inline HelloResult
+SendHello(FirewallConnection& conn)
+{
+    std::string reply;
+    if (!SendLine(conn, HELLO_LINE) || !RecvLine(conn, reply))
+    {
+        return errno == ETIMEDOUT ? HELLO_TIMEOUT : HELLO_DROPPED;
+    }
+    if (reply.find(HELLO_ACK) == std::string::npos)
+    {
+        return HELLO_JSON;
+    }
+    conn.binary = true;
+    return HELLO_BINARY;
+}
+
+inline void
+AppendAddress(std::ostream& os, uint32_t address)
+{
+    os << ((address >> 24) & 0xff) << "." << ((address >> 16) & 0xff) << "."
+       << ((address >> 8) & 0xff) << "." << (address & 0xff);
+}
+
+inline void
+AppendJson(std::ostream& json, const FlowQuery& q)
+{
+    json << "{\"flowId\":" << q.flowId << ",\"srcIP\":\"";
+    AppendAddress(json, q.srcAddress);
+    json << "\",\"dstIP\":\"";
+    AppendAddress(json, q.dstAddress);
+    json << "\",\"txPackets\":" << q.txPackets << ",\"rxPackets\":" << q.rxPackets
+         << ",\"txBytes\":" << q.txBytes << ",\"rxBytes\":" << q.rxBytes
+         << ",\"duration\":" << q.duration << ",\"throughput\":" << q.throughput
+         << ",\"packetLoss\":" << q.packetLoss << ",\"delay\":" << q.delay
+         << ",\"jitter\":" << q.jitter << ",\"dstPort\":" << q.dstPort << ",\"district\":\""
+         << GetDistrictName(q.district) << "\"}";
+}
+
+// Parses the "shouldBlock":[true,false,...] array of a batch reply
+inline bool
+ParseVerdictArray(const std::string& response, FlowVerdict* verdicts, size_t count)
+{
+    size_t pos = response.find("\"shouldBlock\":[");
+    if (pos == std::string::npos)
+        return false;
+    pos = response.find('[', pos) + 1;
+
+    size_t parsed = 0;
+    while (pos < response.size() && response[pos] != ']')
+    {
+        if (response.compare(pos, 4, "true") == 0)
+        {
+            if (parsed == count)
+                return false;
+            verdicts[parsed++].shouldBlock = true;
+            pos += 4;
+        }
+        else if (response.compare(pos, 5, "false") == 0)
+        {
+            if (parsed == count)
+                return false;
+            verdicts[parsed++].shouldBlock = false;
+            pos += 5;
+        }
+        else
+        {
+            pos++; // separators and whitespace
+        }
+    }
+    return parsed == count;
+}
+
+// Number at pos of a JSON reply, NaN for null or anything else
+inline float
+ParseJsonScore(const std::string& response, size_t pos)
+{
+    char* end = nullptr;
+    double value = std::strtod(response.c_str() + pos, &end);
+    return end != response.c_str() + pos ? value : NAN;
+}
+
+// Value of the "key": score of a single-flow reply, NaN if absent
+inline float
+ParseScoreField(const std::string& response, const char* key)
+{
+    size_t pos = response.find("\"" + std::string(key) + "\":");
+    return pos == std::string::npos ? NAN : ParseJsonScore(response, pos + std::strlen(key) + 3);
+}
+
+// Reads a single-flow reply into verdict. Returns false if it has no
+// "shouldBlock" decision, as an {"error":...} reply has not.
+inline bool
+ParseVerdict(const std::string& response, FlowVerdict& verdict)
+{
+    bool block = response.find("\"shouldBlock\":true") != std::string::npos;
+    if (!block && response.find("\"shouldBlock\":false") == std::string::npos)
+    {
+        return false;
+    }
+    verdict.shouldBlock = block;
+    verdict.isoScore = ParseScoreField(response, "isoScore");
+    verdict.lofFactor = ParseScoreField(response, "lofFactor");
+    return true;
+}
+
+// Sets the field of every verdict from the "key":[...] number array of a
+// batch reply; scores stay NaN if the reply has no such array
+inline void
+ParseScoreArray(const std::string& response,
+                const char* key,
+                float FlowVerdict::*field,
+                FlowVerdict* verdicts,
+                size_t count)
+{
+    size_t pos = response.find("\"" + std::string(key) + "\":[");
+    if (pos == std::string::npos)
+        return;
+    pos = response.find('[', pos) + 1;
+    for (size_t i = 0; i < count && pos < response.size() && response[pos] != ']'; i++)
+    {
+        verdicts[i].*field = ParseJsonScore(response, pos);
+        pos = response.find_first_of(",]", pos);
+        pos += pos != std::string::npos && response[pos] == ',';
+    }
+}
+
+// Appends a binary score request for count flows to frame
+inline void
+AppendScoreRequest(std::vector<uint8_t>& frame, const FlowQuery* queries, size_t count)
+{
+    size_t offset = frame.size();
+    frame.resize(offset + HEADER_SIZE + count * FLOW_RECORD_SIZE);
+    uint8_t* p = frame.data() + offset;
+    EncodeHeader(p, MSG_SCORE_REQUEST, count);
+    p += HEADER_SIZE;
+
+    FlowRecordV1 record;
+    for (size_t i = 0; i < count; i++)
+    {
+        const FlowQuery& q = queries[i];
+        record.flowId = q.flowId;
+        record.srcAddress = q.srcAddress;
+        record.dstAddress = q.dstAddress;
+        record.dstPort = q.dstPort;
+        record.district = q.district;
+        ComputeModelFeatures(q, record.features);
+        EncodeFlowRecord(p, record);
+        p += FLOW_RECORD_SIZE;
+    }
+}
+
+// Decodes count verdict records into verdicts, checking they answer the
+// expected flows in order
+inline bool
+DecodeScoreReply(const uint8_t* records, size_t count, FlowVerdict* verdicts)
+{
+    VerdictRecordV1 reply;
+    for (size_t i = 0; i < count; i++)
+    {
+        DecodeVerdictRecord(records + i * VERDICT_RECORD_SIZE, reply);
+        if (reply.flowId != verdicts[i].flowId)
+        {
+            return false;
+        }
+        verdicts[i].shouldBlock = reply.shouldBlock != 0;
+        verdicts[i].isoScore = reply.isoScore;
+        verdicts[i].lofFactor = reply.lofFactor;
+    }
+    return true;
+}
+
+} // namespace mlfw
+
+// Client for the ML firewall scorer. Keeps a pool of long-lived connections
+// so requests can be written back-to-back on one connection instead of paying
+// a handshake per flow. Each socket connection negotiates the binary protocol
+// of ml-firewall-protocol.h and falls back to newline-delimited JSON when the
+// scorer does not support it. A shared-memory ring pair admits a single
+// client, so over TRANSPORT_SHM the pool holds one connection and concurrent
+// callers take turns on it.
+//
+// Every exchange is bounded by the FirewallPolicy of ml-firewall-resilience.h.
+// Flows the scorer does not answer in time are scored by the fallback
+// (RuleBasedFallback unless replaced) and come back with degraded set.
+//
+// With a local scorer set, every flow is scored in-process by it and the
+// scorer is never contacted.
+class MLFirewallClient
+{
+  public:
+    enum Protocol
+    {
+        PROTOCOL_AUTO, // binary if the scorer accepts the hello, JSON otherwise
+        PROTOCOL_JSON
+    };
+
+    MLFirewallClient(const FirewallEndpoint& endpoint = FirewallEndpoint(),
+                     uint32_t maxConnections = 4,
+                     Protocol protocol = PROTOCOL_AUTO,
+                     const FirewallPolicy& policy = FirewallPolicy())
+        : m_endpoint(endpoint),
+          m_maxConnections(endpoint.transport == TRANSPORT_SHM ? 1 : maxConnections),
+          m_protocol(protocol),
+          m_policy(policy),
+          m_budget(policy),
+          m_breaker(policy.breakerThreshold, policy.breakerCooldownMs),
+          m_fallback(RuleBasedFallback)
+    {
+    }
+
+    ~MLFirewallClient()
+    {
+        for (Connection& conn : m_idle)
+        {
+            mlfw::CloseConnection(conn);
+        }
+    }
+
+    MLFirewallClient(const MLFirewallClient&) = delete;
+    MLFirewallClient& operator=(const MLFirewallClient&) = delete;
+
+    // Scores a single flow. Returns false if the scorer gave no verdict, in
+    // which case the verdict comes from the fallback.
+    bool Query(const FlowQuery& query, FlowVerdict& verdict)
+    {
+        return ScoreChunk(&query, 1, &verdict, false);
+    }
+
+    bool Query(const FlowQuery& query)
+    {
+        FlowVerdict verdict;
+        Query(query, verdict);
+        return verdict.shouldBlock;
+    }
+
+    // Scores all flows using as few round trips as possible. The queries are
+    // sent in chunks of at most batchSize records; in JSON mode as
+    // {"batch":[{...},{...}]} answered by {"shouldBlock":[...]} in request
+    // order. verdicts[i] is the verdict of queries[i]; flows whose chunk could
+    // not be scored get a degraded verdict from the fallback.
+    bool QueryBatch(const std::vector<FlowQuery>& queries,
+                    std::vector<FlowVerdict>& verdicts,
+                    uint32_t batchSize = 256)
+    {
+        verdicts.assign(queries.size(), FlowVerdict());
+        batchSize = std::max<uint32_t>(1, std::min(batchSize, mlfw::MAX_RECORDS_PER_MESSAGE));
+
+        bool allScored = true;
+        for (size_t begin = 0; begin < queries.size(); begin += batchSize)
+        {
+            size_t count = std::min<size_t>(queries.size() - begin, batchSize);
+            if (!ScoreChunk(&queries[begin], count, &verdicts[begin], true))
+            {
+                allScored = false;
+            }
+        }
+        return allScored;
+    }
+
+    void SetFallback(FallbackScorer fallback)
+    {
+        m_fallback = std::move(fallback);
+    }
+
+    // Set before the first query
+    void SetLocalScorer(LocalScorer scorer)
+    {
+        m_localScorer = std::move(scorer);
+    }
+
+    // Closes the pooled connections; the next query opens a new one. Frees a
+    // shared memory ring pair, which admits one client at a time, for another.
+    void CloseIdle()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (Connection& conn : m_idle)
+        {
+            mlfw::CloseConnection(conn);
+        }
+        m_idle.clear();
+    }
+
+    uint32_t GetConnectionsOpened() const
+    {
+        return m_connectionsOpened;
+    }
+
+    uint32_t GetBinaryConnections() const
+    {
+        return m_binaryConnections;
+    }
+
+    uint32_t GetFailedExchanges() const
+    {
+        return m_failedExchanges;
+    }
+
+    uint32_t GetDegradedVerdicts() const
+    {
+        return m_degradedVerdicts;
+    }
+
+    uint32_t GetBreakerTrips() const
+    {
+        return m_breaker.GetTrips();
+    }
+
+  private:
+    typedef FirewallConnection Connection;
+
+    bool ScoreChunk(const FlowQuery* queries, size_t count, FlowVerdict* verdicts, bool batch)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            verdicts[i] = FlowVerdict();
+            verdicts[i].flowId = queries[i].flowId;
+        }
+        if (m_localScorer)
+        {
+            m_localScorer(queries, count, verdicts);
+            return true;
+        }
+
+        // The first attempt may reuse a pooled connection the scorer closed
+        // while idle; retries always use a fresh one.
+        Connection conn;
+        bool acquired = false;
+        for (uint32_t attempt = 0; attempt <= m_policy.maxRetries; attempt++)
+        {
+            if (attempt > 0)
+            {
+                std::this_thread::sleep_for(m_policy.Backoff(attempt));
+            }
+            if (!m_budget.NextDeadline(conn.deadline))
+            {
+                m_breaker.Latch();
+            }
+            if (!m_breaker.Allow())
+            {
+                break;
+            }
+
+            bool ok;
+            if (!acquired)
+            {
+                ok = acquired = Acquire(conn);
+            }
+            else
+            {
+                mlfw::CloseConnection(conn);
+                ok = Connect(conn);
+            }
+
+            if (ok && Exchange(conn, queries, count, verdicts, batch))
+            {
+                m_breaker.RecordSuccess();
+                Release(conn);
+                return true;
+            }
+            m_failedExchanges++;
+            m_breaker.RecordFailure();
+        }
+
+        if (acquired)
+        {
+            Discard(conn);
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            Fallback(queries[i], verdicts[i]);
+        }
+        return false;
+    }
+
+    void Fallback(const FlowQuery& query, FlowVerdict& verdict)
+    {
+        verdict = FlowVerdict();
+        verdict.flowId = query.flowId;
+        verdict.degraded = true;
+        if (m_fallback)
+        {
+            m_fallback(query, verdict);
+        }
+        m_degradedVerdicts++;
+    }
+
+    bool Exchange(Connection& conn,
+                  const FlowQuery* queries,
+                  size_t count,
+                  FlowVerdict* verdicts,
+                  bool batch)
+    {
+        if (conn.binary)
+        {
+            return ExchangeBinary(conn, queries, count, verdicts);
+        }
+        return ExchangeJson(conn, queries, count, verdicts, batch);
+    }
+
+    bool ExchangeBinary(Connection& conn,
+                        const FlowQuery* queries,
+                        size_t count,
+                        FlowVerdict* verdicts)
+    {
+        conn.txFrame.clear();
+        mlfw::AppendScoreRequest(conn.txFrame, queries, count);
+        if (!mlfw::SendAll(conn, conn.txFrame.data(), conn.txFrame.size()))
+        {
+            return false;
+        }
+
+        uint8_t header[mlfw::HEADER_SIZE];
+        uint32_t replyCount;
+        if (!mlfw::RecvExact(conn, header, sizeof(header)) ||
+            !mlfw::DecodeHeader(header, mlfw::MSG_SCORE_REPLY, replyCount) || replyCount != count)
+        {
+            return false;
+        }
+
+        conn.rxFrame.resize(count * mlfw::VERDICT_RECORD_SIZE);
+        if (!mlfw::RecvExact(conn, conn.rxFrame.data(), conn.rxFrame.size()))
+        {
+            return false;
+        }
+        return mlfw::DecodeScoreReply(conn.rxFrame.data(), count, verdicts);
+    }
+
+    bool ExchangeJson(Connection& conn,
+                      const FlowQuery* queries,
+                      size_t count,
+                      FlowVerdict* verdicts,
+                      bool batch)
+    {
+        std::ostringstream json;
+        if (batch)
+        {
+            json << "{\"batch\":[";
+            for (size_t i = 0; i < count; i++)
+            {
+                if (i != 0)
+                    json << ",";
+                mlfw::AppendJson(json, queries[i]);
+            }
+            json << "]}";
+        }
+        else
+        {
+            mlfw::AppendJson(json, queries[0]);
+        }
+
+        std::string response;
+        if (!mlfw::SendLine(conn, json.str()) || !mlfw::RecvLine(conn, response))
+        {
+            return false;
+        }
+
+        if (!batch)
+        {
+            return mlfw::ParseVerdict(response, verdicts[0]);
+        }
+        if (!mlfw::ParseVerdictArray(response, verdicts, count))
+        {
+            return false;
+        }
+        mlfw::ParseScoreArray(response, "isoScore", &FlowVerdict::isoScore, verdicts, count);
+        mlfw::ParseScoreArray(response, "lofFactor", &FlowVerdict::lofFactor, verdicts, count);
+        return true;
+    }
+
+    // Takes an idle connection or opens a new one before conn.deadline. Over
+    // shared memory waits until the single connection is returned. Every
+    // successful Acquire() is paired with a Release() or, for a broken
+    // connection, a Discard().
+    bool Acquire(Connection& conn)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_endpoint.transport == TRANSPORT_SHM &&
+                !m_released.wait_until(lock, conn.deadline, [this] { return m_checkedOut == 0; }))
+            {
+                return false;
+            }
+            m_checkedOut++;
+            if (!m_idle.empty())
+            {
+                FirewallClock::time_point deadline = conn.deadline;
+                conn = std::move(m_idle.back());
+                conn.deadline = deadline;
+                m_idle.pop_back();
+                return true;
+            }
+        }
+        if (Connect(conn))
+        {
+            return true;
+        }
+        Discard(conn);
+        return false;
+    }
+
+    void Release(Connection& conn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_checkedOut--;
+            if (m_idle.size() < m_maxConnections)
+            {
+                m_idle.push_back(std::move(conn));
+            }
+            else
+            {
+                mlfw::CloseConnection(conn);
+            }
+        }
+        m_released.notify_one();
+    }
+
+    void Discard(Connection& conn)
+    {
+        mlfw::CloseConnection(conn);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_checkedOut--;
+        }
+        m_released.notify_one();
+    }
+
+    bool Connect(Connection& conn)
+    {
+        if (!mlfw::OpenConnection(conn, m_endpoint))
+        {
+            return false;
+        }
+        m_connectionsOpened++;
+
+        if (conn.binary)
+        {
+            // Shared memory speaks only the binary protocol
+            m_binaryConnections++;
+        }
+        else if (m_protocol == PROTOCOL_AUTO && !m_binaryRejected)
+        {
+            switch (mlfw::SendHello(conn))
+            {
+            case mlfw::HELLO_BINARY:
+                m_binaryConnections++;
+                return true;
+            case mlfw::HELLO_JSON:
+                m_binaryRejected = true;
+                return true;
+            case mlfw::HELLO_DROPPED:
+                // The scorer dropped the connection on the unknown hello;
+                // stay on JSON from now on.
+                m_binaryRejected = true;
+                if (!mlfw::OpenConnection(conn, m_endpoint))
+                {
+                    return false;
+                }
+                m_connectionsOpened++;
+                return true;
+            case mlfw::HELLO_TIMEOUT:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    FirewallEndpoint m_endpoint;
+    uint32_t m_maxConnections;
+    Protocol m_protocol;
+    FirewallPolicy m_policy;
+    FirewallBudget m_budget;
+    CircuitBreaker m_breaker;
+    FallbackScorer m_fallback;
+    LocalScorer m_localScorer;
+    std::atomic<bool> m_binaryRejected{false};
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+    std::vector<Connection> m_idle;
+    uint32_t m_checkedOut = 0;
+    std::atomic<uint32_t> m_connectionsOpened{0};
+    std::atomic<uint32_t> m_binaryConnections{0};
+    std::atomic<uint32_t> m_failedExchanges{0};
+    std::atomic<uint32_t> m_degradedVerdicts{0};
+};
+
+#endif // ML_FIREWALL_CLIENT_H
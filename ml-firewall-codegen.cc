@@ -0,0 +1,189 @@
+// Compiles the exported Isolation Forest to C++ and benchmarks the result
+// against the interpreted forest.
+//
+//   g++ -O2 -std=c++17 -o ml-firewall-codegen ml-firewall-codegen.cc
+//   ./ml-firewall-codegen -o ml-firewall-forest-compiled.cc
+//   g++ -O2 -std=c++17 -o ml-firewall-codegen ml-firewall-codegen.cc ml-firewall-forest-compiled.cc
+//   ./ml-firewall-codegen [-n SYNTHETIC_ROWS] Dataset/*.csv
+//
+// With -o, writes saved_models/isolation_forest.txt as a translation unit
+// (see mlfw::WriteCompiledForest()). Link that file into any program using
+// NativeScorer, the simulation included, to make the compiled forest
+// available to it; it must be regenerated whenever the model is retrained.
+//
+// Built with the generated file and given flow CSVs, scores their flows and
+// a synthetic set (1M rows by default) made by perturbing them: one flow at
+// a time with the interpreted forest and with the compiled one, and in
+// batches with the widest interpreted kernel the CPU supports. Compiled
+// scores must be bit-identical to the interpreted ones; exits with status 1
+// otherwise, or if the linked code was generated from another forest.
+
+#include "ml-firewall-compiled.h"
+#include "ml-firewall-dataset.h"
+#include "ml-firewall-native.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+
+// ns/flow of score over rows, best of three passes; scores are those of the
+// last pass
+template <typename Score>
+double
+Time(size_t count, std::vector<double>& scores, Score score)
+{
+    scores.assign(count, 0.0);
+    double best = 0.0;
+    for (int pass = 0; pass < 3; pass++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        score(scores.data());
+        double ns = std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count();
+        best = pass == 0 ? ns : std::min(best, ns);
+    }
+    return best / std::max<size_t>(1, count);
+}
+
+// Times the interpreted and compiled forests over queries; false if a
+// compiled score differs from the interpreted one
+bool
+Report(const char* title,
+       const IsolationForest& forest,
+       const CompiledForest& compiled,
+       const std::vector<FlowQuery>& queries)
+{
+    size_t count = queries.size();
+    std::vector<float> x(count * mlfw::N_FEATURES);
+    FlowBatch batch;
+    for (const FlowQuery& query : queries)
+    {
+        batch.Append(query);
+    }
+    ExtractFeatures(batch, 0, count, &forest.GetScaler(), x.data());
+
+    std::vector<double> interpreted, batched, generated;
+    double interpretedNs = Time(count, interpreted, [&](double* scores) {
+        for (size_t i = 0; i < count; i++)
+        {
+            scores[i] = forest.DecisionFunction(&x[i * mlfw::N_FEATURES]);
+        }
+    });
+    double batchedNs = Time(count, batched, [&](double* scores) {
+        forest.DecisionFunctionBatch(x.data(), count, scores);
+    });
+    double compiledNs = Time(count, generated, [&](double* scores) {
+        for (size_t i = 0; i < count; i++)
+        {
+            scores[i] = forest.Normalize(compiled.pathLengthSum(&x[i * mlfw::N_FEATURES]));
+        }
+    });
+
+    uint64_t differences = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        differences += generated[i] != interpreted[i] || batched[i] != interpreted[i];
+    }
+    std::cout << std::left << std::setw(11) << title << std::right << std::setw(10) << count
+              << std::fixed << std::setprecision(1) << std::setw(16) << interpretedNs
+              << std::setw(13) << batchedNs << std::setw(14) << compiledNs << std::setw(8)
+              << interpretedNs / compiledNs << "x" << std::setw(13) << differences
+              << std::defaultfloat << std::endl;
+    return differences == 0;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    uint64_t syntheticRows = 1000000;
+    std::string outputPath;
+    std::vector<LabeledFlow> flows;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            syntheticRows = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else if (!LoadFlowCsv(argv[i], flows))
+        {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    const char* forestPath = "saved_models/isolation_forest.txt";
+    NativeScorer scorer;
+    const CompiledForest* compiled = mlfw::GetLinkedCompiledForest();
+    if ((outputPath.empty() && (flows.empty() || !compiled)) ||
+        !scorer.Load(forestPath, "saved_models/model_metadata.json"))
+    {
+        std::cerr << "usage: " << argv[0]
+                  << " -o COMPILED.cc | [-n SYNTHETIC_ROWS] FLOWS.csv... (benchmarking needs "
+                  << "the generated file linked in; run from the repository root after "
+                  << "export_models.py)" << std::endl;
+        return 2;
+    }
+    const IsolationForest& forest = scorer.GetForest();
+
+    if (!outputPath.empty())
+    {
+        std::ofstream out(outputPath);
+        mlfw::WriteCompiledForest(forest, forestPath, out);
+        out.close();
+        if (!out)
+        {
+            std::cerr << "Cannot write " << outputPath << std::endl;
+            return 2;
+        }
+        std::cout << "Wrote " << outputPath << ": " << forest.GetTrees() << " trees, "
+                  << forest.GetNodes() << " nodes, fingerprint " << std::hex
+                  << mlfw::ForestFingerprint(forest) << std::dec << std::endl;
+    }
+    if (flows.empty())
+    {
+        return 0;
+    }
+    if (!compiled || !scorer.UseCompiledForest(compiled))
+    {
+        std::cerr << "The linked compiled forest was not generated from " << forestPath
+                  << "; regenerate it" << std::endl;
+        return 1;
+    }
+
+    std::vector<FlowQuery> queries;
+    for (const LabeledFlow& flow : flows)
+    {
+        queries.push_back(flow.query);
+    }
+    std::vector<FlowQuery> synthetic;
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, flows.size() - 1);
+    for (uint64_t i = 0; i < syntheticRows; i++)
+    {
+        FlowQuery q = flows[pick(rng)].query;
+        mlfw::PerturbFlow(q, rng);
+        q.flowId = i;
+        synthetic.push_back(q);
+    }
+
+    std::cout << "Forest: " << forest.GetTrees() << " trees, " << forest.GetNodes()
+              << " nodes; batched kernel " << IsolationForest::GetKernelName(forest.GetKernel())
+              << std::endl;
+    std::cout << std::left << std::setw(11) << "flows" << std::right << std::setw(10) << "rows"
+              << std::setw(16) << "interpreted ns" << std::setw(13) << "batched ns"
+              << std::setw(14) << "compiled ns" << std::setw(9) << "speedup" << std::setw(13)
+              << "differences" << std::endl;
+    bool exact = Report("Dataset", forest, *compiled, queries);
+    exact = Report("Synthetic", forest, *compiled, synthetic) && exact;
+    return exact ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#ifndef ML_FIREWALL_COMPILED_H
+#define ML_FIREWALL_COMPILED_H
+
+#include "ml-firewall-forest.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Isolation Forest compiled to C++. WriteCompiledForest() turns every tree
+// into a function of nested branches whose split features and thresholds
+// are immediates, and every leaf into a return of its path length; the
+// compiler then lays out and schedules the comparisons of each tree instead
+// of a loop loading them from the node arrays. The generated translation
+// unit defines mlfwCompiledForest; linked into a program, it is found by
+// GetLinkedCompiledForest() and NativeScorer::UseCompiledForest() scores
+// with it. Path lengths are summed in tree order, so scores are
+// bit-identical to IsolationForest's.
+//
+// The code is for one fixed model: it carries the fingerprint of the forest
+// it was made from, and a scorer with any other forest refuses it.
+struct CompiledForest
+{
+    uint64_t fingerprint; // mlfw::ForestFingerprint() of the source forest
+    uint32_t trees;
+    uint32_t features;
+    // Path lengths of one flow's scaled features, summed in tree order: what
+    // IsolationForest::Normalize() takes
+    double (*pathLengthSum)(const float* x);
+};
+
+// Defined by a translation unit WriteCompiledForest() wrote, if one is
+// linked in; weak, so programs link without one
+extern const CompiledForest mlfwCompiledForest __attribute__((weak));
+
+namespace mlfw
+{
+
+// The compiled forest linked into this program, null if there is none
+inline const CompiledForest*
+GetLinkedCompiledForest()
+{
+    return &mlfwCompiledForest;
+}
+
+// FNV-1a over every tree and node of forest and its normalization
+inline uint64_t
+ForestFingerprint(const IsolationForest& forest)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&h](const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            h = (h ^ bytes[i]) * 0x100000001b3ULL;
+        }
+    };
+    for (uint32_t t = 0; t < forest.GetTrees(); t++)
+    {
+        uint32_t tree[2] = {forest.GetTreeRoot(t), forest.GetTreeDepth(t)};
+        mix(tree, sizeof(tree));
+    }
+    for (uint32_t n = 0; n < forest.GetNodes(); n++)
+    {
+        IsolationForest::Node node = forest.GetNode(n);
+        mix(&node.feature, sizeof(node.feature));
+        mix(&node.threshold, sizeof(node.threshold));
+        mix(&node.left, sizeof(node.left));
+        mix(&node.pathLength, sizeof(node.pathLength));
+    }
+    double normalization[2] = {forest.GetOffset(), forest.GetDenominator()};
+    mix(normalization, sizeof(normalization));
+    return h;
+}
+
+// Emits node n of forest and its subtree at indent
+inline void
+WriteCompiledNode(const IsolationForest& forest, uint32_t n, std::ostream& out, size_t indent)
+{
+    std::string pad(indent, ' ');
+    for (;;)
+    {
+        IsolationForest::Node node = forest.GetNode(n);
+        if (node.left == n)
+        {
+            out << pad << "return " << node.pathLength << ";\n";
+            return;
+        }
+        // As the interpreter walks: right if greater, so NaN goes left
+        out << pad << "if (x[" << node.feature << "] > " << node.threshold << "f)\n"
+            << pad << "{\n";
+        WriteCompiledNode(forest, node.left + 1, out, indent + 4);
+        out << pad << "}\n";
+        n = node.left;
+    }
+}
+
+// Writes a translation unit scoring with forest to out. source names the
+// model in its header comment.
+inline void
+WriteCompiledForest(const IsolationForest& forest, const std::string& source, std::ostream& out)
+{
+    std::ios::fmtflags flags = out.flags();
+    out << "// Isolation Forest compiled by ml-firewall-codegen from " << source << ":\n// "
+        << forest.GetTrees() << " trees, " << forest.GetNodes() << " nodes.\n"
+        << "// Generated; regenerate when the model is retrained.\n\n"
+        << "#include \"ml-firewall-compiled.h\"\n\nnamespace\n{\n";
+    out << std::hexfloat; // thresholds and path lengths exactly
+    for (uint32_t t = 0; t < forest.GetTrees(); t++)
+    {
+        out << "\ndouble\nTree" << t << "(const float* x)\n{\n";
+        WriteCompiledNode(forest, forest.GetTreeRoot(t), out, 4);
+        out << "}\n";
+    }
+    out << "\ndouble\nPathLengthSum(const float* x)\n{\n    double depth = 0.0;\n";
+    for (uint32_t t = 0; t < forest.GetTrees(); t++)
+    {
+        out << "    depth += Tree" << t << "(x);\n";
+    }
+    out << "    return depth;\n}\n\n} // namespace\n\n"
+        << "extern const CompiledForest mlfwCompiledForest = {0x" << std::hex
+        << ForestFingerprint(forest) << "ULL, " << std::dec << forest.GetTrees() << ", "
+        << forest.GetFeatures() << ", PathLengthSum};\n";
+    out.flags(flags);
+}
+
+} // namespace mlfw
+
+#endif // ML_FIREWALL_COMPILED_H
@@ -0,0 +1,146 @@
+#ifndef ML_FIREWALL_DATASET_H
+#define ML_FIREWALL_DATASET_H
+
+#include "ml-firewall-client.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// One row of a flow CSV as exported by the simulation (Dataset/*.csv)
+struct LabeledFlow
+{
+    FlowQuery query;
+    std::string trafficType;
+    int label = 0; // 1 = attack
+};
+
+namespace mlfw
+{
+
+// Number in a CSV cell; inf and NaN read as 0 like the training notebook's
+// fillna(0)
+inline double
+CsvNumber(const std::string& cell)
+{
+    double v = std::strtod(cell.c_str(), nullptr);
+    return std::isfinite(v) ? v : 0.0;
+}
+
+inline uint32_t
+CsvAddress(const std::string& cell)
+{
+    in_addr addr;
+    return inet_pton(AF_INET, cell.c_str(), &addr) == 1 ? ntohl(addr.s_addr) : 0;
+}
+
+// Scales the counters and timings of a flow by log-normal noise, keeping
+// addresses, ports and protocol, to make synthetic flows for benchmarks
+inline void
+PerturbFlow(FlowQuery& q, std::mt19937_64& rng)
+{
+    std::lognormal_distribution<double> noise(0.0, 0.5);
+    q.txPackets = std::max(1.0, q.txPackets * noise(rng));
+    q.rxPackets = std::min<uint32_t>(q.txPackets, q.rxPackets * noise(rng));
+    q.txBytes = q.txBytes * noise(rng);
+    q.rxBytes = std::min<uint64_t>(q.txBytes, q.rxBytes * noise(rng));
+    q.duration *= noise(rng);
+    q.throughput = q.duration > 0 ? q.rxBytes * 8.0 / q.duration : 0.0;
+    q.packetLoss = (q.txPackets - q.rxPackets) / double(q.txPackets);
+    q.delay *= noise(rng);
+    q.jitter *= noise(rng);
+}
+
+// Area under the ROC curve of the scores for telling attacks (label 1) from
+// normal flows, lower scores ranking as more anomalous; ties count half
+inline double
+RocAuc(const std::vector<double>& scores, const std::vector<int>& labels)
+{
+    std::vector<size_t> order(scores.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return scores[a] > scores[b];
+    });
+    double normals = 0.0, pairs = 0.0, attacks = 0.0;
+    for (size_t i = 0; i < order.size();)
+    {
+        size_t j = i;
+        double tiedNormals = 0.0, tiedAttacks = 0.0;
+        for (; j < order.size() && scores[order[j]] == scores[order[i]]; j++)
+        {
+            (labels[order[j]] == 1 ? tiedAttacks : tiedNormals) += 1.0;
+        }
+        pairs += tiedAttacks * (normals + tiedNormals / 2);
+        normals += tiedNormals;
+        attacks += tiedAttacks;
+        i = j;
+    }
+    return normals > 0 && attacks > 0 ? pairs / (normals * attacks) : 0.0;
+}
+
+} // namespace mlfw
+
+// Appends the rows of a flow CSV to flows. Returns false if the file cannot
+// be read or its header is not the simulation's.
+inline bool
+LoadFlowCsv(const std::string& path, std::vector<LabeledFlow>& flows)
+{
+    static const char* const HEADER =
+        "FlowId,SrcIP,DstIP,SrcPort,DstPort,Protocol,TxPackets,RxPackets,TxBytes,RxBytes,"
+        "Duration,Throughput,PacketLoss,Delay,Jitter,District,TrafficType,Label";
+
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) || line.compare(0, std::strlen(HEADER), HEADER) != 0)
+    {
+        return false;
+    }
+
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> cells;
+        std::stringstream row(line);
+        std::string cell;
+        while (std::getline(row, cell, ','))
+        {
+            cells.push_back(cell);
+        }
+        if (cells.size() < 18)
+        {
+            continue;
+        }
+
+        LabeledFlow flow;
+        FlowQuery& q = flow.query;
+        q.flowId = mlfw::CsvNumber(cells[0]);
+        q.srcAddress = mlfw::CsvAddress(cells[1]);
+        q.dstAddress = mlfw::CsvAddress(cells[2]);
+        q.srcPort = mlfw::CsvNumber(cells[3]);
+        q.dstPort = mlfw::CsvNumber(cells[4]);
+        q.protocol = mlfw::CsvNumber(cells[5]);
+        q.txPackets = mlfw::CsvNumber(cells[6]);
+        q.rxPackets = mlfw::CsvNumber(cells[7]);
+        q.txBytes = mlfw::CsvNumber(cells[8]);
+        q.rxBytes = mlfw::CsvNumber(cells[9]);
+        q.duration = mlfw::CsvNumber(cells[10]);
+        q.throughput = mlfw::CsvNumber(cells[11]);
+        q.packetLoss = mlfw::CsvNumber(cells[12]);
+        q.delay = mlfw::CsvNumber(cells[13]);
+        q.jitter = mlfw::CsvNumber(cells[14]);
+        q.district = mlfw::GetDistrictId(cells[15]);
+        flow.trafficType = cells[16];
+        flow.label = mlfw::CsvNumber(cells[17]) != 0;
+        flows.push_back(flow);
+    }
+    return true;
+}
+
+#endif // ML_FIREWALL_DATASET_H
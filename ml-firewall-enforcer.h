@@ -0,0 +1,145 @@
+#ifndef ML_FIREWALL_ENFORCER_H
+#define ML_FIREWALL_ENFORCER_H
+
+#include "ml-firewall-blocklist.h"
+
+#include "ns3/internet-module.h"
+#include "ns3/network-module.h"
+
+namespace ns3
+{
+
+// Drops forwarded packets of blocklisted flows. Installed in a node's
+// Ipv4ListRouting ahead of its real routing protocol, so it sees every packet
+// the node forwards (locally delivered ones are handled by the list routing
+// before any protocol is asked). A packet of a blocklisted 5-tuple is
+// reported through the error callback, which FlowMonitor counts as a route
+// error drop; anything else is declined and routed normally. It never
+// originates routes.
+class FirewallEnforcer : public Ipv4RoutingProtocol
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::FirewallEnforcer")
+                                .SetParent<Ipv4RoutingProtocol>()
+                                .SetGroupName("Internet")
+                                .AddConstructor<FirewallEnforcer>();
+        return tid;
+    }
+
+    // Adds an enforcer in front of the node's routing protocols
+    static Ptr<FirewallEnforcer> Install(Ptr<Node> node,
+                                         const FlowBlocklist& blocklist,
+                                         int16_t priority = 100)
+    {
+        Ptr<Ipv4ListRouting> list =
+            DynamicCast<Ipv4ListRouting>(node->GetObject<Ipv4>()->GetRoutingProtocol());
+        NS_ABORT_MSG_IF(!list, "FirewallEnforcer needs Ipv4ListRouting on node " << node->GetId());
+
+        Ptr<FirewallEnforcer> enforcer = CreateObject<FirewallEnforcer>();
+        enforcer->m_blocklist = &blocklist;
+        list->AddRoutingProtocol(enforcer, priority);
+        return enforcer;
+    }
+
+    uint64_t GetInspectedPackets() const
+    {
+        return m_inspected;
+    }
+
+    uint64_t GetDroppedPackets() const
+    {
+        return m_dropped;
+    }
+
+    Ptr<Ipv4Route> RouteOutput(Ptr<Packet> /* p */,
+                               const Ipv4Header& /* header */,
+                               Ptr<NetDevice> /* oif */,
+                               Socket::SocketErrno& sockerr) override
+    {
+        sockerr = Socket::ERROR_NOROUTETOHOST;
+        return nullptr;
+    }
+
+    bool RouteInput(Ptr<const Packet> p,
+                    const Ipv4Header& header,
+                    Ptr<const NetDevice> /* idev */,
+                    const UnicastForwardCallback& /* ucb */,
+                    const MulticastForwardCallback& /* mcb */,
+                    const LocalDeliverCallback& /* lcb */,
+                    const ErrorCallback& ecb) override
+    {
+        m_inspected++;
+        if (!m_blocklist || m_blocklist->GetSize() == 0)
+        {
+            return false;
+        }
+
+        FlowKey key;
+        key.srcAddress = header.GetSource().Get();
+        key.dstAddress = header.GetDestination().Get();
+        key.protocol = header.GetProtocol();
+
+        // TCP and UDP both start with the port pair. Later fragments carry no
+        // ports; dropping the first one is enough to lose the datagram.
+        if ((key.protocol == 6 || key.protocol == 17) && header.GetFragmentOffset() == 0)
+        {
+            uint8_t ports[4];
+            if (p->CopyData(ports, sizeof(ports)) == sizeof(ports))
+            {
+                key.srcPort = (ports[0] << 8) | ports[1];
+                key.dstPort = (ports[2] << 8) | ports[3];
+            }
+        }
+
+        if (!m_blocklist->Contains(key))
+        {
+            return false;
+        }
+        m_dropped++;
+        if (!ecb.IsNull())
+        {
+            ecb(p, header, Socket::ERROR_NOROUTETOHOST);
+        }
+        return true;
+    }
+
+    void NotifyInterfaceUp(uint32_t /* interface */) override
+    {
+    }
+
+    void NotifyInterfaceDown(uint32_t /* interface */) override
+    {
+    }
+
+    void NotifyAddAddress(uint32_t /* interface */, Ipv4InterfaceAddress /* address */) override
+    {
+    }
+
+    void NotifyRemoveAddress(uint32_t /* interface */, Ipv4InterfaceAddress /* address */) override
+    {
+    }
+
+    void SetIpv4(Ptr<Ipv4> /* ipv4 */) override
+    {
+    }
+
+    void PrintRoutingTable(Ptr<OutputStreamWrapper> stream,
+                           Time::Unit /* unit */ = Time::S) const override
+    {
+        *stream->GetStream() << "FirewallEnforcer: " << (m_blocklist ? m_blocklist->GetSize() : 0)
+                             << " blocked flows, " << m_dropped << " packets dropped" << std::endl;
+    }
+
+  private:
+    const FlowBlocklist* m_blocklist = nullptr;
+    uint64_t m_inspected = 0;
+    uint64_t m_dropped = 0;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(FirewallEnforcer);
+
+} // namespace ns3
+
+#endif // ML_FIREWALL_ENFORCER_H
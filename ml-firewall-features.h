@@ -0,0 +1,219 @@
+#ifndef ML_FIREWALL_FEATURES_H
+#define ML_FIREWALL_FEATURES_H
+
+#include "ml-firewall-client.h"
+#include "ml-firewall-forest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// FlowMonitor statistics of one flow with its five-tuple, free of ns-3 types.
+// Times are in seconds.
+struct FlowStatsRecord
+{
+    uint32_t flowId = 0;
+    uint32_t srcAddress = 0; // host byte order, as Ipv4Address::Get()
+    uint32_t dstAddress = 0;
+    uint16_t srcPort = 0;
+    uint16_t dstPort = 0;
+    uint8_t protocol = 0;
+    uint8_t district = mlfw::DISTRICT_CORE;
+    uint32_t txPackets = 0;
+    uint32_t rxPackets = 0;
+    uint64_t txBytes = 0;
+    uint64_t rxBytes = 0;
+    double duration = 0.0; // last received minus first sent packet
+    double delaySum = 0.0;
+    double jitterSum = 0.0;
+};
+
+// Firewall query of a flow: throughput, loss, mean delay and mean jitter
+// derived from its statistics as the training flows were
+inline FlowQuery
+MakeFlowQuery(const FlowStatsRecord& r)
+{
+    FlowQuery query;
+    query.flowId = r.flowId;
+    query.srcAddress = r.srcAddress;
+    query.dstAddress = r.dstAddress;
+    query.srcPort = r.srcPort;
+    query.dstPort = r.dstPort;
+    query.protocol = r.protocol;
+    query.txPackets = r.txPackets;
+    query.rxPackets = r.rxPackets;
+    query.txBytes = r.txBytes;
+    query.rxBytes = r.rxBytes;
+    query.duration = r.duration;
+    query.throughput = r.duration > 0 ? (r.rxBytes * 8.0) / r.duration : 0.0;
+    query.packetLoss =
+        r.txPackets > 0 ? (double)(r.txPackets - r.rxPackets) / r.txPackets : 0.0;
+    query.delay = r.rxPackets > 0 ? (r.delaySum / r.rxPackets) : 0.0;
+    query.jitter = r.rxPackets > 1 ? (r.jitterSum / (r.rxPackets - 1)) : 0.0;
+    query.district = r.district;
+    return query;
+}
+
+// Flow queries stored one array per field, the input of ExtractFeatures()
+struct FlowBatch
+{
+    std::vector<uint32_t> flowId;
+    std::vector<uint32_t> srcAddress;
+    std::vector<uint32_t> dstAddress;
+    std::vector<uint16_t> srcPort;
+    std::vector<uint16_t> dstPort;
+    std::vector<uint8_t> protocol;
+    std::vector<uint8_t> district;
+    std::vector<uint32_t> txPackets;
+    std::vector<uint32_t> rxPackets;
+    std::vector<uint64_t> txBytes;
+    std::vector<uint64_t> rxBytes;
+    std::vector<double> duration;
+    std::vector<double> throughput;
+    std::vector<double> packetLoss;
+    std::vector<double> delay;
+    std::vector<double> jitter;
+
+    size_t GetSize() const
+    {
+        return flowId.size();
+    }
+
+    // Empties the batch, keeping its capacity for the next one
+    void Clear()
+    {
+        flowId.clear();
+        srcAddress.clear();
+        dstAddress.clear();
+        srcPort.clear();
+        dstPort.clear();
+        protocol.clear();
+        district.clear();
+        txPackets.clear();
+        rxPackets.clear();
+        txBytes.clear();
+        rxBytes.clear();
+        duration.clear();
+        throughput.clear();
+        packetLoss.clear();
+        delay.clear();
+        jitter.clear();
+    }
+
+    void Append(const FlowStatsRecord& record)
+    {
+        Append(MakeFlowQuery(record));
+    }
+
+    void Append(const FlowQuery& q)
+    {
+        flowId.push_back(q.flowId);
+        srcAddress.push_back(q.srcAddress);
+        dstAddress.push_back(q.dstAddress);
+        srcPort.push_back(q.srcPort);
+        dstPort.push_back(q.dstPort);
+        protocol.push_back(q.protocol);
+        district.push_back(q.district);
+        txPackets.push_back(q.txPackets);
+        rxPackets.push_back(q.rxPackets);
+        txBytes.push_back(q.txBytes);
+        rxBytes.push_back(q.rxBytes);
+        duration.push_back(q.duration);
+        throughput.push_back(q.throughput);
+        packetLoss.push_back(q.packetLoss);
+        delay.push_back(q.delay);
+        jitter.push_back(q.jitter);
+    }
+
+    FlowQuery GetQuery(size_t i) const
+    {
+        FlowQuery q;
+        q.flowId = flowId[i];
+        q.srcAddress = srcAddress[i];
+        q.dstAddress = dstAddress[i];
+        q.srcPort = srcPort[i];
+        q.dstPort = dstPort[i];
+        q.protocol = protocol[i];
+        q.district = district[i];
+        q.txPackets = txPackets[i];
+        q.rxPackets = rxPackets[i];
+        q.txBytes = txBytes[i];
+        q.rxBytes = rxBytes[i];
+        q.duration = duration[i];
+        q.throughput = throughput[i];
+        q.packetLoss = packetLoss[i];
+        q.delay = delay[i];
+        q.jitter = jitter[i];
+        return q;
+    }
+};
+
+// Writes the model features of flows [begin, begin + count) of batch to out,
+// one row of N_FEATURES per flow in the column order of model_metadata.json.
+// With a scaler the StandardScaler is applied in the same pass, so the rows
+// can go straight to a native scorer; without, they are what the binary
+// protocol sends. Values are derived and scaled in double, then rounded to T,
+// exactly as ComputeModelFeatures() and FeatureScaler::Transform() do.
+//
+// The pass is bound by its divisions. The three port flags are 0 or 1, so
+// their two scaled values are computed once per call instead of per flow.
+template <typename T>
+inline void
+ExtractFeatures(const FlowBatch& batch,
+                size_t begin,
+                size_t count,
+                const FeatureScaler* scaler,
+                T* out)
+{
+    const size_t FLAGS = mlfw::IS_WELL_KNOWN_PORT;
+    double mean[mlfw::N_FEATURES];
+    double scale[mlfw::N_FEATURES];
+    T flag[mlfw::N_FEATURES][2];
+    for (size_t f = 0; f < mlfw::N_FEATURES; f++)
+    {
+        mean[f] = scaler ? scaler->mean[f] : 0.0;
+        scale[f] = scaler ? scaler->scale[f] : 1.0;
+        flag[f][0] = static_cast<T>((0 - mean[f]) / scale[f]);
+        flag[f][1] = static_cast<T>((1 - mean[f]) / scale[f]);
+    }
+
+    double raw[FLAGS];
+    for (size_t k = 0; k < count; k++)
+    {
+        size_t i = begin + k;
+        double txPackets = batch.txPackets[i];
+        double rxPackets = batch.rxPackets[i];
+        double txBytes = batch.txBytes[i];
+        double rxBytes = batch.rxBytes[i];
+        double duration = batch.duration[i];
+        double throughput = batch.throughput[i];
+        raw[mlfw::TX_PACKETS] = txPackets;
+        raw[mlfw::RX_PACKETS] = rxPackets;
+        raw[mlfw::TX_BYTES] = txBytes;
+        raw[mlfw::RX_BYTES] = rxBytes;
+        raw[mlfw::DURATION] = duration;
+        raw[mlfw::THROUGHPUT] = throughput;
+        raw[mlfw::PACKET_LOSS] = batch.packetLoss[i];
+        raw[mlfw::DELAY] = batch.delay[i];
+        raw[mlfw::JITTER] = batch.jitter[i];
+        raw[mlfw::PACKET_DELIVERY_RATIO] = rxPackets / (txPackets + 1e-6);
+        raw[mlfw::BYTE_DELIVERY_RATIO] = rxBytes / (txBytes + 1e-6);
+        raw[mlfw::AVG_PACKET_SIZE] = txBytes / (txPackets + 1e-6);
+        raw[mlfw::THROUGHPUT_EFFICIENCY] = throughput / (duration + 1e-6);
+
+        T* row = out + k * mlfw::N_FEATURES;
+        for (size_t f = 0; f < FLAGS; f++)
+        {
+            row[f] = static_cast<T>(scaler ? (raw[f] - mean[f]) / scale[f] : raw[f]);
+        }
+        uint16_t port = batch.dstPort[i];
+        bool wellKnown = port <= 1023;
+        bool web = port == 80 || port == 443 || port == 8080;
+        bool suspicious = port == 31337 || port == 12345;
+        row[mlfw::IS_WELL_KNOWN_PORT] = flag[mlfw::IS_WELL_KNOWN_PORT][wellKnown];
+        row[mlfw::IS_WEB_PORT] = flag[mlfw::IS_WEB_PORT][web];
+        row[mlfw::IS_SUSPICIOUS_PORT] = flag[mlfw::IS_SUSPICIOUS_PORT][suspicious];
+    }
+}
+
+#endif // ML_FIREWALL_FEATURES_H
@@ -0,0 +1,789 @@
+#ifndef ML_FIREWALL_FOREST_H
+#define ML_FIREWALL_FOREST_H
+
+#include "ml-firewall-bundle.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ML_FIREWALL_FOREST_X86 1
+#include <immintrin.h>
+#endif
+
+namespace mlfw
+{
+
+// Reads the next word of a model dump and checks that it is key
+inline bool
+Expect(std::istream& in, const char* key)
+{
+    std::string word;
+    return (in >> word) && word == key;
+}
+
+inline bool
+ReadValues(std::istream& in, std::vector<double>& values)
+{
+    for (double& v : values)
+    {
+        if (!(in >> v))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace mlfw
+
+// StandardScaler applied to the model features before scoring
+struct FeatureScaler
+{
+    mlfw::ModelArray<double> mean;
+    mlfw::ModelArray<double> scale;
+
+    // Reads the scaler_mean and scaler_scale lines of a model dump
+    bool Load(std::istream& in, uint32_t features)
+    {
+        mean.resize(features);
+        scale.resize(features);
+        return mlfw::Expect(in, "scaler_mean") && mlfw::ReadValues(in, mean.Own()) &&
+               mlfw::Expect(in, "scaler_scale") && mlfw::ReadValues(in, scale.Own());
+    }
+
+    // Maps the prefix.mean and prefix.scale sections of a bundle
+    bool Load(const mlfw::ModelBundle& bundle, const std::string& prefix, uint32_t features)
+    {
+        return bundle.Get(prefix + ".mean", mean) && bundle.Get(prefix + ".scale", scale) &&
+               mean.size() == features && scale.size() == features;
+    }
+
+    void Save(mlfw::BundleWriter& bundle, const std::string& prefix) const
+    {
+        bundle.Add(prefix + ".mean", mean);
+        bundle.Add(prefix + ".scale", scale);
+    }
+
+    // Scales in double like sklearn, then rounds to the type of scaled: the
+    // float32 the trees compare against, or double for LOF distances
+    template <typename T, typename S>
+    void Transform(const T* raw, S* scaled) const
+    {
+        for (size_t i = 0; i < mean.size(); i++)
+        {
+            scaled[i] = static_cast<S>((raw[i] - mean[i]) / scale[i]);
+        }
+    }
+};
+
+// sklearn IsolationForest evaluated in-process from the tree dump written by
+// export_models.py. All trees share flat structure-of-arrays storage: node n
+// splits on m_feature[n] at m_threshold[n], and its children are m_left[n]
+// and m_left[n] + 1. Each tree is stored breadth-first, so the top levels
+// that every sample visits sit together at the front of the tree and a child
+// is picked without a branch. A leaf is its own left child with an infinite
+// threshold, so walking a tree is exactly m_treeDepth steps with no exit
+// test; m_pathLength holds what the leaf adds to the sample's depth.
+//
+// sklearn compares the float32 feature with a float64 threshold. Thresholds
+// are rounded down to float32 on load, which gives the same comparison result
+// for every float32 input. Path lengths are summed in double in tree order as
+// sklearn does, so DecisionFunction() matches decision_function() to the last
+// bit or so.
+//
+// DecisionFunctionBatch() walks the trees for a block of 8 (AVX2) or 16
+// (AVX-512) flows at once: node indices live in one vector per tree, and
+// every level gathers the split feature, threshold, feature value and child
+// of all lanes. TREE_GROUP trees are walked side by side so their gathers
+// overlap. Path lengths are accumulated per lane in double vectors in tree
+// order, so the batched scores are bit-identical to the scalar ones. The
+// widest kernel the CPU supports is picked at run time.
+//
+// The arrays are the ones Save() writes to a model bundle, so a forest loaded
+// from a bundle scores straight from the mapped file.
+class IsolationForest
+{
+  public:
+    enum Kernel
+    {
+        KERNEL_SCALAR,
+        KERNEL_AVX2,
+        KERNEL_AVX512
+    };
+
+    // Trees the batched kernels walk side by side
+    static const uint32_t TREE_GROUP = 4;
+
+    // One node of the flat storage. A leaf is its own left child.
+    struct Node
+    {
+        int32_t feature;
+        float threshold;
+        uint32_t left;
+        double pathLength;
+    };
+
+    // Returns false if the file is missing or malformed
+    bool Load(const std::string& path)
+    {
+        *this = IsolationForest();
+
+        std::ifstream in(path);
+        std::string tag;
+        uint32_t version = 0;
+        uint32_t features = 0;
+        uint32_t estimators = 0;
+        double averagePathLength = 0.0;
+        if (!(in >> tag >> version) || tag != "mlfw-forest" || version != 1 ||
+            !mlfw::Expect(in, "features") || !(in >> features) || features == 0)
+        {
+            return false;
+        }
+        if (!m_scaler.Load(in, features) || !mlfw::Expect(in, "estimators") ||
+            !(in >> estimators) || estimators == 0 ||
+            !mlfw::Expect(in, "average_path_length") || !(in >> averagePathLength) ||
+            !mlfw::Expect(in, "offset") || !(in >> m_offset))
+        {
+            return false;
+        }
+
+        for (uint32_t t = 0; t < estimators; t++)
+        {
+            if (!LoadTree(in, features))
+            {
+                *this = IsolationForest();
+                return false;
+            }
+        }
+        AppendPadding();
+        m_features = features;
+        m_denominator = estimators * averagePathLength;
+        return true;
+    }
+
+    // Maps the forest.* sections of a bundle written by Save(). The arrays are
+    // used in place; only their sizes and node indices are checked.
+    bool Load(const mlfw::ModelBundle& bundle)
+    {
+        *this = IsolationForest();
+
+        uint32_t features = 0;
+        if (!bundle.GetValue("forest.features", features) || features == 0 ||
+            !m_scaler.Load(bundle, "forest.scaler", features) ||
+            !bundle.GetValue("forest.offset", m_offset) ||
+            !bundle.GetValue("forest.denominator", m_denominator) ||
+            !bundle.GetValue("forest.padding", m_padding) ||
+            !bundle.Get("forest.tree_root", m_treeRoot) ||
+            !bundle.Get("forest.tree_depth", m_treeDepth) ||
+            !bundle.Get("forest.feature", m_feature) ||
+            !bundle.Get("forest.threshold", m_threshold) ||
+            !bundle.Get("forest.left", m_left) ||
+            !bundle.Get("forest.path_length", m_pathLength) || !CheckNodes(features))
+        {
+            *this = IsolationForest();
+            return false;
+        }
+        m_features = features;
+        return true;
+    }
+
+    // Adds the forest to bundle as forest.* sections
+    void Save(mlfw::BundleWriter& bundle) const
+    {
+        bundle.AddValue("forest.features", m_features);
+        m_scaler.Save(bundle, "forest.scaler");
+        bundle.AddValue("forest.offset", m_offset);
+        bundle.AddValue("forest.denominator", m_denominator);
+        bundle.AddValue("forest.padding", m_padding);
+        bundle.Add("forest.tree_root", m_treeRoot);
+        bundle.Add("forest.tree_depth", m_treeDepth);
+        bundle.Add("forest.feature", m_feature);
+        bundle.Add("forest.threshold", m_threshold);
+        bundle.Add("forest.left", m_left);
+        bundle.Add("forest.path_length", m_pathLength);
+    }
+
+    bool IsLoaded() const
+    {
+        return !m_treeRoot.empty();
+    }
+
+    // sklearn's decision_function of one flow's scaled features: negative
+    // for outliers, lower is more anomalous
+    double DecisionFunction(const float* x) const
+    {
+        const int32_t* feature = m_feature.data();
+        const float* threshold = m_threshold.data();
+        const uint32_t* left = m_left.data();
+        double depth = 0.0;
+        for (size_t t = 0; t < m_treeRoot.size(); t++)
+        {
+            uint32_t node = m_treeRoot[t];
+            for (uint32_t level = 0; level < m_treeDepth[t]; level++)
+            {
+                node = left[node] + (x[feature[node]] > threshold[node]);
+            }
+            depth += m_pathLength[node];
+        }
+        return Normalize(depth);
+    }
+
+    // Scores count flows whose scaled features are stored row after row in x
+    void DecisionFunctionBatch(const float* x, size_t count, double* scores) const
+    {
+        std::fill(scores, scores + count, 0.0);
+        AddPathLengths(x, count, 0, GetTrees(), scores);
+        for (size_t i = 0; i < count; i++)
+        {
+            scores[i] = Normalize(scores[i]);
+        }
+    }
+
+    // Adds the path lengths of trees [first, last) to depths, one per flow of
+    // x. The batched kernels start at group boundaries, so first should be a
+    // multiple of TREE_GROUP; otherwise flows are walked one at a time.
+    // Walking the trees chunk by chunk into the same depths gives the sums
+    // DecisionFunctionBatch() normalizes, bit for bit.
+    void AddPathLengths(const float* x,
+                        size_t count,
+                        uint32_t first,
+                        uint32_t last,
+                        double* depths) const
+    {
+        size_t done = 0;
+#ifdef ML_FIREWALL_FOREST_X86
+        Kernel kernel = first % TREE_GROUP == 0 ? m_kernel : KERNEL_SCALAR;
+        if (kernel == KERNEL_AVX512)
+        {
+            done = DepthsAvx512(x, count, first, last, depths);
+        }
+        else if (kernel == KERNEL_AVX2)
+        {
+            done = DepthsAvx2(x, count, first, last, depths);
+        }
+#endif
+        for (size_t i = done; i < count; i++)
+        {
+            for (uint32_t t = first; t < last; t++)
+            {
+                depths[i] += PathLength(t, x + i * m_features);
+            }
+        }
+    }
+
+    // What tree t adds to the depth of one flow's scaled features
+    double PathLength(uint32_t t, const float* x) const
+    {
+        const int32_t* feature = m_feature.data();
+        const float* threshold = m_threshold.data();
+        const uint32_t* left = m_left.data();
+        uint32_t node = m_treeRoot[t];
+        for (uint32_t level = 0; level < m_treeDepth[t]; level++)
+        {
+            node = left[node] + (x[feature[node]] > threshold[node]);
+        }
+        return m_pathLength[node];
+    }
+
+    // Widest kernel this CPU supports
+    static Kernel DetectKernel()
+    {
+#ifdef ML_FIREWALL_FOREST_X86
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            return KERNEL_AVX512;
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return KERNEL_AVX2;
+        }
+#endif
+        return KERNEL_SCALAR;
+    }
+
+    // Keeps the first trees (all of them if 0) and cuts every tree maxDepth
+    // levels below its root (no cut if 0). A node cut into a leaf gets the
+    // path length sklearn would give a leaf holding its training samples,
+    // depth + c(samples), where the samples are counted from the leaves below
+    // it. decision_function stays normalized by the number of trees kept.
+    // Returns false if no forest is loaded.
+    bool Prune(uint32_t trees, uint32_t maxDepth)
+    {
+        if (!IsLoaded())
+        {
+            return false;
+        }
+        uint32_t kept = trees == 0 ? GetTrees() : std::min(trees, GetTrees());
+        IsolationForest pruned;
+        pruned.m_scaler = m_scaler;
+        pruned.m_kernel = m_kernel;
+        pruned.m_features = m_features;
+        pruned.m_offset = m_offset;
+        pruned.m_denominator = m_denominator / GetTrees() * kept;
+        for (uint32_t t = 0; t < kept; t++)
+        {
+            uint32_t depth = maxDepth == 0 ? m_treeDepth[t] : std::min(maxDepth, m_treeDepth[t]);
+            pruned.AppendTree(*this, m_treeRoot[t], depth);
+        }
+        pruned.AppendPadding();
+        *this = pruned;
+        return true;
+    }
+
+    // Returns false, keeping the current kernel, if the CPU lacks it
+    bool SetKernel(Kernel kernel)
+    {
+        if (kernel > DetectKernel())
+        {
+            return false;
+        }
+        m_kernel = kernel;
+        return true;
+    }
+
+    Kernel GetKernel() const
+    {
+        return m_kernel;
+    }
+
+    static const char* GetKernelName(Kernel kernel)
+    {
+        static const char* const names[] = {"scalar", "avx2", "avx512"};
+        return names[kernel];
+    }
+
+    const FeatureScaler& GetScaler() const
+    {
+        return m_scaler;
+    }
+
+    uint32_t GetFeatures() const
+    {
+        return m_features;
+    }
+
+    uint32_t GetTrees() const
+    {
+        return m_treeRoot.size();
+    }
+
+    uint32_t GetNodes() const
+    {
+        return m_feature.empty() ? 0 : m_feature.size() - 1;
+    }
+
+    uint32_t GetTreeRoot(uint32_t t) const
+    {
+        return m_treeRoot[t];
+    }
+
+    // Levels below the root of tree t; every walk takes exactly this many steps
+    uint32_t GetTreeDepth(uint32_t t) const
+    {
+        return m_treeDepth[t];
+    }
+
+    // offset_ of the sklearn model
+    double GetOffset() const
+    {
+        return m_offset;
+    }
+
+    // Trees times c(max_samples): summed path lengths are divided by it
+    double GetDenominator() const
+    {
+        return m_denominator;
+    }
+
+    Node GetNode(uint32_t n) const
+    {
+        return {m_feature[n], m_threshold[n], m_left[n], m_pathLength[n]};
+    }
+
+    // Bytes of node storage a walk reads from
+    size_t GetModelBytes() const
+    {
+        size_t node = sizeof(int32_t) + sizeof(float) + sizeof(uint32_t) + sizeof(double);
+        return m_feature.size() * node;
+    }
+
+    // Normalized average path length to decision_function
+    double Normalize(double depth) const
+    {
+        return -std::pow(2.0, -(depth / m_denominator)) - m_offset;
+    }
+
+    // sklearn's _average_path_length: c(n), the mean depth of an unsuccessful
+    // search in a binary tree built on n samples
+    static double AveragePathLength(double n)
+    {
+        if (n <= 1.0)
+        {
+            return 0.0;
+        }
+        if (n <= 2.0)
+        {
+            return 1.0;
+        }
+        return 2.0 * (std::log(n - 1.0) + 0.5772156649015329) - 2.0 * (n - 1.0) / n;
+    }
+
+  private:
+
+    // Roots and common depth of the trees of group g, padded past last
+    uint32_t GroupRoots(size_t g, uint32_t last, uint32_t* roots) const
+    {
+        uint32_t depth = 0;
+        for (size_t k = 0; k < TREE_GROUP; k++)
+        {
+            size_t t = g * TREE_GROUP + k;
+            roots[k] = t < last ? m_treeRoot[t] : m_padding;
+            depth = std::max(depth, t < last ? m_treeDepth[t] : 0);
+        }
+        return depth;
+    }
+
+#ifdef ML_FIREWALL_FOREST_X86
+    // One level down for 8 flows of block whose nodes are node
+    __attribute__((target("avx2"))) __m256i StepAvx2(__m256i node,
+                                                     const float* block,
+                                                     __m256i rows) const
+    {
+        const int* left = reinterpret_cast<const int*>(m_left.data());
+        __m256i split = _mm256_i32gather_epi32(m_feature.data(), node, 4);
+        __m256 t = _mm256_i32gather_ps(m_threshold.data(), node, 4);
+        __m256 v = _mm256_i32gather_ps(block, _mm256_add_epi32(rows, split), 4);
+        __m256i child = _mm256_i32gather_epi32(left, node, 4);
+        // all-ones (-1) in lanes that go right
+        return _mm256_sub_epi32(child, _mm256_castps_si256(_mm256_cmp_ps(v, t, _CMP_GT_OQ)));
+    }
+
+    // Adds the path lengths of trees [first, last) to the depths of the
+    // flows in whole blocks of 8; returns how many flows were done
+    __attribute__((target("avx2"))) size_t DepthsAvx2(const float* x,
+                                                      size_t count,
+                                                      uint32_t first,
+                                                      uint32_t last,
+                                                      double* depths) const
+    {
+        const double* pathLength = m_pathLength.data();
+        const __m256i rows =
+            _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(m_features));
+        size_t groups = (last + TREE_GROUP - 1) / TREE_GROUP;
+
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            const float* block = x + i * m_features;
+            __m256d low = _mm256_loadu_pd(depths + i);
+            __m256d high = _mm256_loadu_pd(depths + i + 4);
+            for (size_t g = first / TREE_GROUP; g < groups; g++)
+            {
+                uint32_t roots[TREE_GROUP];
+                uint32_t depth = GroupRoots(g, last, roots);
+                __m256i node[TREE_GROUP];
+                for (uint32_t k = 0; k < TREE_GROUP; k++)
+                {
+                    node[k] = _mm256_set1_epi32(roots[k]);
+                }
+                for (uint32_t level = 0; level < depth; level++)
+                {
+                    for (uint32_t k = 0; k < TREE_GROUP; k++)
+                    {
+                        node[k] = StepAvx2(node[k], block, rows);
+                    }
+                }
+                for (uint32_t k = 0; k < TREE_GROUP; k++)
+                {
+                    low = _mm256_add_pd(
+                        low, _mm256_i32gather_pd(pathLength, _mm256_castsi256_si128(node[k]), 8));
+                    high = _mm256_add_pd(
+                        high, _mm256_i32gather_pd(pathLength, _mm256_extracti128_si256(node[k], 1), 8));
+                }
+            }
+            _mm256_storeu_pd(depths + i, low);
+            _mm256_storeu_pd(depths + i + 4, high);
+        }
+        return i;
+    }
+
+    __attribute__((target("avx512f"))) __m512i StepAvx512(__m512i node,
+                                                          const float* block,
+                                                          __m512i rows) const
+    {
+        const int* left = reinterpret_cast<const int*>(m_left.data());
+        __m512i split = _mm512_i32gather_epi32(node, m_feature.data(), 4);
+        __m512 t = _mm512_i32gather_ps(node, m_threshold.data(), 4);
+        __m512 v = _mm512_i32gather_ps(_mm512_add_epi32(rows, split), block, 4);
+        __m512i child = _mm512_i32gather_epi32(node, left, 4);
+        __mmask16 right = _mm512_cmp_ps_mask(v, t, _CMP_GT_OQ);
+        return _mm512_mask_add_epi32(child, right, child, _mm512_set1_epi32(1));
+    }
+
+    // As DepthsAvx2, in blocks of 16
+    __attribute__((target("avx512f"))) size_t DepthsAvx512(const float* x,
+                                                           size_t count,
+                                                           uint32_t first,
+                                                           uint32_t last,
+                                                           double* depths) const
+    {
+        const double* pathLength = m_pathLength.data();
+        const __m512i rows = _mm512_mullo_epi32(
+            _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+            _mm512_set1_epi32(m_features));
+        size_t groups = (last + TREE_GROUP - 1) / TREE_GROUP;
+
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            const float* block = x + i * m_features;
+            __m512d low = _mm512_loadu_pd(depths + i);
+            __m512d high = _mm512_loadu_pd(depths + i + 8);
+            for (size_t g = first / TREE_GROUP; g < groups; g++)
+            {
+                uint32_t roots[TREE_GROUP];
+                uint32_t depth = GroupRoots(g, last, roots);
+                __m512i node[TREE_GROUP];
+                for (uint32_t k = 0; k < TREE_GROUP; k++)
+                {
+                    node[k] = _mm512_set1_epi32(roots[k]);
+                }
+                for (uint32_t level = 0; level < depth; level++)
+                {
+                    for (uint32_t k = 0; k < TREE_GROUP; k++)
+                    {
+                        node[k] = StepAvx512(node[k], block, rows);
+                    }
+                }
+                for (uint32_t k = 0; k < TREE_GROUP; k++)
+                {
+                    low = _mm512_add_pd(
+                        low, _mm512_i32gather_pd(_mm512_castsi512_si256(node[k]), pathLength, 8));
+                    high = _mm512_add_pd(
+                        high, _mm512_i32gather_pd(_mm512_extracti64x4_epi64(node[k], 1), pathLength, 8));
+                }
+            }
+            _mm512_storeu_pd(depths + i, low);
+            _mm512_storeu_pd(depths + i + 8, high);
+        }
+        return i;
+    }
+#endif
+
+    // True if every tree walk stays inside the node arrays: roots, children
+    // and split features are in range and the padding node is a leaf
+    bool CheckNodes(uint32_t features) const
+    {
+        size_t nodes = m_feature.size();
+        if (m_treeRoot.empty() || m_treeDepth.size() != m_treeRoot.size() || nodes == 0 ||
+            m_threshold.size() != nodes || m_left.size() != nodes || m_pathLength.size() != nodes ||
+            m_padding >= nodes || m_left[m_padding] != m_padding)
+        {
+            return false;
+        }
+        for (uint32_t root : m_treeRoot)
+        {
+            if (root >= nodes)
+            {
+                return false;
+            }
+        }
+        for (size_t n = 0; n < nodes; n++)
+        {
+            if (m_feature[n] < 0 || uint32_t(m_feature[n]) >= features || m_left[n] >= nodes ||
+                (m_left[n] + 1 >= nodes && m_left[n] != n))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Leaf that pads the last group of trees in the batched kernels
+    void AppendPadding()
+    {
+        m_padding = m_feature.size();
+        m_feature.push_back(0);
+        m_threshold.push_back(std::numeric_limits<float>::infinity());
+        m_left.push_back(m_padding);
+        m_pathLength.push_back(0.0);
+    }
+
+    // Training samples that reached node at the given level, from the path
+    // lengths of the leaves below it: a leaf holds the n with
+    // level + c(n) equal to its path length
+    double Samples(uint32_t node, uint32_t level) const
+    {
+        if (m_left[node] != node)
+        {
+            return Samples(m_left[node], level + 1) + Samples(m_left[node] + 1, level + 1);
+        }
+        double target = m_pathLength[node] - level;
+        double lo = 1.0, hi = 1 << 24; // c() is increasing: smallest n reaching target
+        while (lo < hi)
+        {
+            double mid = std::floor((lo + hi) / 2);
+            if (AveragePathLength(mid) + 1e-9 < target)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // Appends the tree of source rooted at root, breadth-first, with the
+    // nodes maxDepth levels down turned into leaves
+    void AppendTree(const IsolationForest& source, uint32_t root, uint32_t maxDepth)
+    {
+        uint32_t base = m_feature.size();
+        std::vector<std::pair<uint32_t, uint32_t>> order(1, {root, 0}); // node, level
+        uint32_t depth = 0;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            uint32_t n = order[i].first;
+            uint32_t level = order[i].second;
+            depth = std::max(depth, level);
+            if (source.m_left[n] == n)
+            {
+                m_feature.push_back(0);
+                m_threshold.push_back(std::numeric_limits<float>::infinity());
+                m_left.push_back(base + i);
+                m_pathLength.push_back(source.m_pathLength[n]);
+            }
+            else if (level == maxDepth)
+            {
+                m_feature.push_back(0);
+                m_threshold.push_back(std::numeric_limits<float>::infinity());
+                m_left.push_back(base + i);
+                m_pathLength.push_back(level + AveragePathLength(source.Samples(n, level)));
+            }
+            else
+            {
+                m_feature.push_back(source.m_feature[n]);
+                m_threshold.push_back(source.m_threshold[n]);
+                m_left.push_back(base + order.size());
+                m_pathLength.push_back(0.0);
+                order.push_back({source.m_left[n], level + 1});
+                order.push_back({source.m_left[n] + 1, level + 1});
+            }
+        }
+        m_treeRoot.push_back(base);
+        m_treeDepth.push_back(depth);
+    }
+
+    // Largest float not above t, so that x <= result iff x <= t for float x
+    static float RoundDown(double t)
+    {
+        float f = static_cast<float>(t);
+        if (static_cast<double>(f) > t)
+        {
+            f = std::nextafter(f, -std::numeric_limits<float>::infinity());
+        }
+        return f;
+    }
+
+    // Reads one tree in sklearn's node order and appends it breadth-first
+    bool LoadTree(std::istream& in, uint32_t features)
+    {
+        uint32_t count = 0;
+        if (!mlfw::Expect(in, "tree") || !(in >> count) || count == 0)
+        {
+            return false;
+        }
+
+        std::vector<int32_t> feature(count), left(count), right(count);
+        std::vector<double> threshold(count), pathLength(count);
+        for (uint32_t n = 0; n < count; n++)
+        {
+            if (!(in >> feature[n] >> threshold[n] >> left[n] >> right[n] >> pathLength[n]))
+            {
+                return false;
+            }
+            bool leaf = feature[n] < 0;
+            if (leaf ? (left[n] != -1 || right[n] != -1)
+                     : (feature[n] >= int32_t(features) || left[n] <= 0 || right[n] <= 0 ||
+                        left[n] >= int32_t(count) || right[n] >= int32_t(count)))
+            {
+                return false;
+            }
+        }
+
+        // Position of each node in breadth-first order; children get
+        // adjacent positions as they are queued
+        uint32_t base = m_feature.size();
+        std::vector<uint32_t> order(1, 0);
+        std::vector<int32_t> position(count, -1);
+        std::vector<uint32_t> level(count, 0);
+        position[0] = 0;
+        uint32_t depth = 0;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            uint32_t n = order[i];
+            depth = std::max(depth, level[n]);
+            if (feature[n] < 0)
+            {
+                continue;
+            }
+            for (int32_t child : {left[n], right[n]})
+            {
+                if (position[child] >= 0)
+                {
+                    return false; // not a tree
+                }
+                position[child] = order.size();
+                level[child] = level[n] + 1;
+                order.push_back(child);
+            }
+        }
+        if (order.size() != count)
+        {
+            return false;
+        }
+
+        m_treeRoot.push_back(base);
+        m_treeDepth.push_back(depth);
+        for (uint32_t n : order)
+        {
+            if (feature[n] < 0)
+            {
+                m_feature.push_back(0);
+                m_threshold.push_back(std::numeric_limits<float>::infinity());
+                m_left.push_back(base + position[n]);
+                m_pathLength.push_back(pathLength[n]);
+            }
+            else
+            {
+                m_feature.push_back(feature[n]);
+                m_threshold.push_back(RoundDown(threshold[n]));
+                m_left.push_back(base + position[left[n]]);
+                m_pathLength.push_back(0.0);
+            }
+        }
+        return true;
+    }
+
+    FeatureScaler m_scaler;
+    Kernel m_kernel = DetectKernel();
+    uint32_t m_features = 0;
+    double m_offset = 0.0;
+    double m_denominator = 1.0; // trees * c(max_samples)
+    mlfw::ModelArray<uint32_t> m_treeRoot;
+    mlfw::ModelArray<uint32_t> m_treeDepth; // levels below the root
+    uint32_t m_padding = 0;
+    mlfw::ModelArray<int32_t> m_feature;
+    mlfw::ModelArray<float> m_threshold;
+    mlfw::ModelArray<uint32_t> m_left;
+    mlfw::ModelArray<double> m_pathLength; // leaves: depth + c(leaf samples) - 1; 0 otherwise
+};
+
+#endif // ML_FIREWALL_FOREST_H
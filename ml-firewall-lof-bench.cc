@@ -0,0 +1,191 @@
+// Exact and approximate neighbor search of the native LOF.
+//
+//   g++ -O2 -std=c++17 -o ml-firewall-lof-bench ml-firewall-lof-bench.cc
+//   ./ml-firewall-lof-bench [-n TRAINING_ROWS] [-q QUERIES] Dataset/*.csv
+//
+// Fits the LOF on a synthetic training set (200k rows by default) made by
+// perturbing the flows of the CSVs, then scores fresh synthetic flows with a
+// brute-force scan, the KD-tree and the HNSW graph at several beam widths.
+// The saved model is searched the same way. Recall is the share of the
+// neighbors found that are no farther than the true k-th neighbor, so ties
+// among duplicate samples do not count as misses. Exits with status 1 if the
+// KD-tree's neighbors are not exactly the scan's.
+
+#include "ml-firewall-dataset.h"
+#include "ml-firewall-native.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+
+typedef LocalOutlierFactor::Neighbor Neighbor;
+
+// k nearest samples by scanning them all, closest first
+void
+Scan(const LocalOutlierFactor& lof, const double* x, uint32_t k, std::vector<Neighbor>& found)
+{
+    found.clear();
+    for (uint32_t s = 0; s < lof.GetSamples(); s++)
+    {
+        found.push_back({lof.Distance(x, s), s});
+    }
+    std::partial_sort(found.begin(), found.begin() + k, found.end());
+    found.resize(k);
+}
+
+// Times one search mode over the queries and compares it with the scan
+bool
+Measure(const char* name,
+        const LocalOutlierFactor& lof,
+        const std::vector<double>& queries,
+        const std::vector<std::vector<Neighbor>>& exact,
+        const std::vector<double>& exactFactors,
+        double lofThreshold)
+{
+    uint32_t k = lof.GetNeighbors();
+    size_t count = exact.size();
+    std::vector<std::vector<Neighbor>> found(count);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        lof.Neighbors(&queries[i * lof.GetFeatures()], k, found[i]);
+    }
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t hits = 0, differences = 0, flips = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < found[i].size(); j++)
+        {
+            hits += found[i][j].distance <= exact[i].back().distance;
+            differences += j >= exact[i].size() || found[i][j].distance != exact[i][j].distance;
+        }
+        differences += k - found[i].size();
+        double factor = lof.Factor(&queries[i * lof.GetFeatures()]);
+        flips += (factor >= lofThreshold) != (exactFactors[i] >= lofThreshold);
+    }
+    std::cout << "  " << name << ": " << elapsed.count() / count << " ns/query, recall "
+              << double(hits) / (double(count) * k) << ", " << flips
+              << " outlier decisions differ" << std::endl;
+    return differences == 0;
+}
+
+// Reports every search mode of lof on the queries; true if the KD-tree is
+// exact
+bool
+Report(const char* name,
+       LocalOutlierFactor& lof,
+       const std::vector<double>& queries,
+       double lofThreshold)
+{
+    uint32_t k = lof.GetNeighbors();
+    size_t count = queries.size() / lof.GetFeatures();
+    std::cout << name << ": " << lof.GetSamples() << " samples, " << k << " neighbors, " << count
+              << " queries" << std::endl;
+
+    std::vector<std::vector<Neighbor>> exact(count);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        Scan(lof, &queries[i * lof.GetFeatures()], k, exact[i]);
+    }
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "  scan: " << elapsed.count() / count << " ns/query" << std::endl;
+
+    lof.SetSearch(LocalOutlierFactor::SEARCH_EXACT);
+    std::vector<double> exactFactors(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        exactFactors[i] = lof.Factor(&queries[i * lof.GetFeatures()]);
+    }
+    bool exactTree = Measure("kd-tree", lof, queries, exact, exactFactors, lofThreshold);
+    if (!exactTree)
+    {
+        std::cout << "  kd-tree neighbors differ from the scan" << std::endl;
+    }
+
+    start = std::chrono::steady_clock::now();
+    lof.BuildApproximateIndex();
+    elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "  hnsw build: " << elapsed.count() / 1e6 << " ms" << std::endl;
+    lof.SetSearch(LocalOutlierFactor::SEARCH_APPROXIMATE);
+    for (uint32_t ef : {20, 40, 80, 160, 320})
+    {
+        lof.SetSearchWidth(ef);
+        std::string label = "hnsw ef " + std::to_string(ef);
+        Measure(label.c_str(), lof, queries, exact, exactFactors, lofThreshold);
+    }
+    return exactTree;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    uint64_t trainingRows = 200000;
+    uint64_t queryRows = 1000;
+    std::vector<LabeledFlow> flows;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            trainingRows = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+        {
+            queryRows = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (!LoadFlowCsv(argv[i], flows))
+        {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    NativeScorer scorer;
+    if (flows.empty() || queryRows == 0 ||
+        !scorer.Load("saved_models/isolation_forest.txt", "saved_models/model_metadata.json") ||
+        !scorer.LoadLof("saved_models/lof_model.txt"))
+    {
+        std::cerr << "usage: " << argv[0] << " [-n TRAINING_ROWS] [-q QUERIES] FLOWS.csv... "
+                  << "(run from the repository root after export_models.py)" << std::endl;
+        return 2;
+    }
+    LocalOutlierFactor model = scorer.GetLof();
+    const FeatureScaler& scaler = model.GetScaler();
+
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, flows.size() - 1);
+    auto synthetic = [&](uint64_t count) {
+        std::vector<double> rows(count * mlfw::N_FEATURES);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            FlowQuery q = flows[pick(rng)].query;
+            mlfw::PerturbFlow(q, rng);
+            double features[mlfw::N_FEATURES];
+            ComputeModelFeatures(q, features);
+            scaler.Transform(features, &rows[i * mlfw::N_FEATURES]);
+        }
+        return rows;
+    };
+    std::vector<double> queries = synthetic(queryRows);
+
+    bool exact = Report("Saved model", model, queries, scorer.GetLofThreshold());
+
+    LocalOutlierFactor fitted;
+    std::vector<double> training = synthetic(trainingRows);
+    auto start = std::chrono::steady_clock::now();
+    if (!fitted.Fit(scaler, training, model.GetNeighbors()))
+    {
+        std::cerr << "Need more than " << model.GetNeighbors() << " training rows" << std::endl;
+        return 2;
+    }
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Synthetic fit: " << elapsed.count() / 1e6 << " ms" << std::endl;
+    exact = Report("Synthetic", fitted, queries, scorer.GetLofThreshold()) && exact;
+    return exact ? 0 : 1;
+}
@@ -0,0 +1,768 @@
+#ifndef ML_FIREWALL_LOF_H
+#define ML_FIREWALL_LOF_H
+
+#include "ml-firewall-forest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+// sklearn LocalOutlierFactor (novelty=True) evaluated in-process from the
+// dump written by export_models.py, or fitted here on scaled samples. The
+// k-distance and local reachability density of every training sample are
+// precomputed, so scoring a flow x only needs its k nearest samples n_j:
+//
+//   reach_j = max(|x - n_j|, k_distance(n_j))
+//   lrd(x)  = 1 / (mean(reach_j) + 1e-10)
+//   factor  = mean(lrd(n_j) / lrd(x))            (-score_samples)
+//
+// Neighbors are found exactly with a KD-tree over the scaled features.
+// Samples are stored in the tree's leaf order, so each leaf is a contiguous
+// run of rows and the sample indices handed out by Neighbors() are positions
+// in that order, not rows of the training file.
+//
+// For training sets in the millions, BuildApproximateIndex() adds an HNSW
+// graph (hierarchical navigable small world: each sample linked to a few
+// close samples, with sparser long-range layers on top). SEARCH_APPROXIMATE
+// walks it greedily, visiting a few hundred samples per query instead of
+// the thousands the KD-tree ends up checking in 16 dimensions.
+//
+// Save() writes the samples and the KD-tree to a model bundle as they are
+// laid out here, so a bundle-loaded model searches the mapped file directly.
+class LocalOutlierFactor
+{
+  public:
+    enum Search
+    {
+        SEARCH_EXACT,
+        SEARCH_APPROXIMATE
+    };
+
+    struct Neighbor
+    {
+        double distance; // squared Euclidean
+        uint32_t sample;
+
+        bool operator<(const Neighbor& other) const
+        {
+            return distance < other.distance;
+        }
+    };
+
+    // Returns false if the file is missing or malformed
+    bool Load(const std::string& path)
+    {
+        *this = LocalOutlierFactor();
+
+        std::ifstream in(path);
+        std::string tag;
+        uint32_t version = 0;
+        uint32_t features = 0;
+        uint32_t neighbors = 0;
+        uint32_t samples = 0;
+        double offset = 0.0;
+        FeatureScaler scaler;
+        if (!(in >> tag >> version) || tag != "mlfw-lof" || version != 1 ||
+            !mlfw::Expect(in, "features") || !(in >> features) || features == 0 ||
+            !scaler.Load(in, features) || !mlfw::Expect(in, "neighbors") ||
+            !(in >> neighbors) || neighbors == 0 || !mlfw::Expect(in, "samples") ||
+            !(in >> samples) || samples < neighbors || !mlfw::Expect(in, "offset") ||
+            !(in >> offset))
+        {
+            return false;
+        }
+
+        std::vector<double> points(size_t(samples) * features);
+        std::vector<double> kDistance(samples), lrd(samples);
+        for (uint32_t s = 0; s < samples; s++)
+        {
+            for (uint32_t f = 0; f < features; f++)
+            {
+                if (!(in >> points[size_t(s) * features + f]))
+                {
+                    return false;
+                }
+            }
+            if (!(in >> kDistance[s] >> lrd[s]))
+            {
+                return false;
+            }
+        }
+
+        m_scaler = scaler;
+        m_features = features;
+        m_neighbors = neighbors;
+        m_offset = offset;
+        BuildTree(points, kDistance, lrd);
+        return true;
+    }
+
+    // Fits on samples already scaled by scaler, stored row after row, like
+    // sklearn's fit(): every sample's k-distance and lrd come from its
+    // neighbors among the other samples. The offset is that of
+    // contamination="auto". Returns false unless there are more samples than
+    // neighbors.
+    bool Fit(const FeatureScaler& scaler, const std::vector<double>& points, uint32_t neighbors)
+    {
+        uint32_t features = scaler.mean.size();
+        size_t samples = features > 0 ? points.size() / features : 0;
+        *this = LocalOutlierFactor();
+        if (neighbors == 0 || samples <= neighbors || samples > UINT32_MAX)
+        {
+            return false;
+        }
+        m_scaler = scaler;
+        m_features = features;
+        m_neighbors = neighbors;
+        m_offset = -1.5;
+        BuildTree(points, std::vector<double>(samples), std::vector<double>(samples));
+
+        // Neighbors of each sample without the sample itself. With duplicates
+        // it may not be among the k + 1 found, then the farthest is dropped.
+        std::vector<double>& kDistance = m_kDistance.Own();
+        std::vector<double>& lrd = m_lrd.Own();
+        std::vector<uint32_t> fitNeighbors(samples * neighbors);
+        std::vector<Neighbor> found;
+        for (uint32_t s = 0; s < samples; s++)
+        {
+            SearchTree(GetSample(s), neighbors + 1, found);
+            auto self = std::find_if(found.begin(), found.end(),
+                                     [s](const Neighbor& n) { return n.sample == s; });
+            found.erase(self != found.end() ? self : found.end() - 1);
+            for (uint32_t j = 0; j < neighbors; j++)
+            {
+                fitNeighbors[size_t(s) * neighbors + j] = found[j].sample;
+            }
+            kDistance[s] = std::sqrt(found.back().distance);
+        }
+        for (uint32_t s = 0; s < samples; s++)
+        {
+            double reach = 0.0;
+            for (uint32_t j = 0; j < neighbors; j++)
+            {
+                uint32_t n = fitNeighbors[size_t(s) * neighbors + j];
+                reach += std::max(std::sqrt(Distance(GetSample(s), n)), kDistance[n]);
+            }
+            lrd[s] = 1.0 / (reach / neighbors + 1e-10);
+        }
+        return true;
+    }
+
+    // Maps the lof.* sections of a bundle written by Save(): the samples and
+    // KD-tree are used in place, with only their sizes and indices checked.
+    // An approximate index is not stored and has to be built again.
+    bool Load(const mlfw::ModelBundle& bundle)
+    {
+        *this = LocalOutlierFactor();
+
+        uint32_t features = 0;
+        uint32_t neighbors = 0;
+        if (!bundle.GetValue("lof.features", features) || features == 0 ||
+            !bundle.GetValue("lof.neighbors", neighbors) || neighbors == 0 ||
+            !m_scaler.Load(bundle, "lof.scaler", features) ||
+            !bundle.GetValue("lof.offset", m_offset) || !bundle.Get("lof.points", m_points) ||
+            !bundle.Get("lof.k_distance", m_kDistance) || !bundle.Get("lof.lrd", m_lrd) ||
+            !bundle.Get("lof.node_feature", m_nodeFeature) ||
+            !bundle.Get("lof.node_split", m_nodeSplit) ||
+            !bundle.Get("lof.node_left", m_nodeLeft) ||
+            !bundle.Get("lof.node_begin", m_nodeBegin) ||
+            !bundle.Get("lof.node_end", m_nodeEnd))
+        {
+            *this = LocalOutlierFactor();
+            return false;
+        }
+        m_features = features;
+        m_neighbors = neighbors;
+        if (!CheckTree())
+        {
+            *this = LocalOutlierFactor();
+            return false;
+        }
+        return true;
+    }
+
+    // Adds the model to bundle as lof.* sections
+    void Save(mlfw::BundleWriter& bundle) const
+    {
+        bundle.AddValue("lof.features", m_features);
+        bundle.AddValue("lof.neighbors", m_neighbors);
+        m_scaler.Save(bundle, "lof.scaler");
+        bundle.AddValue("lof.offset", m_offset);
+        bundle.Add("lof.points", m_points);
+        bundle.Add("lof.k_distance", m_kDistance);
+        bundle.Add("lof.lrd", m_lrd);
+        bundle.Add("lof.node_feature", m_nodeFeature);
+        bundle.Add("lof.node_split", m_nodeSplit);
+        bundle.Add("lof.node_left", m_nodeLeft);
+        bundle.Add("lof.node_begin", m_nodeBegin);
+        bundle.Add("lof.node_end", m_nodeEnd);
+    }
+
+    bool IsLoaded() const
+    {
+        return m_neighbors > 0;
+    }
+
+    // Builds the HNSW graph over the loaded samples: m links per sample on
+    // the upper layers and 2m on the bottom one, candidates gathered with a
+    // beam of efConstruction. Samples are inserted in an order shuffled by
+    // seed so the graph does not follow the KD-tree's leaf order.
+    void BuildApproximateIndex(uint32_t m = 16, uint32_t efConstruction = 200, uint64_t seed = 1)
+    {
+        uint32_t samples = GetSamples();
+        m_linksPerLayer = std::max<uint32_t>(m, 2);
+        m_efConstruction = std::max(efConstruction, m_linksPerLayer);
+        m_level.assign(samples, 0);
+        m_upperLinks.clear();
+        m_upperBase.assign(samples, 0);
+        m_bottomLinks.assign(size_t(samples) * (2 * m_linksPerLayer + 1), 0);
+        m_maxLevel = 0;
+
+        std::mt19937_64 rng(seed);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        double levelScale = 1.0 / std::log(double(m_linksPerLayer));
+        for (uint32_t s = 0; s < samples; s++)
+        {
+            m_level[s] = static_cast<uint8_t>(
+                std::min(-std::log(1.0 - uniform(rng)) * levelScale, 30.0));
+            if (m_level[s] > 0)
+            {
+                m_upperBase[s] = m_upperLinks.size();
+                m_upperLinks.resize(m_upperLinks.size() + m_level[s] * (m_linksPerLayer + 1), 0);
+            }
+        }
+
+        std::vector<uint32_t> order(samples);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), rng);
+        m_entry = order.empty() ? 0 : order[0];
+        m_maxLevel = order.empty() ? 0 : m_level[m_entry];
+        for (size_t i = 1; i < order.size(); i++)
+        {
+            Insert(order[i]);
+        }
+        m_approximate = samples > 0;
+    }
+
+    // Returns false if SEARCH_APPROXIMATE is asked for before
+    // BuildApproximateIndex()
+    bool SetSearch(Search search)
+    {
+        if (search == SEARCH_APPROXIMATE && !m_approximate)
+        {
+            return false;
+        }
+        m_search = search;
+        return true;
+    }
+
+    Search GetSearch() const
+    {
+        return m_search;
+    }
+
+    // Beam width of SEARCH_APPROXIMATE queries; wider is slower but finds
+    // more of the true neighbors
+    void SetSearchWidth(uint32_t ef)
+    {
+        m_efSearch = std::max<uint32_t>(ef, 1);
+    }
+
+    uint32_t GetSearchWidth() const
+    {
+        return m_efSearch;
+    }
+
+    // The k samples closest to x, closest first
+    void Neighbors(const double* x, uint32_t k, std::vector<Neighbor>& found) const
+    {
+        if (m_search == SEARCH_APPROXIMATE)
+        {
+            SearchGraph(x, k, found);
+        }
+        else
+        {
+            SearchTree(x, k, found);
+        }
+    }
+
+    // sklearn's -score_samples of one flow's scaled features: about 1 for
+    // inliers, higher is more anomalous
+    double Factor(const double* x) const
+    {
+        std::vector<Neighbor> found;
+        Neighbors(x, m_neighbors, found);
+        double reach = 0.0;
+        for (const Neighbor& n : found)
+        {
+            reach += std::max(std::sqrt(n.distance), m_kDistance[n.sample]);
+        }
+        double lrd = 1.0 / (reach / found.size() + 1e-10);
+        double ratios = 0.0;
+        for (const Neighbor& n : found)
+        {
+            ratios += m_lrd[n.sample] / lrd;
+        }
+        return ratios / found.size();
+    }
+
+    const FeatureScaler& GetScaler() const
+    {
+        return m_scaler;
+    }
+
+    uint32_t GetFeatures() const
+    {
+        return m_features;
+    }
+
+    uint32_t GetNeighbors() const
+    {
+        return m_neighbors;
+    }
+
+    uint32_t GetSamples() const
+    {
+        return m_kDistance.size();
+    }
+
+    const double* GetSample(uint32_t s) const
+    {
+        return &m_points[size_t(s) * m_features];
+    }
+
+    // Squared distance from x to sample s. Four partial sums keep the
+    // additions from waiting on each other.
+    double Distance(const double* x, uint32_t s) const
+    {
+        const double* p = GetSample(s);
+        double sum[4] = {0.0, 0.0, 0.0, 0.0};
+        uint32_t f = 0;
+        for (; f + 4 <= m_features; f += 4)
+        {
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                double d = x[f + i] - p[f + i];
+                sum[i] += d * d;
+            }
+        }
+        for (; f < m_features; f++)
+        {
+            double d = x[f] - p[f];
+            sum[0] += d * d;
+        }
+        return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    }
+
+    // offset_ of the sklearn model: decision_function = -factor - offset
+    double GetOffset() const
+    {
+        return m_offset;
+    }
+
+  private:
+    static const uint32_t LEAF_SIZE = 16;
+
+    // True if the sample arrays agree in size and every search of the
+    // KD-tree stays inside them. Children come after their parent, so the
+    // tree has no cycles.
+    bool CheckTree() const
+    {
+        size_t samples = m_kDistance.size();
+        size_t nodes = m_nodeFeature.size();
+        if (samples < m_neighbors || samples > UINT32_MAX || m_lrd.size() != samples ||
+            m_points.size() != samples * m_features || nodes == 0 || m_nodeSplit.size() != nodes ||
+            m_nodeLeft.size() != nodes || m_nodeBegin.size() != nodes || m_nodeEnd.size() != nodes)
+        {
+            return false;
+        }
+        for (size_t n = 0; n < nodes; n++)
+        {
+            bool valid = m_nodeFeature[n] < 0
+                             ? m_nodeBegin[n] <= m_nodeEnd[n] && m_nodeEnd[n] <= samples
+                             : uint32_t(m_nodeFeature[n]) < m_features && m_nodeLeft[n] > n &&
+                                   m_nodeLeft[n] + 1 < nodes;
+            if (!valid)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Keeps the k closest of the samples pushed, sorted by distance
+    static void Push(std::vector<Neighbor>& best, uint32_t k, double distance, uint32_t sample)
+    {
+        if (best.size() == k && !(distance < best.back().distance))
+        {
+            return;
+        }
+        if (best.size() == k)
+        {
+            best.pop_back();
+        }
+        Neighbor n = {distance, sample};
+        best.insert(std::upper_bound(best.begin(), best.end(), n), n);
+    }
+
+    // Splits samples on the widest feature at the median until a node holds
+    // LEAF_SIZE samples or only copies of one point, then stores the samples
+    // and their statistics in leaf order
+    void BuildTree(const std::vector<double>& points,
+                   const std::vector<double>& kDistance,
+                   const std::vector<double>& lrd)
+    {
+        uint32_t samples = kDistance.size();
+        std::vector<uint32_t> order(samples);
+        std::iota(order.begin(), order.end(), 0);
+        m_nodeFeature.assign(1, -1);
+        m_nodeSplit.assign(1, 0.0);
+        m_nodeLeft.assign(1, 0);
+        m_nodeBegin.assign(1, 0);
+        m_nodeEnd.assign(1, samples);
+        SplitNode(0, points, order);
+
+        std::vector<double>& sortedPoints = m_points.Own();
+        std::vector<double>& sortedKDistance = m_kDistance.Own();
+        std::vector<double>& sortedLrd = m_lrd.Own();
+        sortedPoints.resize(points.size());
+        sortedKDistance.resize(samples);
+        sortedLrd.resize(samples);
+        for (uint32_t s = 0; s < samples; s++)
+        {
+            std::copy_n(&points[size_t(order[s]) * m_features],
+                        m_features,
+                        &sortedPoints[size_t(s) * m_features]);
+            sortedKDistance[s] = kDistance[order[s]];
+            sortedLrd[s] = lrd[order[s]];
+        }
+    }
+
+    void SplitNode(uint32_t node, const std::vector<double>& points, std::vector<uint32_t>& order)
+    {
+        uint32_t begin = m_nodeBegin[node];
+        uint32_t end = m_nodeEnd[node];
+        if (end - begin <= LEAF_SIZE)
+        {
+            return;
+        }
+
+        int32_t widest = -1;
+        double widestSpread = 0.0;
+        for (uint32_t f = 0; f < m_features; f++)
+        {
+            double lo = std::numeric_limits<double>::infinity();
+            double hi = -lo;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                double v = points[size_t(order[i]) * m_features + f];
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+            }
+            if (hi - lo > widestSpread)
+            {
+                widest = f;
+                widestSpread = hi - lo;
+            }
+        }
+        if (widest < 0)
+        {
+            return;
+        }
+
+        uint32_t mid = begin + (end - begin) / 2;
+        auto value = [&](uint32_t s) { return points[size_t(s) * m_features + widest]; };
+        std::nth_element(order.begin() + begin,
+                         order.begin() + mid,
+                         order.begin() + end,
+                         [&](uint32_t a, uint32_t b) { return value(a) < value(b); });
+
+        uint32_t left = m_nodeFeature.size();
+        m_nodeFeature.Own()[node] = widest;
+        m_nodeSplit.Own()[node] = value(order[mid]);
+        m_nodeLeft.Own()[node] = left;
+        for (uint32_t child = 0; child < 2; child++)
+        {
+            m_nodeFeature.push_back(-1);
+            m_nodeSplit.push_back(0.0);
+            m_nodeLeft.push_back(0);
+        }
+        m_nodeBegin.push_back(begin);
+        m_nodeEnd.push_back(mid);
+        m_nodeBegin.push_back(mid);
+        m_nodeEnd.push_back(end);
+        SplitNode(left, points, order);
+        SplitNode(left + 1, points, order);
+    }
+
+    void SearchTree(const double* x, uint32_t k, std::vector<Neighbor>& found) const
+    {
+        found.clear();
+        found.reserve(k + 1);
+        std::vector<double> offsets(m_features, 0.0);
+        SearchNode(0, x, k, 0.0, offsets.data(), found);
+    }
+
+    // Visits the child on x's side of the split first. boxDistance is the
+    // squared distance from x to the node's cell, kept up to date from the
+    // per-feature offsets as in Arya and Mount's incremental search, and
+    // prunes the far child.
+    void SearchNode(uint32_t node,
+                    const double* x,
+                    uint32_t k,
+                    double boxDistance,
+                    double* offsets,
+                    std::vector<Neighbor>& found) const
+    {
+        int32_t feature = m_nodeFeature[node];
+        if (feature < 0)
+        {
+            for (uint32_t s = m_nodeBegin[node]; s < m_nodeEnd[node]; s++)
+            {
+                Push(found, k, Distance(x, s), s);
+            }
+            return;
+        }
+
+        double diff = x[feature] - m_nodeSplit[node];
+        uint32_t nearChild = m_nodeLeft[node] + (diff >= 0.0);
+        uint32_t farChild = m_nodeLeft[node] + (diff < 0.0);
+        SearchNode(nearChild, x, k, boxDistance, offsets, found);
+
+        double saved = offsets[feature];
+        double farDistance = boxDistance - saved * saved + diff * diff;
+        if (found.size() < k || farDistance < found.back().distance)
+        {
+            offsets[feature] = diff;
+            SearchNode(farChild, x, k, farDistance, offsets, found);
+            offsets[feature] = saved;
+        }
+    }
+
+    // Link list of sample s on a layer: a count, then the linked samples
+    uint32_t* Links(uint32_t s, uint32_t level)
+    {
+        return level == 0
+                   ? &m_bottomLinks[size_t(s) * (2 * m_linksPerLayer + 1)]
+                   : &m_upperLinks[m_upperBase[s] + (level - 1) * (m_linksPerLayer + 1)];
+    }
+
+    const uint32_t* Links(uint32_t s, uint32_t level) const
+    {
+        return const_cast<LocalOutlierFactor*>(this)->Links(s, level);
+    }
+
+    // Moves to the closest linked sample until none is closer
+    uint32_t Greedy(const double* x, uint32_t s, uint32_t level) const
+    {
+        double distance = Distance(x, s);
+        for (bool moved = true; moved;)
+        {
+            moved = false;
+            const uint32_t* links = Links(s, level);
+            for (uint32_t i = 1; i <= links[0]; i++)
+            {
+                double d = Distance(x, links[i]);
+                if (d < distance)
+                {
+                    distance = d;
+                    s = links[i];
+                    moved = true;
+                }
+            }
+        }
+        return s;
+    }
+
+    // Beam search on one layer from entry: the ef closest samples reached,
+    // closest first
+    void SearchLayer(const double* x, uint32_t entry, uint32_t ef, uint32_t level,
+                     std::vector<Neighbor>& found) const
+    {
+        // Visit marks shared by the calls of a thread; a new epoch clears them
+        static thread_local std::vector<uint32_t> visited;
+        static thread_local uint32_t epoch = 0;
+        if (visited.size() < m_kDistance.size() || ++epoch == 0)
+        {
+            visited.assign(std::max(visited.size(), m_kDistance.size()), 0);
+            epoch = 1;
+        }
+
+        std::priority_queue<Neighbor> best; // farthest on top
+        std::vector<Neighbor> frontier;     // min-heap on distance
+        auto closer = [](const Neighbor& a, const Neighbor& b) { return b < a; };
+        Neighbor start = {Distance(x, entry), entry};
+        visited[entry] = epoch;
+        best.push(start);
+        frontier.push_back(start);
+        while (!frontier.empty())
+        {
+            std::pop_heap(frontier.begin(), frontier.end(), closer);
+            Neighbor current = frontier.back();
+            frontier.pop_back();
+            if (current.distance > best.top().distance)
+            {
+                break;
+            }
+            const uint32_t* links = Links(current.sample, level);
+            for (uint32_t i = 1; i <= links[0]; i++)
+            {
+                uint32_t s = links[i];
+                if (visited[s] == epoch)
+                {
+                    continue;
+                }
+                visited[s] = epoch;
+                Neighbor n = {Distance(x, s), s};
+                if (best.size() < ef || n.distance < best.top().distance)
+                {
+                    best.push(n);
+                    frontier.push_back(n);
+                    std::push_heap(frontier.begin(), frontier.end(), closer);
+                    if (best.size() > ef)
+                    {
+                        best.pop();
+                    }
+                }
+            }
+        }
+
+        found.resize(best.size());
+        for (size_t i = found.size(); i-- > 0; best.pop())
+        {
+            found[i] = best.top();
+        }
+    }
+
+    void SearchGraph(const double* x, uint32_t k, std::vector<Neighbor>& found) const
+    {
+        uint32_t s = m_entry;
+        for (uint32_t level = m_maxLevel; level > 0; level--)
+        {
+            s = Greedy(x, s, level);
+        }
+        SearchLayer(x, s, std::max(m_efSearch, k), 0, found);
+        if (found.size() > k)
+        {
+            found.resize(k);
+        }
+    }
+
+    // Keeps at most limit of the candidates (closest first) for s, skipping
+    // any that is closer to an already kept one than to s, so the links
+    // spread out in different directions
+    void SelectLinks(const std::vector<Neighbor>& candidates, uint32_t limit,
+                     std::vector<uint32_t>& kept) const
+    {
+        kept.clear();
+        for (const Neighbor& c : candidates)
+        {
+            if (kept.size() == limit)
+            {
+                break;
+            }
+            bool diverse = true;
+            for (uint32_t k : kept)
+            {
+                if (Distance(GetSample(c.sample), k) < c.distance)
+                {
+                    diverse = false;
+                    break;
+                }
+            }
+            if (diverse)
+            {
+                kept.push_back(c.sample);
+            }
+        }
+    }
+
+    void Insert(uint32_t s)
+    {
+        const double* x = GetSample(s);
+        uint32_t entry = m_entry;
+        for (uint32_t level = m_maxLevel; level > m_level[s]; level--)
+        {
+            entry = Greedy(x, entry, level);
+        }
+
+        std::vector<Neighbor> candidates;
+        std::vector<uint32_t> kept;
+        for (uint32_t level = std::min<uint32_t>(m_level[s], m_maxLevel) + 1; level-- > 0;)
+        {
+            uint32_t limit = level == 0 ? 2 * m_linksPerLayer : m_linksPerLayer;
+            SearchLayer(x, entry, m_efConstruction, level, candidates);
+            entry = candidates[0].sample;
+            SelectLinks(candidates, limit, kept);
+            uint32_t* links = Links(s, level);
+            links[0] = kept.size();
+            std::copy(kept.begin(), kept.end(), links + 1);
+
+            // Link back, pruning the neighbor's list when it overflows
+            for (uint32_t n : kept)
+            {
+                uint32_t* back = Links(n, level);
+                if (back[0] < limit)
+                {
+                    back[++back[0]] = s;
+                    continue;
+                }
+                std::vector<Neighbor> linked = {{Distance(GetSample(n), s), s}};
+                for (uint32_t i = 1; i <= back[0]; i++)
+                {
+                    linked.push_back({Distance(GetSample(n), back[i]), back[i]});
+                }
+                std::sort(linked.begin(), linked.end());
+                std::vector<uint32_t> pruned;
+                SelectLinks(linked, limit, pruned);
+                back[0] = pruned.size();
+                std::copy(pruned.begin(), pruned.end(), back + 1);
+            }
+        }
+        if (m_level[s] > m_maxLevel)
+        {
+            m_maxLevel = m_level[s];
+            m_entry = s;
+        }
+    }
+
+    FeatureScaler m_scaler;
+    uint32_t m_features = 0;
+    uint32_t m_neighbors = 0;
+    double m_offset = -1.5;
+    Search m_search = SEARCH_EXACT;
+
+    // Samples in leaf order with their k-distance and lrd
+    mlfw::ModelArray<double> m_points;
+    mlfw::ModelArray<double> m_kDistance;
+    mlfw::ModelArray<double> m_lrd;
+
+    // KD-tree; a node with feature -1 is a leaf over samples [begin, end),
+    // otherwise its children are left and left + 1
+    mlfw::ModelArray<int32_t> m_nodeFeature;
+    mlfw::ModelArray<double> m_nodeSplit;
+    mlfw::ModelArray<uint32_t> m_nodeLeft;
+    mlfw::ModelArray<uint32_t> m_nodeBegin;
+    mlfw::ModelArray<uint32_t> m_nodeEnd;
+
+    // HNSW graph
+    bool m_approximate = false;
+    uint32_t m_linksPerLayer = 16;
+    uint32_t m_efConstruction = 200;
+    uint32_t m_efSearch = 64;
+    uint32_t m_entry = 0;
+    uint32_t m_maxLevel = 0;
+    std::vector<uint8_t> m_level;
+    std::vector<uint32_t> m_bottomLinks; // 2m + 1 per sample
+    std::vector<uint32_t> m_upperLinks;  // m + 1 per sample and layer above 0
+    std::vector<size_t> m_upperBase;
+};
+
+#endif // ML_FIREWALL_LOF_H
@@ -0,0 +1,470 @@
+#ifndef ML_FIREWALL_NATIVE_H
+#define ML_FIREWALL_NATIVE_H
+
+#include "ml-firewall-bundle.h"
+#include "ml-firewall-cache.h"
+#include "ml-firewall-cascade.h"
+#include "ml-firewall-client.h"
+#include "ml-firewall-compiled.h"
+#include "ml-firewall-features.h"
+#include "ml-firewall-forest.h"
+#include "ml-firewall-lof.h"
+#include "ml-firewall-quantized.h"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Scores flows in-process the way the scorer service does with the Isolation
+// Forest: model features computed in double, StandardScaler, then
+// decision_function compared with iso_threshold of model_metadata.json.
+// Produces verdicts identical to sklearn's without any IPC. Once LoadLof()
+// has been called, verdicts also carry the LOF factor; block decisions are
+// still the forest's alone.
+//
+// UseCascade() trades the LOF factor of clear-cut flows for speed: the
+// forest settles them, often before walking all its trees, and the LOF only
+// decides the flows whose score is close to iso_threshold.
+//
+// UseCompiledForest() scores with code generated from the forest by
+// ml-firewall-codegen and linked into the program, with identical scores.
+//
+// SaveBundle() packs both models, the thresholds and the model identity into
+// one model bundle; LoadBundle() maps it and scores from the mapping, so
+// loading costs a checksum pass instead of parsing the text dumps.
+class NativeScorer
+{
+  public:
+    // Returns false if either file cannot be read or they disagree on the
+    // number of features
+    bool Load(const std::string& forestPath, const std::string& metadataPath)
+    {
+        std::ifstream file(metadataPath);
+        if (!file || !m_forest.Load(forestPath))
+        {
+            return false;
+        }
+        std::stringstream text;
+        text << file.rdbuf();
+        m_isoThreshold = mlfw::JsonNumberField(text.str(), "iso_threshold");
+        m_lofThreshold = mlfw::JsonNumberField(text.str(), "lof_threshold");
+        m_modelVersion = mlfw::JsonStringField(text.str(), "model_version");
+        m_trainingDate = mlfw::JsonStringField(text.str(), "training_date");
+        m_pruned = false;
+        m_prunedDepth = 0;
+        UpdateModelTag();
+        std::vector<std::string> names = mlfw::JsonStringArrayField(text.str(), "feature_names");
+        return !std::isnan(m_isoThreshold) && m_forest.GetFeatures() == mlfw::N_FEATURES &&
+               (names.empty() || JoinFeatureNames(names) == GetFeatureNames());
+    }
+
+    // Maps a bundle written by SaveBundle(). Returns false if it is missing,
+    // corrupt, or was made for other features; the LOF is optional.
+    bool LoadBundle(const std::string& path, bool verify = true)
+    {
+        *this = NativeScorer();
+        mlfw::ModelBundle bundle;
+        if (!bundle.Open(path, verify) ||
+            bundle.GetString("meta.feature_names") != GetFeatureNames() ||
+            !bundle.GetValue("meta.iso_threshold", m_isoThreshold) ||
+            !bundle.GetValue("meta.lof_threshold", m_lofThreshold) || !m_forest.Load(bundle) ||
+            m_forest.GetFeatures() != mlfw::N_FEATURES ||
+            (bundle.Has("lof.features") &&
+             (!m_lof.Load(bundle) || m_lof.GetFeatures() != mlfw::N_FEATURES)))
+        {
+            *this = NativeScorer();
+            return false;
+        }
+        m_modelVersion = bundle.GetString("meta.model_version");
+        m_trainingDate = bundle.GetString("meta.training_date");
+        UpdateModelTag();
+        return true;
+    }
+
+    // Writes the loaded models to a bundle at path, replacing it atomically
+    bool SaveBundle(const std::string& path) const
+    {
+        if (!m_forest.IsLoaded())
+        {
+            return false;
+        }
+        mlfw::BundleWriter bundle;
+        bundle.AddString("meta.feature_names", GetFeatureNames());
+        bundle.AddString("meta.model_version", m_modelVersion);
+        bundle.AddString("meta.training_date", m_trainingDate);
+        bundle.AddValue("meta.iso_threshold", m_isoThreshold);
+        bundle.AddValue("meta.lof_threshold", m_lofThreshold);
+        m_forest.Save(bundle);
+        if (m_lof.IsLoaded())
+        {
+            m_lof.Save(bundle);
+        }
+        return bundle.Write(path);
+    }
+
+    // Returns false if the LOF dump cannot be read or does not use the model
+    // features
+    bool LoadLof(const std::string& lofPath)
+    {
+        return m_lof.Load(lofPath) && m_lof.GetFeatures() == mlfw::N_FEATURES;
+    }
+
+    // Finds LOF neighbors in an HNSW graph with beam width ef instead of the
+    // exact KD-tree; for LOF models fitted on millions of flows
+    void UseApproximateLof(uint32_t ef)
+    {
+        m_lof.BuildApproximateIndex();
+        m_lof.SetSearch(LocalOutlierFactor::SEARCH_APPROXIMATE);
+        m_lof.SetSearchWidth(ef);
+        UpdateModelTag();
+    }
+
+    // Scores with the first trees of the forest only, cut maxDepth levels
+    // below the root (0 = all of them); see IsolationForest::Prune()
+    bool PruneForest(uint32_t trees, uint32_t maxDepth)
+    {
+        ForestCascade cascade = m_cascade;
+        if (!m_forest.Prune(trees, maxDepth))
+        {
+            return false;
+        }
+        m_pruned = true;
+        if (maxDepth > 0)
+        {
+            m_prunedDepth = m_prunedDepth == 0 ? maxDepth : std::min(m_prunedDepth, maxDepth);
+        }
+        bool rebuilt =
+            (!m_quantized.IsBuilt() || UseQuantizedForest()) &&
+            (!m_compiled || UseCompiledForest(m_compiled)) &&
+            (!cascade.IsBuilt() ||
+             m_cascade.Build(m_forest, cascade.GetLow(), cascade.GetHigh(), cascade.GetChunk()));
+        UpdateModelTag();
+        return rebuilt;
+    }
+
+    // Walks the forest with 16-bit split codes instead of float32 thresholds.
+    // Scores do not change; see QuantizedForest.
+    bool UseQuantizedForest()
+    {
+        bool built = m_quantized.Build(m_forest);
+        UpdateModelTag();
+        return built;
+    }
+
+    // Walks the forest through compiled, code generated from it (see
+    // mlfw::WriteCompiledForest()). Scores do not change. Returns false, and
+    // goes back to the interpreted forest, if compiled is null or was
+    // generated from another forest. The cascade walks the interpreted trees.
+    bool UseCompiledForest(const CompiledForest* compiled)
+    {
+        m_compiled = compiled && m_forest.IsLoaded() &&
+                             compiled->fingerprint == mlfw::ForestFingerprint(m_forest)
+                         ? compiled
+                         : nullptr;
+        UpdateModelTag();
+        return m_compiled != nullptr;
+    }
+
+    // Cascades the models: flows whose decision function is below
+    // iso_threshold - blockMargin are blocked, and flows above iso_threshold +
+    // passMargin passed, by the forest alone, which checks every chunk trees
+    // whether the rest can still change that (see ForestCascade). The flows
+    // in between are scored by the LOF, which blocks them if their factor
+    // reaches lof_threshold. Call after LoadLof(): without a LOF the band
+    // shrinks to iso_threshold and decisions are the forest's. Returns false
+    // if no forest is loaded or a margin is negative.
+    bool UseCascade(double blockMargin, double passMargin, uint32_t chunk)
+    {
+        if (!m_lof.IsLoaded())
+        {
+            blockMargin = passMargin = 0.0;
+        }
+        bool built = blockMargin >= 0 && passMargin >= 0 &&
+                     m_cascade.Build(m_forest, m_isoThreshold - blockMargin,
+                                     m_isoThreshold + passMargin, chunk);
+        UpdateModelTag();
+        return built;
+    }
+
+    const ForestCascade& GetCascade() const
+    {
+        return m_cascade;
+    }
+
+    // decision_function of the flow, in double
+    double IsoScore(const FlowQuery& query) const
+    {
+        double features[mlfw::N_FEATURES];
+        float scaled[mlfw::N_FEATURES];
+        ComputeModelFeatures(query, features);
+        m_forest.GetScaler().Transform(features, scaled);
+        if (m_compiled)
+        {
+            return m_forest.Normalize(m_compiled->pathLengthSum(scaled));
+        }
+        return m_quantized.IsBuilt() ? m_quantized.DecisionFunction(scaled)
+                                     : m_forest.DecisionFunction(scaled);
+    }
+
+    // LOF factor (-score_samples) of the flow, NaN without LoadLof()
+    double LofFactor(const FlowQuery& query) const
+    {
+        if (!m_lof.IsLoaded())
+        {
+            return NAN;
+        }
+        double features[mlfw::N_FEATURES];
+        double scaled[mlfw::N_FEATURES];
+        ComputeModelFeatures(query, features);
+        m_lof.GetScaler().Transform(features, scaled);
+        return m_lof.Factor(scaled);
+    }
+
+    void Score(const FlowQuery& query, FlowVerdict& verdict) const
+    {
+        if (m_cascade.IsBuilt())
+        {
+            ScoreBatch(&query, 1, &verdict);
+            return;
+        }
+        double isoScore = IsoScore(query);
+        verdict.flowId = query.flowId;
+        verdict.isoScore = isoScore;
+        verdict.lofFactor = LofFactor(query);
+        verdict.shouldBlock = isoScore <= m_isoThreshold;
+        verdict.modelTag = m_modelTag;
+        verdict.stage = mlfw::STAGE_NONE;
+    }
+
+    // Buffers batches are scored in. A caller scoring batch after batch can
+    // keep one (per thread) so they are allocated once and then reused.
+    struct Scratch
+    {
+        FlowBatch batch;
+        std::vector<float> scaled;
+        std::vector<double> isoScores;
+        std::vector<double> lofScaled;
+        std::vector<uint8_t> stages;
+    };
+
+    // Scores count flows with the forest's batched kernel
+    void ScoreBatch(const FlowQuery* queries, size_t count, FlowVerdict* verdicts) const
+    {
+        Scratch scratch;
+        ScoreBatch(queries, count, verdicts, scratch);
+    }
+
+    void ScoreBatch(const FlowQuery* queries,
+                    size_t count,
+                    FlowVerdict* verdicts,
+                    Scratch& scratch) const
+    {
+        scratch.batch.Clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            scratch.batch.Append(queries[i]);
+        }
+        ScoreFlows(scratch.batch, 0, count, verdicts, scratch);
+    }
+
+    // Scores flows [begin, begin + count) of batch, extracting and scaling
+    // their features in one pass
+    void ScoreFlows(const FlowBatch& batch, size_t begin, size_t count, FlowVerdict* verdicts) const
+    {
+        Scratch scratch;
+        ScoreFlows(batch, begin, count, verdicts, scratch);
+    }
+
+    // Scratch's batch is not used, so it may be batch
+    void ScoreFlows(const FlowBatch& batch,
+                    size_t begin,
+                    size_t count,
+                    FlowVerdict* verdicts,
+                    Scratch& scratch) const
+    {
+        std::vector<float>& scaled = scratch.scaled;
+        std::vector<double>& isoScores = scratch.isoScores;
+        scaled.resize(count * mlfw::N_FEATURES);
+        isoScores.resize(count);
+        ExtractFeatures(batch, begin, count, &m_forest.GetScaler(), scaled.data());
+        if (m_cascade.IsBuilt())
+        {
+            ScoreCascade(batch, begin, count, scaled.data(), verdicts, scratch);
+            return;
+        }
+        if (m_compiled)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                isoScores[i] = m_forest.Normalize(
+                    m_compiled->pathLengthSum(&scaled[i * mlfw::N_FEATURES]));
+            }
+        }
+        else if (m_quantized.IsBuilt())
+        {
+            m_quantized.DecisionFunctionBatch(scaled.data(), count, isoScores.data());
+        }
+        else
+        {
+            m_forest.DecisionFunctionBatch(scaled.data(), count, isoScores.data());
+        }
+
+        std::vector<double>& lofScaled = scratch.lofScaled;
+        if (m_lof.IsLoaded())
+        {
+            lofScaled.resize(count * mlfw::N_FEATURES);
+            ExtractFeatures(batch, begin, count, &m_lof.GetScaler(), lofScaled.data());
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            verdicts[i].flowId = batch.flowId[begin + i];
+            verdicts[i].isoScore = isoScores[i];
+            verdicts[i].lofFactor =
+                m_lof.IsLoaded() ? m_lof.Factor(&lofScaled[i * mlfw::N_FEATURES]) : NAN;
+            verdicts[i].shouldBlock = isoScores[i] <= m_isoThreshold;
+            verdicts[i].modelTag = m_modelTag;
+            verdicts[i].stage = mlfw::STAGE_NONE;
+        }
+    }
+
+    double GetIsoThreshold() const
+    {
+        return m_isoThreshold;
+    }
+
+    // lof_threshold of model_metadata.json: flows whose factor reaches it are
+    // LOF outliers
+    double GetLofThreshold() const
+    {
+        return m_lofThreshold;
+    }
+
+    const std::string& GetModelVersion() const
+    {
+        return m_modelVersion;
+    }
+
+    const std::string& GetTrainingDate() const
+    {
+        return m_trainingDate;
+    }
+
+    // Tag of the loaded model, as ReadModelTag() gives for its metadata, or
+    // of the variant of it scoring once the forest is pruned, quantized,
+    // compiled or cascaded or the LOF search is approximate; carried by every
+    // verdict it produces
+    uint32_t GetModelTag() const
+    {
+        return m_modelTag;
+    }
+
+    const IsolationForest& GetForest() const
+    {
+        return m_forest;
+    }
+
+    const LocalOutlierFactor& GetLof() const
+    {
+        return m_lof;
+    }
+
+  private:
+    // Folds the settings that can change verdicts into the model's tag, so
+    // a verdict cache never answers with the verdict of another variant
+    void UpdateModelTag()
+    {
+        std::ostringstream variant;
+        variant << std::setprecision(17);
+        if (m_pruned)
+        {
+            variant << "|trees=" << m_forest.GetTrees() << ",depth=" << m_prunedDepth;
+        }
+        if (m_quantized.IsBuilt())
+        {
+            variant << "|int16";
+        }
+        if (m_compiled)
+        {
+            variant << "|compiled";
+        }
+        if (m_lof.GetSearch() == LocalOutlierFactor::SEARCH_APPROXIMATE)
+        {
+            variant << "|ef=" << m_lof.GetSearchWidth();
+        }
+        if (m_cascade.IsBuilt())
+        {
+            variant << "|cascade=" << m_cascade.GetLow() << "," << m_cascade.GetHigh() << ","
+                    << m_cascade.GetChunk();
+        }
+        m_modelTag = mlfw::MakeModelTag(m_modelVersion, m_trainingDate + variant.str());
+    }
+
+    // ScoreFlows() through the cascade, given the flows' scaled features
+    void ScoreCascade(const FlowBatch& batch,
+                      size_t begin,
+                      size_t count,
+                      const float* scaled,
+                      FlowVerdict* verdicts,
+                      Scratch& scratch) const
+    {
+        std::vector<double>& isoScores = scratch.isoScores;
+        std::vector<uint8_t>& stages = scratch.stages;
+        isoScores.resize(count);
+        stages.resize(count);
+        m_cascade.Score(m_forest, scaled, count, isoScores.data(), stages.data());
+        for (size_t i = 0; i < count; i++)
+        {
+            verdicts[i].flowId = batch.flowId[begin + i];
+            verdicts[i].isoScore = isoScores[i];
+            verdicts[i].lofFactor = NAN;
+            verdicts[i].shouldBlock = isoScores[i] <= m_isoThreshold;
+            verdicts[i].modelTag = m_modelTag;
+            verdicts[i].stage = stages[i];
+            if (stages[i] == mlfw::STAGE_LOF && m_lof.IsLoaded())
+            {
+                double lofScaled[mlfw::N_FEATURES];
+                ExtractFeatures(batch, begin + i, 1, &m_lof.GetScaler(), lofScaled);
+                verdicts[i].lofFactor = m_lof.Factor(lofScaled);
+                verdicts[i].shouldBlock = verdicts[i].lofFactor >= m_lofThreshold;
+            }
+        }
+    }
+
+    static std::string JoinFeatureNames(const std::vector<std::string>& names)
+    {
+        std::string joined;
+        for (const std::string& name : names)
+        {
+            joined += name + "\n";
+        }
+        return joined;
+    }
+
+    // Model feature names, one per line
+    static std::string GetFeatureNames()
+    {
+        std::vector<std::string> names;
+        for (uint32_t f = 0; f < mlfw::N_FEATURES; f++)
+        {
+            names.push_back(mlfw::GetFeatureName(f));
+        }
+        return JoinFeatureNames(names);
+    }
+
+    IsolationForest m_forest;
+    QuantizedForest m_quantized; // built from m_forest by UseQuantizedForest()
+    ForestCascade m_cascade;     // built for m_forest by UseCascade()
+    const CompiledForest* m_compiled = nullptr; // set by UseCompiledForest()
+    LocalOutlierFactor m_lof;
+    double m_isoThreshold = NAN;
+    double m_lofThreshold = NAN;
+    std::string m_modelVersion;
+    std::string m_trainingDate;
+    bool m_pruned = false;      // by PruneForest()
+    uint32_t m_prunedDepth = 0; // levels PruneForest() kept, 0 if none were cut
+    uint32_t m_modelTag = 0;
+};
+
+#endif // ML_FIREWALL_NATIVE_H
@@ -0,0 +1,190 @@
+// Online Half-Space Trees against the offline Isolation Forest, scenario by
+// scenario.
+//
+//   g++ -O2 -std=c++17 -o ml-firewall-online ml-firewall-online.cc
+//   ./ml-firewall-online [-r ROWS] [-w WINDOW] [-c CONTAMINATION] Dataset/*.csv
+//
+// Plays the CSVs one after the other as a stream of regimes: ROWS flows per
+// file (2000 by default), drawn from its rows and perturbed. Each flow is
+// scored by the offline forest and by HalfSpaceTrees, which then learns it
+// with a reference window of WINDOW flows (256 by default). For each file
+// it reports the AUC of both scores against the Label column, the share of
+// flows each flags (the forest at iso_threshold; the detector at 0, which
+// flags CONTAMINATION of a steady stream, 0.05 by default) and the rank
+// correlation between the two scores; then the same for a fresh detector fed
+// all files interleaved. Ends with the cost of an update and the detector's
+// memory.
+//
+// Attacks make up a large share of most files, so within one regime the
+// detector soon learns them as ordinary: expect its AUC to fall well below
+// the forest's there. On the interleaved stream it ranks attacks better than
+// chance but below the forest, which was trained on labeled scenarios.
+
+#include "ml-firewall-dataset.h"
+#include "ml-firewall-native.h"
+#include "ml-firewall-online.h"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+
+// Rank of each value, ties sharing their mean rank
+std::vector<double>
+Ranks(const std::vector<double>& values)
+{
+    std::vector<size_t> order(values.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return values[a] < values[b];
+    });
+    std::vector<double> ranks(values.size());
+    for (size_t i = 0; i < order.size();)
+    {
+        size_t j = i;
+        while (j < order.size() && values[order[j]] == values[order[i]])
+        {
+            j++;
+        }
+        for (size_t k = i; k < j; k++)
+        {
+            ranks[order[k]] = (i + j - 1) / 2.0;
+        }
+        i = j;
+    }
+    return ranks;
+}
+
+// Spearman's rank correlation of a and b
+double
+RankCorrelation(const std::vector<double>& a, const std::vector<double>& b)
+{
+    std::vector<double> ra = Ranks(a), rb = Ranks(b);
+    double n = ra.size(), mean = (n - 1) / 2;
+    double ab = 0.0, aa = 0.0, bb = 0.0;
+    for (size_t i = 0; i < ra.size(); i++)
+    {
+        ab += (ra[i] - mean) * (rb[i] - mean);
+        aa += (ra[i] - mean) * (ra[i] - mean);
+        bb += (rb[i] - mean) * (rb[i] - mean);
+    }
+    return aa > 0 && bb > 0 ? ab / std::sqrt(aa * bb) : 0.0;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    uint32_t rows = 2000;
+    uint32_t window = 256;
+    double contamination = 0.05;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            rows = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+        {
+            window = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            contamination = std::strtod(argv[++i], nullptr);
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    NativeScorer offline;
+    if (paths.empty() || rows == 0 ||
+        !offline.Load("saved_models/isolation_forest.txt", "saved_models/model_metadata.json"))
+    {
+        std::cerr << "usage: " << argv[0]
+                  << " [-r ROWS] [-w WINDOW] [-c CONTAMINATION] FLOWS.csv... "
+                  << "(run from the repository root after export_models.py)" << std::endl;
+        return 2;
+    }
+    double threshold = offline.GetIsoThreshold();
+    HalfSpaceTrees online(mlfw::N_FEATURES, 25, 8, window, contamination);
+    std::cout << "Half-Space Trees: " << online.GetTrees() << " trees, depth "
+              << online.GetDepth() << ", window " << online.GetWindow() << ", contamination "
+              << contamination << "; " << rows << " flows per file" << std::endl;
+    std::cout << std::left << std::setw(34) << "file" << std::right << std::setw(12)
+              << "online AUC" << std::setw(13) << "offline AUC" << std::setw(11) << "online %"
+              << std::setw(12) << "offline %" << std::setw(8) << "rank r" << std::endl;
+
+    // Streams count flows drawn from flows through detector and prints a row
+    std::mt19937_64 rng(42);
+    std::chrono::nanoseconds updating{0};
+    auto play = [&](const std::string& name,
+                    const std::vector<LabeledFlow>& flows,
+                    uint64_t count,
+                    HalfSpaceTrees& detector) {
+        std::uniform_int_distribution<size_t> pick(0, flows.size() - 1);
+        std::vector<double> onlineScores, offlineScores;
+        std::vector<int> labels;
+        uint32_t onlineFlagged = 0, offlineFlagged = 0;
+        for (uint64_t r = 0; r < count; r++)
+        {
+            const LabeledFlow& flow = flows[pick(rng)];
+            FlowQuery q = flow.query;
+            mlfw::PerturbFlow(q, rng);
+            double features[mlfw::N_FEATURES];
+            ComputeModelFeatures(q, features);
+
+            auto start = std::chrono::steady_clock::now();
+            double score = detector.Update(features);
+            updating += std::chrono::steady_clock::now() - start;
+            if (std::isnan(score))
+            {
+                continue; // first window
+            }
+            double reference = offline.IsoScore(q);
+            onlineScores.push_back(score);
+            offlineScores.push_back(reference);
+            labels.push_back(flow.label);
+            onlineFlagged += score <= 0;
+            offlineFlagged += reference <= threshold;
+        }
+        size_t scored = std::max<size_t>(1, labels.size());
+        std::cout << std::left << std::setw(34) << name << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(12)
+                  << mlfw::RocAuc(onlineScores, labels) << std::setw(13)
+                  << mlfw::RocAuc(offlineScores, labels) << std::setprecision(1)
+                  << std::setw(11) << 100.0 * onlineFlagged / scored << std::setw(12)
+                  << 100.0 * offlineFlagged / scored << std::setprecision(3) << std::setw(8)
+                  << RankCorrelation(onlineScores, offlineScores) << std::defaultfloat
+                  << std::endl;
+    };
+
+    std::vector<LabeledFlow> all;
+    for (const std::string& path : paths)
+    {
+        std::vector<LabeledFlow> flows;
+        if (!LoadFlowCsv(path, flows) || flows.empty())
+        {
+            std::cerr << "Cannot read " << path << std::endl;
+            return 2;
+        }
+        play(path.substr(path.find_last_of('/') + 1), flows, rows, online);
+        all.insert(all.end(), flows.begin(), flows.end());
+    }
+    // A fresh detector on the files mixed, the regime the offline forest
+    // was trained on
+    HalfSpaceTrees mixed(mlfw::N_FEATURES, 25, 8, window, contamination);
+    play("(all files interleaved)", all, uint64_t(rows) * paths.size(), mixed);
+
+    uint64_t observations = online.GetObservations() + mixed.GetObservations();
+    std::cout << "Update: " << double(updating.count()) / observations << " ns/flow over "
+              << observations << " flows; memory " << online.GetMemoryBytes() << " bytes"
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,291 @@
+#ifndef ML_FIREWALL_ONLINE_H
+#define ML_FIREWALL_ONLINE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Streaming anomaly detector that learns while it scores: Half-Space Trees
+// (Tan, Ting and Liu, 2011). Each tree halves a random feature's work range
+// at every level down to a fixed depth, so the trees are built once and only
+// count observations afterwards. Every node holds two counts: the mass of the
+// reference window, which scores, and the mass of the window being
+// filled. When a window of observations is complete it becomes the
+// reference and the counts start over, so the model follows drift with a
+// lag of one window and never holds more than two windows of counts.
+//
+// Update() scores an observation against the reference and counts it, in
+// O(trees x depth). Every window it also rescores the window's observations
+// to calibrate: the scores are shaped like sklearn's score_samples (-0.5 at
+// the window's mean mass, towards -1 for an isolated observation) and
+// DecisionFunction() subtracts the contamination quantile of the window's
+// scores, as IsolationForest's offset_ does: on a steady stream, about that
+// share of observations score at or below 0.
+//
+// The first window only fixes the work ranges, from the features' extremes
+// in it; scores are NaN until it is complete. Features are compressed with
+// log1p so that counters and rates spanning decades split by order of
+// magnitude.
+class HalfSpaceTrees
+{
+  public:
+    // Features beyond this are ignored
+    static const uint32_t MAX_FEATURES = 64;
+
+    HalfSpaceTrees(uint32_t features,
+                   uint32_t trees = 25,
+                   uint32_t depth = 8,
+                   uint32_t window = 256,
+                   double contamination = 0.1,
+                   uint64_t seed = 1)
+        : m_features(std::min(features, MAX_FEATURES)),
+          m_trees(std::max<uint32_t>(1, trees)),
+          m_depth(std::min<uint32_t>(std::max<uint32_t>(1, depth), 20)),
+          m_window(std::max<uint32_t>(2, window)),
+          m_contamination(contamination),
+          m_rng(seed)
+    {
+        m_nodesPerTree = (2u << m_depth) - 1;
+        m_sizeLimit = std::max(1.0, 0.1 * m_window);
+        m_pending.reserve(m_window * m_features);
+    }
+
+    // Scores x (features values), then learns it. Returns the decision
+    // function x had before it was learned, NaN during the first window.
+    double Update(const double* x)
+    {
+        double point[MAX_FEATURES];
+        Compress(x, point);
+        double score = IsReady() ? ScoreSamples(Mass(point, m_latest.data())) - m_offset : NAN;
+        m_pending.insert(m_pending.end(), point, point + m_features);
+        m_observations++;
+        if (m_pending.size() == size_t(m_window) * m_features)
+        {
+            CloseWindow();
+        }
+        return score;
+    }
+
+    // Decision function of x against the reference window without learning
+    // it: negative for outliers, lower is more anomalous. NaN until the
+    // first window is complete.
+    double DecisionFunction(const double* x) const
+    {
+        if (!IsReady())
+        {
+            return NAN;
+        }
+        double point[MAX_FEATURES];
+        Compress(x, point);
+        return ScoreSamples(Mass(point, nullptr)) - m_offset;
+    }
+
+    bool IsReady() const
+    {
+        return !m_split.empty();
+    }
+
+    uint64_t GetObservations() const
+    {
+        return m_observations;
+    }
+
+    // Windows that have become the reference
+    uint64_t GetWindows() const
+    {
+        return m_windows;
+    }
+
+    // Contamination quantile of the reference window's scores
+    double GetOffset() const
+    {
+        return m_offset;
+    }
+
+    uint32_t GetTrees() const
+    {
+        return m_trees;
+    }
+
+    uint32_t GetDepth() const
+    {
+        return m_depth;
+    }
+
+    uint32_t GetWindow() const
+    {
+        return m_window;
+    }
+
+    // Bytes of node storage and pending window; fixed once the trees are built
+    size_t GetMemoryBytes() const
+    {
+        size_t node = sizeof(uint8_t) + sizeof(double) + 2 * sizeof(uint32_t);
+        return m_split.size() * node + m_pending.capacity() * sizeof(double);
+    }
+
+  private:
+    void Compress(const double* x, double* point) const
+    {
+        for (uint32_t f = 0; f < m_features; f++)
+        {
+            point[f] = std::copysign(std::log1p(std::fabs(x[f])), x[f]);
+        }
+    }
+
+    // Builds the trees over work ranges that cover the first window with
+    // room to spare: around a random point of each feature's observed range,
+    // twice its distance to the farther extreme on either side
+    void Build()
+    {
+        std::vector<double> low(m_features), high(m_features);
+        for (uint32_t f = 0; f < m_features; f++)
+        {
+            double lo = INFINITY, hi = -INFINITY;
+            for (size_t i = f; i < m_pending.size(); i += m_features)
+            {
+                lo = std::min(lo, m_pending[i]);
+                hi = std::max(hi, m_pending[i]);
+            }
+            std::uniform_real_distribution<double> pick(lo, std::nextafter(hi, INFINITY));
+            double centre = pick(m_rng);
+            double reach = 2 * std::max({centre - lo, hi - centre, 1e-9});
+            low[f] = centre - reach;
+            high[f] = centre + reach;
+        }
+        size_t nodes = size_t(m_trees) * m_nodesPerTree;
+        m_splitFeature.assign(nodes, 0);
+        m_split.assign(nodes, 0.0);
+        m_reference.assign(nodes, 0);
+        m_latest.assign(nodes, 0);
+        for (uint32_t t = 0; t < m_trees; t++)
+        {
+            BuildNode(t * m_nodesPerTree, 0, 0, low, high);
+        }
+    }
+
+    // Node n of the tree starting at base, as a heap: children 2n+1, 2n+2
+    void BuildNode(size_t base,
+                   uint32_t n,
+                   uint32_t level,
+                   std::vector<double>& low,
+                   std::vector<double>& high)
+    {
+        if (level == m_depth)
+        {
+            return;
+        }
+        uint32_t f = std::uniform_int_distribution<uint32_t>(0, m_features - 1)(m_rng);
+        double split = (low[f] + high[f]) / 2;
+        m_splitFeature[base + n] = f;
+        m_split[base + n] = split;
+        double saved = high[f];
+        high[f] = split;
+        BuildNode(base, 2 * n + 1, level + 1, low, high);
+        high[f] = saved;
+        saved = low[f];
+        low[f] = split;
+        BuildNode(base, 2 * n + 2, level + 1, low, high);
+        low[f] = saved;
+    }
+
+    // Tan et al.'s mass profile of point in the reference window: the mean
+    // over the trees of mass * 2^level at the node where its path leaves
+    // the part of the reference holding m_sizeLimit observations or more.
+    // The deeper and fuller that node, the more ordinary the point. With
+    // latest, the walk goes on to the leaf and adds point to those counts.
+    double Mass(const double* point, uint32_t* latest) const
+    {
+        double sum = 0.0;
+        for (uint32_t t = 0; t < m_trees; t++)
+        {
+            size_t base = size_t(t) * m_nodesPerTree;
+            uint32_t n = 0;
+            bool scored = false;
+            for (uint32_t level = 0;; level++)
+            {
+                if (!scored && (level == m_depth || m_reference[base + n] < m_sizeLimit))
+                {
+                    sum += std::ldexp(double(m_reference[base + n]), level);
+                    scored = true;
+                    if (!latest)
+                    {
+                        break;
+                    }
+                }
+                if (latest)
+                {
+                    latest[base + n]++;
+                }
+                if (level == m_depth)
+                {
+                    break;
+                }
+                n = 2 * n + 1 + (point[m_splitFeature[base + n]] >= m_split[base + n]);
+            }
+        }
+        return sum / m_trees;
+    }
+
+    // score_samples analogue: -0.5 at the window's mean mass
+    double ScoreSamples(double mass) const
+    {
+        return -std::pow(2.0, -(mass / m_meanMass));
+    }
+
+    // Makes the filled window the reference and recalibrates on it
+    void CloseWindow()
+    {
+        if (!IsReady())
+        {
+            Build();
+            for (size_t i = 0; i < m_pending.size(); i += m_features)
+            {
+                Mass(&m_pending[i], m_latest.data());
+            }
+        }
+        m_reference.swap(m_latest);
+        std::fill(m_latest.begin(), m_latest.end(), 0);
+
+        std::vector<double> masses;
+        double sum = 0.0;
+        for (size_t i = 0; i < m_pending.size(); i += m_features)
+        {
+            masses.push_back(Mass(&m_pending[i], nullptr));
+            sum += masses.back();
+        }
+        m_meanMass = std::max(sum / masses.size(), 1e-9);
+        std::vector<double> scores;
+        for (double mass : masses)
+        {
+            scores.push_back(ScoreSamples(mass));
+        }
+        size_t rank = std::min(scores.size() - 1, size_t(m_contamination * scores.size()));
+        std::nth_element(scores.begin(), scores.begin() + rank, scores.end());
+        m_offset = scores[rank];
+        m_pending.clear();
+        m_windows++;
+    }
+
+    uint32_t m_features;
+    uint32_t m_trees;
+    uint32_t m_depth;
+    uint32_t m_window;
+    double m_contamination;
+    std::mt19937_64 m_rng;
+    uint32_t m_nodesPerTree;
+    double m_sizeLimit;                  // nodes with less reference mass end a scoring walk
+    std::vector<uint8_t> m_splitFeature; // per node, trees one after the other
+    std::vector<double> m_split;         // values at or above go right
+    std::vector<uint32_t> m_reference;   // mass of the reference window
+    std::vector<uint32_t> m_latest;      // mass of the window being filled
+    std::vector<double> m_pending;       // compressed observations of that window
+    double m_meanMass = 1.0;
+    double m_offset = -0.5;
+    uint64_t m_observations = 0;
+    uint64_t m_windows = 0;
+};
+
+#endif // ML_FIREWALL_ONLINE_H
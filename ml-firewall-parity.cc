@@ -0,0 +1,130 @@
+// Checks the native Isolation Forest and LOF against sklearn on the flow CSVs.
+//
+//   python3 export_models.py --reference model-reference.csv
+//   g++ -O2 -std=c++17 -o ml-firewall-parity ml-firewall-parity.cc
+//   ./ml-firewall-parity model-reference.csv Dataset/*.csv
+//
+// Every row is scored by NativeScorer and compared with the scores sklearn
+// gave it. Exits with status 1 if any block decision of the forest, or any
+// LOF outlier decision at lof_threshold, differs.
+
+#include "ml-firewall-dataset.h"
+#include "ml-firewall-native.h"
+
+#include <chrono>
+#include <iostream>
+#include <map>
+
+int
+main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " REFERENCE.csv FLOWS.csv..." << std::endl;
+        return 2;
+    }
+
+    NativeScorer scorer;
+    if (!scorer.Load("saved_models/isolation_forest.txt", "saved_models/model_metadata.json") ||
+        !scorer.LoadLof("saved_models/lof_model.txt"))
+    {
+        std::cerr << "Cannot load saved_models/isolation_forest.txt and lof_model.txt "
+                  << "(run export_models.py)" << std::endl;
+        return 2;
+    }
+
+    // "file,row" -> sklearn decision_function and -score_samples of the LOF
+    std::map<std::string, std::pair<double, double>> reference;
+    std::ifstream refFile(argv[1]);
+    std::string line;
+    std::getline(refFile, line);
+    while (std::getline(refFile, line))
+    {
+        size_t lofComma = line.rfind(',');
+        size_t isoComma = lofComma != std::string::npos && lofComma > 0
+                              ? line.rfind(',', lofComma - 1)
+                              : std::string::npos;
+        if (isoComma != std::string::npos)
+        {
+            reference[line.substr(0, isoComma)] = {
+                std::strtod(line.c_str() + isoComma + 1, nullptr),
+                std::strtod(line.c_str() + lofComma + 1, nullptr)};
+        }
+    }
+
+    uint32_t flows = 0, blocked = 0, missing = 0, mismatches = 0;
+    uint32_t lofOutliers = 0, lofMismatches = 0;
+    double maxError = 0.0, maxLofError = 0.0;
+    std::chrono::nanoseconds elapsed(0);
+    for (int i = 2; i < argc; i++)
+    {
+        std::vector<LabeledFlow> rows;
+        if (!LoadFlowCsv(argv[i], rows))
+        {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 2;
+        }
+
+        std::string name = argv[i];
+        name = name.substr(name.find_last_of('/') + 1);
+        for (size_t row = 0; row < rows.size(); row++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            FlowVerdict verdict;
+            scorer.Score(rows[row].query, verdict);
+            elapsed += std::chrono::steady_clock::now() - start;
+
+            flows++;
+            blocked += verdict.shouldBlock;
+            auto ref = reference.find(name + "," + std::to_string(row));
+            if (ref == reference.end())
+            {
+                missing++;
+                continue;
+            }
+            double isoScore = scorer.IsoScore(rows[row].query);
+            double refIsoScore = ref->second.first;
+            maxError = std::max(maxError, std::fabs(isoScore - refIsoScore));
+            if (verdict.shouldBlock != (refIsoScore <= scorer.GetIsoThreshold()))
+            {
+                mismatches++;
+                std::cout << "MISMATCH " << name << " row " << row << ": native " << isoScore
+                          << ", sklearn " << refIsoScore << std::endl;
+            }
+
+            // sklearn's brute-force distances carry rounding error of their
+            // own, so factors agree to a relative 1e-8 or so. The training set
+            // has many duplicate samples; when copies tie for the k-th
+            // neighbor sklearn may keep another copy, whose lrd can differ.
+            double lofFactor = scorer.LofFactor(rows[row].query);
+            double refLofFactor = ref->second.second;
+            bool lofOutlier = lofFactor >= scorer.GetLofThreshold();
+            lofOutliers += lofOutlier;
+            maxLofError = std::max(maxLofError,
+                                   std::fabs(lofFactor - refLofFactor) / std::fabs(refLofFactor));
+            if (lofOutlier != (refLofFactor >= scorer.GetLofThreshold()))
+            {
+                lofMismatches++;
+                std::cout << "LOF MISMATCH " << name << " row " << row << ": native "
+                          << lofFactor << ", sklearn " << refLofFactor << std::endl;
+            }
+        }
+    }
+
+    const IsolationForest& forest = scorer.GetForest();
+    std::cout << "Forest: " << forest.GetTrees() << " trees, " << forest.GetNodes()
+              << " nodes, iso_threshold " << scorer.GetIsoThreshold() << std::endl;
+    std::cout << "Flows: " << flows << " (" << blocked << " blocked), " << missing
+              << " without reference" << std::endl;
+    std::cout << "Decision mismatches: " << mismatches << ", max |score error| " << maxError
+              << std::endl;
+    const LocalOutlierFactor& lof = scorer.GetLof();
+    std::cout << "LOF: " << lof.GetSamples() << " samples, " << lof.GetNeighbors()
+              << " neighbors, lof_threshold " << scorer.GetLofThreshold() << ", "
+              << lofOutliers << " outliers" << std::endl;
+    std::cout << "LOF mismatches: " << lofMismatches << ", max relative factor error "
+              << maxLofError << std::endl;
+    std::cout << "Native scoring: " << (flows > 0 ? elapsed.count() / flows : 0) << " ns/flow"
+              << std::endl;
+    return mismatches > 0 || lofMismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+#ifndef ML_FIREWALL_POOL_H
+#define ML_FIREWALL_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Fixed set of threads for data-parallel loops over independent items.
+// ParallelFor() cuts [0, count) into chunks and deals them out in contiguous
+// runs, one run per thread. Each thread takes chunks from the front of its
+// own queue and, once that is empty, steals from the back of another's, so a
+// thread held up by expensive items leaves the rest of its run to the others.
+// The queues are short and the chunks coarse, so one mutex per queue is
+// enough.
+//
+// The calling thread works too and ParallelFor() returns once every chunk
+// has run. Chunks run in no particular order and on no particular thread:
+// tasks write their results at the items' indices, so what the caller reads
+// afterwards does not depend on the schedule.
+class WorkStealingPool
+{
+  public:
+    // Runs items [begin, end)
+    typedef std::function<void(size_t begin, size_t end)> RangeTask;
+
+    // threads counts the caller; 0 = one per hardware thread
+    explicit WorkStealingPool(uint32_t threads = 0)
+    {
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (uint32_t t = 0; t < threads; t++)
+        {
+            m_queues.emplace_back(new Queue());
+        }
+        for (uint32_t t = 1; t < threads; t++)
+        {
+            m_workers.emplace_back(&WorkStealingPool::Work, this, t);
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Runs task over [0, count) in chunks of grain items and waits for all
+    // of them. Not reentrant: task must not call ParallelFor().
+    void ParallelFor(size_t count, size_t grain, const RangeTask& task)
+    {
+        grain = std::max<size_t>(1, grain);
+        size_t chunks = (count + grain - 1) / grain;
+        if (chunks <= 1 || m_workers.empty())
+        {
+            if (count > 0)
+            {
+                task(0, count);
+            }
+            return;
+        }
+
+        m_task = &task;
+        m_remaining.store(chunks);
+        size_t threads = m_queues.size();
+        for (size_t t = 0; t < threads; t++)
+        {
+            // Run t: chunks [chunks * t / threads, chunks * (t + 1) / threads)
+            std::lock_guard<std::mutex> lock(m_queues[t]->mutex);
+            for (size_t c = chunks * t / threads; c < chunks * (t + 1) / threads; c++)
+            {
+                m_queues[t]->ranges.emplace_back(c * grain, std::min(count, (c + 1) * grain));
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        while (RunChunk(0))
+        {
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_remaining.load() == 0; });
+        m_task = nullptr;
+    }
+
+    // Threads that run chunks, the caller included
+    uint32_t GetThreads() const
+    {
+        return m_queues.size();
+    }
+
+    // Chunks run by a thread other than the one they were dealt to
+    uint64_t GetSteals() const
+    {
+        return m_steals.load();
+    }
+
+  private:
+    typedef std::pair<size_t, size_t> Range;
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    // Runs one chunk, from thread self's queue or stolen from another's.
+    // Returns false if every queue is empty.
+    bool RunChunk(size_t self)
+    {
+        Range range;
+        bool found = Pop(self, true, range);
+        for (size_t v = 1; !found && v < m_queues.size(); v++)
+        {
+            found = Pop((self + v) % m_queues.size(), false, range);
+            m_steals += found;
+        }
+        if (!found)
+        {
+            return false;
+        }
+        (*m_task)(range.first, range.second);
+        if (m_remaining.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done.notify_all();
+        }
+        return true;
+    }
+
+    bool Pop(size_t q, bool front, Range& range)
+    {
+        Queue& queue = *m_queues[q];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.ranges.empty())
+        {
+            return false;
+        }
+        range = front ? queue.ranges.front() : queue.ranges.back();
+        if (front)
+        {
+            queue.ranges.pop_front();
+        }
+        else
+        {
+            queue.ranges.pop_back();
+        }
+        return true;
+    }
+
+    void Work(size_t self)
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stopping || m_generation != seen; });
+                if (m_stopping)
+                {
+                    return;
+                }
+                seen = m_generation;
+            }
+            while (RunChunk(self))
+            {
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues; // one per thread, the caller's first
+    std::vector<std::thread> m_workers;
+    const RangeTask* m_task = nullptr; // of the ParallelFor() in progress
+    std::atomic<size_t> m_remaining{0}; // its chunks not yet finished
+    std::atomic<uint64_t> m_steals{0};
+    std::mutex m_mutex;
+    std::condition_variable m_wake; // a ParallelFor() has dealt its chunks
+    std::condition_variable m_done; // its last chunk has finished
+    uint64_t m_generation = 0;
+    bool m_stopping = false;
+};
+
+#endif // ML_FIREWALL_POOL_H
@@ -0,0 +1,236 @@
+// Checks a running scorer through the firewall clients, end to end.
+//
+//   g++ -O2 -std=c++17 -pthread -o ml-firewall-probe ml-firewall-probe.cc
+//   ./ml-firewall-probe [-x tcp|unix|shm] [-s PATH] [-p PORT] [-n FLOWS] Dataset/*.csv
+//
+// Scores the flows of the CSVs through the scorer at 127.0.0.1:PORT (8888
+// by default), or over the unix or shm transport at PATH as
+// ml-firewall-server -u and -m serve them, as the simulation would, in every
+// way the clients talk to it: MLFirewallClient one flow per round trip and in
+// batches, and MLFirewallAsyncClient pipelined, each on JSON and on the binary
+// protocol the hello negotiates (binary only over shm). The time per flow of
+// each mode is reported. The first FLOWS flows (2000 by default) are used. Every
+// verdict must come from the scorer with the scores NativeScorer gives the
+// flow in-process, the LOF factor included when saved_models/lof_model.txt
+// exists. Exits with status 1 if any does not, or a mode lost its scores.
+
+#include "ml-firewall-async-client.h"
+#include "ml-firewall-dataset.h"
+#include "ml-firewall-native.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+
+// Scores travel as floats
+const double SCORE_TOLERANCE = 1e-5;
+
+// The flow as a scorer reads it from a binary record: its counters carry
+// float precision, which can move it to another branch of a tree
+FlowQuery
+RoundToRecord(FlowQuery q)
+{
+    q.txPackets = float(q.txPackets);
+    q.rxPackets = float(q.rxPackets);
+    q.txBytes = float(q.txBytes);
+    q.rxBytes = float(q.rxBytes);
+    q.duration = float(q.duration);
+    q.throughput = float(q.throughput);
+    q.packetLoss = float(q.packetLoss);
+    q.delay = float(q.delay);
+    q.jitter = float(q.jitter);
+    return q;
+}
+
+// Verdicts of one mode that are not what the in-process scorer gives
+struct Check
+{
+    uint32_t degraded = 0;
+    uint32_t missingScores = 0;
+    uint32_t scoreMismatches = 0;
+    double maxError = 0.0;
+
+    uint32_t GetFailures() const
+    {
+        return degraded + missingScores + scoreMismatches;
+    }
+};
+
+void
+Compare(const FlowVerdict& verdict, const FlowVerdict& expected, Check& check)
+{
+    if (verdict.degraded)
+    {
+        check.degraded++;
+        return;
+    }
+    if (std::isnan(verdict.isoScore) ||
+        (std::isnan(verdict.lofFactor) && !std::isnan(expected.lofFactor)))
+    {
+        check.missingScores++;
+        return;
+    }
+    double error = std::fabs(double(verdict.isoScore) - expected.isoScore);
+    if (!std::isnan(expected.lofFactor))
+    {
+        // Relative, as LOF factors of far outliers are large
+        double lofError = std::fabs(double(verdict.lofFactor) - expected.lofFactor);
+        error = std::max(error, lofError / std::max(1.0, std::fabs(double(expected.lofFactor))));
+    }
+    check.maxError = std::max(check.maxError, error);
+    check.scoreMismatches += error > SCORE_TOLERANCE;
+}
+
+void
+PrintMode(const char* mode, const Check& check, size_t flows, double seconds)
+{
+    std::cout << std::setw(22) << std::left << mode << std::right << std::setw(10) << std::fixed
+              << std::setprecision(2) << seconds * 1e6 / std::max<size_t>(1, flows)
+              << " us/flow  max error " << std::scientific << std::setprecision(1)
+              << check.maxError << std::defaultfloat;
+    if (check.GetFailures() > 0)
+    {
+        std::cout << "  FAILED: " << check.degraded << " degraded, " << check.missingScores
+                  << " without scores, " << check.scoreMismatches << " off";
+    }
+    std::cout << std::endl;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    std::string transport = "tcp";
+    std::string path;
+    FirewallEndpoint endpoint;
+    size_t maxFlows = 2000;
+    std::vector<LabeledFlow> flows;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+        {
+            transport = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        {
+            endpoint.port = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            maxFlows = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!LoadFlowCsv(argv[i], flows))
+        {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    NativeScorer scorer;
+    if (flows.empty() || !FirewallEndpoint::Parse(transport, path, endpoint) ||
+        !scorer.Load("saved_models/isolation_forest.txt", "saved_models/model_metadata.json"))
+    {
+        std::cerr << "usage: " << argv[0] << " [-x tcp|unix|shm] [-s PATH] [-p PORT] [-n FLOWS] "
+                  << "FLOWS.csv... "
+                  << "(run from the repository root after export_models.py)" << std::endl;
+        return 2;
+    }
+    scorer.LoadLof("saved_models/lof_model.txt");
+
+    std::vector<FlowQuery> queries;
+    for (size_t i = 0; i < flows.size() && i < maxFlows; i++)
+    {
+        queries.push_back(flows[i].query);
+        queries.back().flowId = i; // replies are matched by position, ids only label them
+    }
+    std::vector<FlowQuery> records;
+    for (const FlowQuery& q : queries)
+    {
+        records.push_back(RoundToRecord(q));
+    }
+    std::vector<FlowVerdict> jsonExpected(queries.size()), binaryExpected(queries.size());
+    scorer.ScoreBatch(queries.data(), queries.size(), jsonExpected.data());
+    scorer.ScoreBatch(records.data(), records.size(), binaryExpected.data());
+
+    std::cout << "Probing ";
+    if (endpoint.transport == TRANSPORT_TCP)
+    {
+        std::cout << endpoint.host << ":" << endpoint.port;
+    }
+    else
+    {
+        std::cout << transport << " " << endpoint.path;
+    }
+    std::cout << " with " << queries.size() << " flows" << std::endl;
+
+    uint32_t failures = 0;
+    for (MLFirewallClient::Protocol protocol :
+         {MLFirewallClient::PROTOCOL_JSON, MLFirewallClient::PROTOCOL_AUTO})
+    {
+        bool json = protocol == MLFirewallClient::PROTOCOL_JSON;
+        if (json && endpoint.transport == TRANSPORT_SHM)
+        {
+            continue;
+        }
+        const std::vector<FlowVerdict>& expected = json ? jsonExpected : binaryExpected;
+        std::vector<FlowVerdict> verdicts(queries.size());
+
+        Check single;
+        std::unique_ptr<MLFirewallClient> client(new MLFirewallClient(endpoint, 1, protocol));
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            client->Query(queries[i], verdicts[i]);
+        }
+        double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            Compare(verdicts[i], expected[i], single);
+        }
+        PrintMode(json ? "json round trip" : "binary round trip", single, queries.size(), seconds);
+
+        Check batch;
+        start = std::chrono::steady_clock::now();
+        client->QueryBatch(queries, verdicts);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            Compare(verdicts[i], expected[i], batch);
+        }
+        PrintMode(json ? "json batch" : "binary batch", batch, queries.size(), seconds);
+        client.reset(); // a ring pair admits one client at a time
+
+        Check pipelined;
+        {
+            MLFirewallAsyncClient async(endpoint, 4, 64, protocol);
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < queries.size(); i++)
+            {
+                FlowVerdict* verdict = &verdicts[i];
+                async.Submit(queries[i], [verdict](const FlowVerdict& v) { *verdict = v; });
+            }
+            async.Flush();
+            seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            Compare(verdicts[i], expected[i], pipelined);
+        }
+        PrintMode(json ? "json pipelined" : "binary pipelined", pipelined, queries.size(), seconds);
+
+        failures += single.GetFailures() + batch.GetFailures() + pipelined.GetFailures();
+    }
+
+    std::cout << (failures == 0 ? "All verdicts match" : "Verdicts differ") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
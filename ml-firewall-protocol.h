@@ -0,0 +1,260 @@
+#ifndef ML_FIREWALL_PROTOCOL_H
+#define ML_FIREWALL_PROTOCOL_H
+
+#include <cstdint>
+#include <cstring>
+#include <endian.h>
+#include <string>
+
+// Binary wire protocol spoken with the ML firewall scorer.
+//
+// Every message is a fixed 12-byte header followed by `count` fixed-size
+// records. All integers and floats are little-endian.
+//
+//   header:  magic "MLFW" | version u16 | type u16 | count u32
+//   request: FlowRecordV1 x count   (80 bytes each)
+//   reply:   VerdictRecordV1 x count (16 bytes each, in request order)
+//
+// A connection starts in the newline-delimited JSON protocol. The client
+// sends the JSON hello line {"hello":"mlfw","binaryVersion":1}; a scorer that
+// understands the binary protocol answers {"binaryVersion":1} and both sides
+// switch to binary frames. Any other reply leaves the connection on JSON.
+
+namespace mlfw
+{
+
+const uint32_t MAGIC = 0x57464c4d; // "MLFW" read as little-endian u32
+const uint16_t VERSION = 1;
+const uint16_t MSG_SCORE_REQUEST = 1;
+const uint16_t MSG_SCORE_REPLY = 2;
+
+const size_t HEADER_SIZE = 12;
+const size_t FLOW_RECORD_SIZE = 80;
+const size_t VERDICT_RECORD_SIZE = 16;
+const uint32_t MAX_RECORDS_PER_MESSAGE = 65536;
+
+const char* const HELLO_LINE = "{\"hello\":\"mlfw\",\"binaryVersion\":1}";
+const char* const HELLO_ACK = "\"binaryVersion\":1";
+
+// Model features in the column order of saved_models/model_metadata.json
+enum Feature
+{
+    TX_PACKETS = 0,
+    RX_PACKETS,
+    TX_BYTES,
+    RX_BYTES,
+    DURATION,
+    THROUGHPUT,
+    PACKET_LOSS,
+    DELAY,
+    JITTER,
+    PACKET_DELIVERY_RATIO,
+    BYTE_DELIVERY_RATIO,
+    AVG_PACKET_SIZE,
+    THROUGHPUT_EFFICIENCY,
+    IS_WELL_KNOWN_PORT,
+    IS_WEB_PORT,
+    IS_SUSPICIOUS_PORT,
+    N_FEATURES
+};
+
+// Column name of a feature in feature_names of model_metadata.json
+inline const char*
+GetFeatureName(uint32_t feature)
+{
+    static const char* const names[N_FEATURES] = {"TxPackets",
+                                                  "RxPackets",
+                                                  "TxBytes",
+                                                  "RxBytes",
+                                                  "Duration",
+                                                  "Throughput",
+                                                  "PacketLoss",
+                                                  "Delay",
+                                                  "Jitter",
+                                                  "PacketDeliveryRatio",
+                                                  "ByteDeliveryRatio",
+                                                  "AvgPacketSize",
+                                                  "ThroughputEfficiency",
+                                                  "IsWellKnownPort",
+                                                  "IsWebPort",
+                                                  "IsSuspiciousPort"};
+    return feature < N_FEATURES ? names[feature] : "";
+}
+
+// District ids carried in FlowRecordV1, indexed by GetDistrictName()
+enum District : uint8_t
+{
+    DISTRICT_CORE = 0,
+    DISTRICT_HOME,
+    DISTRICT_OFFICE,
+    DISTRICT_UNIVERSITY,
+    DISTRICT_IOT,
+    DISTRICT_HOSPITAL,
+    DISTRICT_POWER_GRID,
+    DISTRICT_FINANCE,
+    N_DISTRICTS
+};
+
+inline const char*
+GetDistrictName(uint8_t district)
+{
+    static const char* const names[N_DISTRICTS] =
+        {"Core", "Home", "Office", "University", "IoT", "Hospital", "PowerGrid", "Finance"};
+    return district < N_DISTRICTS ? names[district] : names[DISTRICT_CORE];
+}
+
+inline uint8_t
+GetDistrictId(const std::string& name)
+{
+    for (uint8_t i = 0; i < N_DISTRICTS; i++)
+    {
+        if (name == GetDistrictName(i))
+            return i;
+    }
+    return DISTRICT_CORE;
+}
+
+// Flow features as sent on the wire
+struct FlowRecordV1
+{
+    uint32_t flowId;
+    uint32_t srcAddress; // host byte order
+    uint32_t dstAddress;
+    uint16_t dstPort;
+    uint8_t district;
+    uint8_t reserved;
+    float features[N_FEATURES];
+};
+
+// Verdict for one flow as sent on the wire
+struct VerdictRecordV1
+{
+    uint32_t flowId;
+    float isoScore;  // IsolationForest decision_function, lower is more anomalous
+    float lofFactor; // LOF outlier factor, higher is more anomalous
+    uint8_t shouldBlock;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+inline void
+PutU16(uint8_t* p, uint16_t v)
+{
+    v = htole16(v);
+    std::memcpy(p, &v, sizeof(v));
+}
+
+inline void
+PutU32(uint8_t* p, uint32_t v)
+{
+    v = htole32(v);
+    std::memcpy(p, &v, sizeof(v));
+}
+
+inline void
+PutF32(uint8_t* p, float f)
+{
+    uint32_t v;
+    std::memcpy(&v, &f, sizeof(v));
+    PutU32(p, v);
+}
+
+inline uint16_t
+GetU16(const uint8_t* p)
+{
+    uint16_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return le16toh(v);
+}
+
+inline uint32_t
+GetU32(const uint8_t* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return le32toh(v);
+}
+
+inline float
+GetF32(const uint8_t* p)
+{
+    uint32_t v = GetU32(p);
+    float f;
+    std::memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+inline void
+EncodeHeader(uint8_t* p, uint16_t type, uint32_t count)
+{
+    PutU32(p, MAGIC);
+    PutU16(p + 4, VERSION);
+    PutU16(p + 6, type);
+    PutU32(p + 8, count);
+}
+
+// Returns false if the header is not a version 1 message of the given type
+inline bool
+DecodeHeader(const uint8_t* p, uint16_t expectedType, uint32_t& count)
+{
+    if (GetU32(p) != MAGIC || GetU16(p + 4) != VERSION || GetU16(p + 6) != expectedType)
+        return false;
+    count = GetU32(p + 8);
+    return count <= MAX_RECORDS_PER_MESSAGE;
+}
+
+inline void
+EncodeFlowRecord(uint8_t* p, const FlowRecordV1& r)
+{
+    PutU32(p, r.flowId);
+    PutU32(p + 4, r.srcAddress);
+    PutU32(p + 8, r.dstAddress);
+    PutU16(p + 12, r.dstPort);
+    p[14] = r.district;
+    p[15] = 0;
+    for (int i = 0; i < N_FEATURES; i++)
+    {
+        PutF32(p + 16 + 4 * i, r.features[i]);
+    }
+}
+
+inline void
+DecodeFlowRecord(const uint8_t* p, FlowRecordV1& r)
+{
+    r.flowId = GetU32(p);
+    r.srcAddress = GetU32(p + 4);
+    r.dstAddress = GetU32(p + 8);
+    r.dstPort = GetU16(p + 12);
+    r.district = p[14];
+    r.reserved = 0;
+    for (int i = 0; i < N_FEATURES; i++)
+    {
+        r.features[i] = GetF32(p + 16 + 4 * i);
+    }
+}
+
+inline void
+EncodeVerdictRecord(uint8_t* p, const VerdictRecordV1& v)
+{
+    PutU32(p, v.flowId);
+    PutF32(p + 4, v.isoScore);
+    PutF32(p + 8, v.lofFactor);
+    p[12] = v.shouldBlock;
+    p[13] = v.flags;
+    PutU16(p + 14, 0);
+}
+
+inline void
+DecodeVerdictRecord(const uint8_t* p, VerdictRecordV1& v)
+{
+    v.flowId = GetU32(p);
+    v.isoScore = GetF32(p + 4);
+    v.lofFactor = GetF32(p + 8);
+    v.shouldBlock = p[12];
+    v.flags = p[13];
+    v.reserved = 0;
+}
+
+} // namespace mlfw
+
+#endif // ML_FIREWALL_PROTOCOL_H
@@ -0,0 +1,188 @@
+#ifndef ML_FIREWALL_QUANTIZED_H
+#define ML_FIREWALL_QUANTIZED_H
+
+#include "ml-firewall-forest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// IsolationForest with 16-bit split thresholds and 8-byte nodes.
+//
+// The thresholds a feature is split on are sorted into a table of cuts, and
+// each threshold is replaced by its rank in that table. A flow's feature
+// value is coded as the number of cuts below it, so value > threshold
+// exactly when code > rank: the codes decide every split as the float32
+// thresholds do, and scores are bit-identical to IsolationForest's. Flows
+// pay one binary search per feature to be coded; in exchange a node packs
+// into 8 bytes instead of 12, one load per level instead of three, and the
+// walk compares integers. Path lengths are summed in tree order as
+// IsolationForest does.
+//
+// There is no SIMD kernel: on AVX2/AVX-512 machines the float32 gather
+// kernels stay faster, and the codes pay off for one flow at a time.
+class QuantizedForest
+{
+  public:
+    // Codes the splits of forest. Returns false if it is not loaded, has
+    // more than 64 features, or a feature is split at more than 65534
+    // distinct thresholds.
+    bool Build(const IsolationForest& forest)
+    {
+        *this = QuantizedForest();
+        uint32_t features = forest.GetFeatures();
+        if (!forest.IsLoaded() || features > 64)
+        {
+            return false;
+        }
+
+        // Distinct thresholds of each feature, ascending
+        std::vector<std::vector<float>> cuts(features);
+        uint32_t nodes = forest.GetNodes();
+        for (uint32_t n = 0; n < nodes; n++)
+        {
+            IsolationForest::Node node = forest.GetNode(n);
+            if (node.left != n)
+            {
+                cuts[node.feature].push_back(node.threshold);
+            }
+        }
+        m_cutBegin.push_back(0);
+        for (std::vector<float>& c : cuts)
+        {
+            std::sort(c.begin(), c.end());
+            c.erase(std::unique(c.begin(), c.end()), c.end());
+            if (c.size() >= LEAF_CODE)
+            {
+                *this = QuantizedForest();
+                return false;
+            }
+            m_cuts.insert(m_cuts.end(), c.begin(), c.end());
+            m_cutBegin.push_back(m_cuts.size());
+        }
+
+        for (uint32_t n = 0; n < nodes; n++)
+        {
+            IsolationForest::Node node = forest.GetNode(n);
+            PackedNode packed;
+            packed.left = node.left;
+            if (node.left == n)
+            {
+                packed.code = LEAF_CODE; // no value codes above it
+                packed.feature = 0;
+            }
+            else
+            {
+                const std::vector<float>& c = cuts[node.feature];
+                packed.code = std::lower_bound(c.begin(), c.end(), node.threshold) - c.begin();
+                packed.feature = node.feature;
+            }
+            m_nodes.push_back(packed);
+            m_pathLength.push_back(node.pathLength);
+        }
+        for (uint32_t t = 0; t < forest.GetTrees(); t++)
+        {
+            m_treeRoot.push_back(forest.GetTreeRoot(t));
+            m_treeDepth.push_back(forest.GetTreeDepth(t));
+        }
+        m_offset = forest.GetOffset();
+        m_denominator = forest.GetDenominator();
+        m_features = features;
+        return true;
+    }
+
+    bool IsBuilt() const
+    {
+        return !m_treeRoot.empty();
+    }
+
+    // Codes of one flow's scaled features: the number of cuts below each
+    void Encode(const float* x, uint16_t* codes) const
+    {
+        for (uint32_t f = 0; f < m_features; f++)
+        {
+            // Branch-free lower bound: the halving steps depend on the
+            // number of cuts only, so no step is mispredicted
+            const float* base = m_cuts.data() + m_cutBegin[f];
+            uint32_t n = m_cutBegin[f + 1] - m_cutBegin[f];
+            while (n > 1)
+            {
+                uint32_t half = n / 2;
+                base = base[half - 1] < x[f] ? base + half : base;
+                n -= half;
+            }
+            codes[f] = (base - (m_cuts.data() + m_cutBegin[f])) + (n == 1 && *base < x[f]);
+        }
+    }
+
+    // decision_function of one flow's scaled features, as
+    // IsolationForest::DecisionFunction()
+    double DecisionFunction(const float* x) const
+    {
+        uint16_t codes[64];
+        Encode(x, codes);
+        const PackedNode* nodes = m_nodes.data();
+        double depth = 0.0;
+        for (size_t t = 0; t < m_treeRoot.size(); t++)
+        {
+            uint32_t node = m_treeRoot[t];
+            for (uint32_t level = 0; level < m_treeDepth[t]; level++)
+            {
+                const PackedNode& p = nodes[node];
+                node = p.left + (codes[p.feature] > p.code);
+            }
+            depth += m_pathLength[node];
+        }
+        return Normalize(depth);
+    }
+
+    // Scores count flows whose scaled features are stored row after row in x
+    void DecisionFunctionBatch(const float* x, size_t count, double* scores) const
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            scores[i] = DecisionFunction(x + i * m_features);
+        }
+    }
+
+    uint32_t GetCuts() const
+    {
+        return m_cuts.size();
+    }
+
+    // Bytes of node storage and cut tables a walk reads from
+    size_t GetModelBytes() const
+    {
+        size_t node = sizeof(PackedNode) + sizeof(double);
+        return m_nodes.size() * node + m_cuts.size() * sizeof(float);
+    }
+
+  private:
+    static const uint16_t LEAF_CODE = 0xffff;
+
+    // As IsolationForest::Normalize()
+    double Normalize(double depth) const
+    {
+        return -std::pow(2.0, -(depth / m_denominator)) - m_offset;
+    }
+
+    struct PackedNode
+    {
+        uint16_t code;    // rank of the threshold among the feature's cuts
+        uint16_t feature;
+        uint32_t left;    // leaves: the node itself
+    };
+
+    uint32_t m_features = 0;
+    double m_offset = 0.0;
+    double m_denominator = 1.0;
+    std::vector<float> m_cuts;         // per feature, ascending
+    std::vector<uint32_t> m_cutBegin;  // features + 1 offsets into m_cuts
+    std::vector<PackedNode> m_nodes;
+    std::vector<double> m_pathLength;
+    std::vector<uint32_t> m_treeRoot;
+    std::vector<uint32_t> m_treeDepth;
+};
+
+#endif // ML_FIREWALL_QUANTIZED_H
@@ -0,0 +1,181 @@
+#ifndef ML_FIREWALL_RELOAD_H
+#define ML_FIREWALL_RELOAD_H
+
+#include "ml-firewall-native.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+
+// Native scorer that follows a model bundle as it is replaced. A background
+// thread checks the bundle path every interval; when a new file appears
+// there (ml-firewall-bundle renames it into place) it is mapped, checksummed
+// and prepared on that thread, then published with one atomic pointer store.
+//
+// Readers take the current model with Acquire() and score a whole batch with
+// it. The swap never waits for them: a batch in flight finishes on the model
+// it started with, and a replaced model is unmapped when its last reader lets
+// go, as with RCU. A bundle that fails to load is counted and skipped; the
+// current model stays in service. Verdicts carry the tag of the model that
+// produced them.
+class ModelReloader
+{
+  public:
+    // Called on each freshly loaded model before it is published, e.g. to
+    // build an approximate LOF index; returning false rejects the model
+    typedef std::function<bool(NativeScorer&)> Prepare;
+
+    ModelReloader(const std::string& path,
+                  std::chrono::milliseconds interval = std::chrono::milliseconds(1000),
+                  Prepare prepare = nullptr)
+        : m_path(path),
+          m_interval(interval),
+          m_prepare(prepare)
+    {
+    }
+
+    ~ModelReloader()
+    {
+        Stop();
+    }
+
+    ModelReloader(const ModelReloader&) = delete;
+    ModelReloader& operator=(const ModelReloader&) = delete;
+
+    // Loads the bundle now and starts watching it. Returns false, without
+    // watching, if the first load fails.
+    bool Start()
+    {
+        if (!Reload() && !Acquire())
+        {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_watcher.joinable() && m_interval.count() > 0)
+        {
+            m_stopping = false;
+            m_watcher = std::thread(&ModelReloader::Watch, this);
+        }
+        return true;
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        if (m_watcher.joinable())
+        {
+            m_watcher.join();
+        }
+    }
+
+    // The model in service; null before the first successful load
+    std::shared_ptr<const NativeScorer> Acquire() const
+    {
+        return std::atomic_load(&m_current);
+    }
+
+    // Loads the bundle if the file at the path is not the one in service.
+    // Returns true if a new model was published.
+    bool Reload()
+    {
+        std::lock_guard<std::mutex> lock(m_reloadMutex);
+        FileId id;
+        if (!Identify(id) || (Acquire() && id == m_loaded))
+        {
+            return false;
+        }
+        m_loaded = id; // a broken file is not retried until it changes
+        std::shared_ptr<NativeScorer> scorer = std::make_shared<NativeScorer>();
+        if (!scorer->LoadBundle(m_path) || (m_prepare && !m_prepare(*scorer)))
+        {
+            m_failures++;
+            return false;
+        }
+        std::atomic_store(&m_current, std::shared_ptr<const NativeScorer>(scorer));
+        m_swaps++;
+        return true;
+    }
+
+    const std::string& GetPath() const
+    {
+        return m_path;
+    }
+
+    // Models published, the first one included
+    uint32_t GetSwaps() const
+    {
+        return m_swaps;
+    }
+
+    // Bundles that could not be loaded
+    uint32_t GetFailures() const
+    {
+        return m_failures;
+    }
+
+  private:
+    // A file at the path: writing a new bundle always gives a new inode
+    struct FileId
+    {
+        dev_t device = 0;
+        ino_t inode = 0;
+        off_t size = 0;
+        int64_t modified = 0; // ns
+
+        bool operator==(const FileId& other) const
+        {
+            return device == other.device && inode == other.inode && size == other.size &&
+                   modified == other.modified;
+        }
+    };
+
+    bool Identify(FileId& id) const
+    {
+        struct stat st;
+        if (stat(m_path.c_str(), &st) != 0)
+        {
+            return false;
+        }
+        id.device = st.st_dev;
+        id.inode = st.st_ino;
+        id.size = st.st_size;
+        id.modified = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        return true;
+    }
+
+    void Watch()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_wake.wait_for(lock, m_interval, [this] { return m_stopping; }))
+        {
+            lock.unlock();
+            Reload();
+            lock.lock();
+        }
+    }
+
+    std::string m_path;
+    std::chrono::milliseconds m_interval;
+    Prepare m_prepare;
+    std::shared_ptr<const NativeScorer> m_current; // only accessed atomically
+    std::mutex m_reloadMutex;                      // one load at a time
+    FileId m_loaded;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+    std::thread m_watcher;
+    std::atomic<uint32_t> m_swaps{0};
+    std::atomic<uint32_t> m_failures{0};
+};
+
+#endif // ML_FIREWALL_RELOAD_H
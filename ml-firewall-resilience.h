@@ -0,0 +1,203 @@
+#ifndef ML_FIREWALL_RESILIENCE_H
+#define ML_FIREWALL_RESILIENCE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// Time bounds on talking to the ML firewall scorer. Every attempt has a
+// deadline, failed attempts are retried a bounded number of times with
+// exponential backoff, and a circuit breaker stops contacting a scorer that
+// keeps failing. Flows that get no verdict from the scorer are scored by the
+// client's fallback and marked degraded.
+//
+// Worst case, one chunk of flows costs
+//   (maxRetries + 1) * timeoutMs + sum of the backoffs
+// before falling back, and once budgetMs of wall time has passed since the
+// first query every remaining flow is answered by the fallback at once.
+
+typedef std::chrono::steady_clock FirewallClock;
+
+struct FirewallPolicy
+{
+    uint32_t timeoutMs = 250;          // per attempt: connect, send and receive (0 = none)
+    uint32_t maxRetries = 2;           // further attempts after a failed one
+    uint32_t backoffMs = 10;           // wait before the second retry, doubled after
+    uint32_t maxBackoffMs = 200;       // cap on a single backoff
+    uint32_t breakerThreshold = 5;     // consecutive failures that open the breaker (0 = never)
+    uint32_t breakerCooldownMs = 2000; // open time before a single probe is let through
+    uint32_t budgetMs = 0;             // total wall time for scorer traffic (0 = unlimited)
+
+    // Backoff before retry number `retry` (1-based). The first retry goes out
+    // immediately: it usually replaces a pooled connection the scorer closed
+    // while idle.
+    FirewallClock::duration Backoff(uint32_t retry) const
+    {
+        if (retry <= 1)
+        {
+            return FirewallClock::duration::zero();
+        }
+        uint64_t ms = uint64_t(backoffMs) << std::min<uint32_t>(retry - 2, 20);
+        return std::chrono::milliseconds(std::min<uint64_t>(ms, maxBackoffMs));
+    }
+};
+
+namespace mlfw
+{
+
+// Milliseconds left until deadline, rounded up and clamped to [0, capMs].
+// A deadline of time_point::max() means no deadline and yields capMs.
+inline int
+RemainingMs(FirewallClock::time_point deadline, int capMs = 1 << 30)
+{
+    if (deadline == FirewallClock::time_point::max())
+    {
+        return capMs;
+    }
+    auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - FirewallClock::now());
+    return std::max<int>(0, std::min<int64_t>(left.count(), capMs));
+}
+
+} // namespace mlfw
+
+// Hands out attempt deadlines within the policy's overall time budget, which
+// starts with the first attempt. Safe to share between threads.
+class FirewallBudget
+{
+  public:
+    explicit FirewallBudget(const FirewallPolicy& policy)
+        : m_timeout(std::chrono::milliseconds(policy.timeoutMs)),
+          m_budget(std::chrono::milliseconds(policy.budgetMs))
+    {
+    }
+
+    // Sets deadline for an attempt starting now (time_point::max() if
+    // unbounded). Returns false once the budget is spent.
+    bool NextDeadline(FirewallClock::time_point& deadline)
+    {
+        FirewallClock::time_point now = FirewallClock::now();
+        deadline = m_timeout.count() > 0 ? now + m_timeout : FirewallClock::time_point::max();
+        if (m_budget.count() == 0)
+        {
+            return true;
+        }
+
+        std::call_once(m_started, [this, now] { m_end = now + m_budget; });
+        deadline = std::min(deadline, m_end);
+        return now < m_end;
+    }
+
+  private:
+    FirewallClock::duration m_timeout;
+    FirewallClock::duration m_budget;
+    std::once_flag m_started;
+    FirewallClock::time_point m_end;
+};
+
+// Closed: requests flow. After `threshold` consecutive failures it opens and
+// rejects requests for `cooldown`, then lets a single probe through
+// (half-open); the probe's outcome closes or re-opens it. Latch() opens it for
+// good once the time budget is spent. Safe to share between threads.
+class CircuitBreaker
+{
+  public:
+    CircuitBreaker(uint32_t threshold, uint32_t cooldownMs)
+        : m_threshold(threshold),
+          m_cooldown(std::chrono::milliseconds(cooldownMs))
+    {
+    }
+
+    // Returns true if a request may be sent now
+    bool Allow()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        switch (m_state)
+        {
+        case CLOSED:
+            return true;
+        case OPEN:
+            if (!m_latched && FirewallClock::now() >= m_openedAt + m_cooldown)
+            {
+                m_state = HALF_OPEN;
+                return true;
+            }
+            return false;
+        case HALF_OPEN:
+            return false; // a probe is already out
+        }
+        return false;
+    }
+
+    void RecordSuccess()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_consecutiveFailures = 0;
+        if (!m_latched)
+        {
+            m_state = CLOSED;
+        }
+    }
+
+    void RecordFailure()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_consecutiveFailures++;
+        if (m_state == HALF_OPEN ||
+            (m_state == CLOSED && m_threshold > 0 && m_consecutiveFailures >= m_threshold))
+        {
+            Open();
+        }
+    }
+
+    void Latch()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_latched)
+        {
+            m_latched = true;
+            if (m_state != OPEN)
+            {
+                Open();
+            }
+        }
+    }
+
+    bool IsOpen() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_state != CLOSED;
+    }
+
+    uint32_t GetTrips() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_trips;
+    }
+
+  private:
+    enum State
+    {
+        CLOSED,
+        OPEN,
+        HALF_OPEN
+    };
+
+    void Open()
+    {
+        m_state = OPEN;
+        m_openedAt = FirewallClock::now();
+        m_trips++;
+    }
+
+    uint32_t m_threshold;
+    FirewallClock::duration m_cooldown;
+    mutable std::mutex m_mutex;
+    State m_state = CLOSED;
+    FirewallClock::time_point m_openedAt;
+    uint32_t m_consecutiveFailures = 0;
+    uint32_t m_trips = 0;
+    bool m_latched = false;
+};
+
+#endif // ML_FIREWALL_RESILIENCE_H
@@ -0,0 +1,980 @@
+// Native ML firewall scorer: serves the protocol MLFirewallClient speaks,
+// in place of the Python service.
+//
+//   python3 export_models.py
+//   g++ -O2 -std=c++17 -pthread -o ml-firewall-server ml-firewall-server.cc
+//   ./ml-firewall-server [-a ADDRESS] [-p PORT] [-t THREADS] [-b BUNDLE] [-u PATH] [-m NAME]
+//
+// Listens on ADDRESS:PORT (127.0.0.1:8888 by default) with one thread per
+// core (THREADS, 0 by default). Each thread owns a listening socket bound
+// with SO_REUSEPORT, so the kernel spreads connections across threads, and
+// an epoll loop serving its connections. With -u the threads also accept
+// connections on a SOCK_SEQPACKET socket at PATH (TRANSPORT_UNIX), and with
+// -m a thread of its own serves the client attached to the shared-memory ring
+// pair NAME (TRANSPORT_SHM, binary frames only). A connection starts on the
+// newline-delimited JSON protocol: one flow object per line answered by
+// {"flowId":...,"shouldBlock":...,"isoScore":...,"lofFactor":...}, or
+// {"batch":[...]} answered by {"shouldBlock":[...],"isoScore":[...],
+// "lofFactor":[...]} in request order. The hello line of
+// ml-firewall-protocol.h switches it to binary frames.
+//
+// Requests are parsed in place in the connection's receive buffer, and each
+// thread scores them in buffers of its own (NativeScorer::Scratch); buffers
+// grow to the largest message seen and are then reused.
+// Flows are scored in-process by NativeScorer, the Isolation Forest and the
+// LOF when saved_models/lof_model.txt exists (or the models of BUNDLE), one
+// scorer shared read-only by every thread. Block decisions are the forest's,
+// as the service's are. Stops on SIGINT or SIGTERM and prints what each
+// thread served.
+
+#include "ml-firewall-native.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+// Largest message a connection may buffer: a full binary frame of
+// MAX_RECORDS_PER_MESSAGE flows fits, and so does a JSON batch of them. A
+// connection is not read while more replies than this wait to be sent.
+const size_t MAX_MESSAGE_BYTES = 32 << 20;
+
+std::atomic<bool> g_stopping{false};
+
+void
+Stop(int)
+{
+    g_stopping = true;
+}
+
+// Reads JSON in place from [p, end). Strings are views into the input, so
+// escapes are left as they are; the protocol's strings have none.
+struct JsonCursor
+{
+    const char* p;
+    const char* end;
+
+    void SkipSpace()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        {
+            p++;
+        }
+    }
+
+    bool Consume(char c)
+    {
+        SkipSpace();
+        if (p < end && *p == c)
+        {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    bool String(std::string_view& s)
+    {
+        if (!Consume('"'))
+        {
+            return false;
+        }
+        const char* begin = p;
+        while (p < end && *p != '"')
+        {
+            p += *p == '\\' ? 2 : 1;
+        }
+        if (p >= end)
+        {
+            return false;
+        }
+        s = std::string_view(begin, p - begin);
+        p++;
+        return true;
+    }
+
+    bool Number(double& v)
+    {
+        SkipSpace();
+        std::from_chars_result result = std::from_chars(p, end, v);
+        if (result.ec != std::errc())
+        {
+            return false;
+        }
+        p = result.ptr;
+        return true;
+    }
+
+    // Skips a string, number or literal
+    bool SkipValue()
+    {
+        SkipSpace();
+        std::string_view s;
+        double v;
+        if (p < end && *p == '"')
+        {
+            return String(s);
+        }
+        for (const char* literal : {"true", "false", "null"})
+        {
+            size_t n = std::strlen(literal);
+            if (size_t(end - p) >= n && std::memcmp(p, literal, n) == 0)
+            {
+                p += n;
+                return true;
+            }
+        }
+        return Number(v);
+    }
+};
+
+// Host-order address of a dotted quad
+bool
+ParseAddress(std::string_view s, uint32_t& address)
+{
+    address = 0;
+    const char* p = s.data();
+    const char* end = p + s.size();
+    for (int octet = 0; octet < 4; octet++)
+    {
+        unsigned value;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc() || value > 255 || (octet < 3 && result.ptr == end) ||
+            (octet < 3 && *result.ptr != '.'))
+        {
+            return false;
+        }
+        address = address << 8 | value;
+        p = result.ptr + (octet < 3);
+    }
+    return p == end;
+}
+
+uint8_t
+ParseDistrict(std::string_view name)
+{
+    for (uint8_t d = 0; d < mlfw::N_DISTRICTS; d++)
+    {
+        if (name == mlfw::GetDistrictName(d))
+        {
+            return d;
+        }
+    }
+    return mlfw::DISTRICT_CORE;
+}
+
+// One flow object as AppendJson() writes it; unknown keys are skipped
+bool
+ParseFlow(JsonCursor& json, FlowQuery& q)
+{
+    q = FlowQuery();
+    if (!json.Consume('{'))
+    {
+        return false;
+    }
+    if (json.Consume('}'))
+    {
+        return true;
+    }
+    do
+    {
+        std::string_view key, text;
+        double v = 0.0;
+        if (!json.String(key) || !json.Consume(':'))
+        {
+            return false;
+        }
+        if (key == "srcIP" || key == "dstIP")
+        {
+            if (!json.String(text) ||
+                !ParseAddress(text, key == "srcIP" ? q.srcAddress : q.dstAddress))
+            {
+                return false;
+            }
+        }
+        else if (key == "district")
+        {
+            if (!json.String(text))
+            {
+                return false;
+            }
+            q.district = ParseDistrict(text);
+        }
+        else if (key == "flowId" || key == "txPackets" || key == "rxPackets" ||
+                 key == "txBytes" || key == "rxBytes" || key == "duration" ||
+                 key == "throughput" || key == "packetLoss" || key == "delay" ||
+                 key == "jitter" || key == "dstPort")
+        {
+            if (!json.Number(v))
+            {
+                return false;
+            }
+            if (key == "flowId")
+                q.flowId = v;
+            else if (key == "txPackets")
+                q.txPackets = v;
+            else if (key == "rxPackets")
+                q.rxPackets = v;
+            else if (key == "txBytes")
+                q.txBytes = v;
+            else if (key == "rxBytes")
+                q.rxBytes = v;
+            else if (key == "duration")
+                q.duration = v;
+            else if (key == "throughput")
+                q.throughput = v;
+            else if (key == "packetLoss")
+                q.packetLoss = v;
+            else if (key == "delay")
+                q.delay = v;
+            else if (key == "jitter")
+                q.jitter = v;
+            else
+                q.dstPort = v;
+        }
+        else if (!json.SkipValue())
+        {
+            return false;
+        }
+    } while (json.Consume(','));
+    return json.Consume('}');
+}
+
+// Flow of a binary record. Its counters come back from the float features,
+// so they carry float precision, as they do for a scorer reading the record.
+FlowQuery
+QueryFromRecord(const mlfw::FlowRecordV1& r)
+{
+    FlowQuery q;
+    q.flowId = r.flowId;
+    q.srcAddress = r.srcAddress;
+    q.dstAddress = r.dstAddress;
+    q.dstPort = r.dstPort;
+    q.district = r.district;
+    q.txPackets = r.features[mlfw::TX_PACKETS];
+    q.rxPackets = r.features[mlfw::RX_PACKETS];
+    q.txBytes = r.features[mlfw::TX_BYTES];
+    q.rxBytes = r.features[mlfw::RX_BYTES];
+    q.duration = r.features[mlfw::DURATION];
+    q.throughput = r.features[mlfw::THROUGHPUT];
+    q.packetLoss = r.features[mlfw::PACKET_LOSS];
+    q.delay = r.features[mlfw::DELAY];
+    q.jitter = r.features[mlfw::JITTER];
+    return q;
+}
+
+void
+AppendNumber(std::string& out, double v)
+{
+    if (std::isnan(v))
+    {
+        out += "null";
+        return;
+    }
+    char text[32];
+    std::to_chars_result result = std::to_chars(text, text + sizeof(text), v);
+    out.append(text, result.ptr);
+}
+
+struct Connection
+{
+    int fd = -1;
+    bool seqpacket = false; // AF_UNIX SOCK_SEQPACKET: a recv must fit the whole message
+    bool binary = false;
+    bool writing = false; // waiting for EPOLLOUT
+    bool reading = true;  // waiting for EPOLLIN: few enough replies are unsent
+    std::vector<char> rx;
+    size_t rxBegin = 0; // first unprocessed byte
+    size_t rxEnd = 0;
+    std::string tx;
+    size_t txBegin = 0; // first unsent byte
+};
+
+// Serves the connections of one listening socket
+class Worker
+{
+  public:
+    Worker(const NativeScorer& scorer)
+        : m_scorer(scorer)
+    {
+    }
+
+    ~Worker()
+    {
+        for (auto& conn : m_connections)
+        {
+            close(conn.first);
+        }
+        if (m_listener >= 0)
+        {
+            close(m_listener);
+        }
+        if (m_epoll >= 0)
+        {
+            close(m_epoll);
+        }
+    }
+
+    // Binds a listening socket of its own to address:port, shared with the
+    // other workers through SO_REUSEPORT. Called before anything else.
+    bool Listen(const std::string& address, uint16_t port)
+    {
+        m_listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (m_listener < 0 || m_epoll < 0)
+        {
+            return false;
+        }
+        int one = 1;
+        setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(m_listener, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        struct sockaddr_in local;
+        std::memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons(port);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = m_listener;
+        return inet_pton(AF_INET, address.c_str(), &local.sin_addr) == 1 &&
+               bind(m_listener, (struct sockaddr*)&local, sizeof(local)) == 0 &&
+               listen(m_listener, SOMAXCONN) == 0 &&
+               epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listener, &event) == 0;
+    }
+
+    // Also accepts connections on the SOCK_SEQPACKET socket every worker
+    // shares; EPOLLEXCLUSIVE wakes one of them per connection
+    bool ListenUnix(int listener)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.fd = listener;
+        m_unixListener = listener;
+        return epoll_ctl(m_epoll, EPOLL_CTL_ADD, listener, &event) == 0;
+    }
+
+    void Run()
+    {
+        struct epoll_event events[256];
+        while (!g_stopping)
+        {
+            int n = epoll_wait(m_epoll, events, 256, 200);
+            for (int i = 0; i < n; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == m_listener || fd == m_unixListener)
+                {
+                    Accept(fd);
+                    continue;
+                }
+                auto it = m_connections.find(fd);
+                if (it == m_connections.end())
+                {
+                    continue;
+                }
+                Connection& conn = *it->second;
+                bool open = !(events[i].events & (EPOLLERR | EPOLLHUP));
+                if (open && (events[i].events & EPOLLIN))
+                {
+                    open = Receive(conn);
+                }
+                if (open)
+                {
+                    open = Flush(conn);
+                }
+                if (!open)
+                {
+                    Close(fd);
+                }
+            }
+        }
+    }
+
+    // Serves the client attached to the scorer side of a ring pair, in
+    // place of the epoll loop. Frames are answered as they are on a socket;
+    // the client reading its verdicts makes room for more.
+    void RunShm(mlfw::ShmRingPair& shm)
+    {
+        Connection conn;
+        conn.binary = true;
+        conn.rx.resize(65536);
+        while (!g_stopping)
+        {
+            if (shm.ClientWaiting())
+            {
+                // Drop what is left of earlier clients, down to a partial
+                // request, before the new one sends anything
+                conn.rxBegin = conn.rxEnd = conn.txBegin = 0;
+                conn.tx.clear();
+                shm.AcceptClient();
+                m_accepted++;
+            }
+
+            bool progress = false;
+            if (conn.tx.size() - conn.txBegin < MAX_MESSAGE_BYTES && Reserve(conn, 1))
+            {
+                size_t n = shm.TryRead(reinterpret_cast<uint8_t*>(conn.rx.data() + conn.rxEnd),
+                                       conn.rx.size() - conn.rxEnd);
+                conn.rxEnd += n;
+                progress = n > 0;
+                if (n > 0 && !Process(conn))
+                {
+                    // Nothing to close; skip what was received
+                    conn.rxBegin = conn.rxEnd = 0;
+                }
+            }
+            if (conn.txBegin < conn.tx.size())
+            {
+                size_t n =
+                    shm.TryWrite(reinterpret_cast<const uint8_t*>(conn.tx.data() + conn.txBegin),
+                                 conn.tx.size() - conn.txBegin);
+                conn.txBegin += n;
+                progress = progress || n > 0;
+                if (conn.txBegin == conn.tx.size())
+                {
+                    conn.tx.clear();
+                    conn.txBegin = 0;
+                }
+            }
+
+            if (!progress)
+            {
+                if (conn.tx.empty())
+                {
+                    shm.WaitReadable(200);
+                }
+                else
+                {
+                    shm.WaitWritable(200);
+                }
+            }
+        }
+    }
+
+    uint64_t GetConnections() const
+    {
+        return m_accepted;
+    }
+
+    uint64_t GetRequests() const
+    {
+        return m_requests;
+    }
+
+    uint64_t GetFlows() const
+    {
+        return m_flows;
+    }
+
+  private:
+    void Accept(int listener)
+    {
+        for (;;)
+        {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                return;
+            }
+            if (listener == m_listener)
+            {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+            {
+                close(fd);
+                continue;
+            }
+            std::unique_ptr<Connection> conn(new Connection());
+            conn->fd = fd;
+            conn->seqpacket = listener == m_unixListener;
+            conn->rx.resize(65536);
+            m_connections[fd] = std::move(conn);
+            m_accepted++;
+        }
+    }
+
+    void Close(int fd)
+    {
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        m_connections.erase(fd);
+    }
+
+    // Makes room for at least free more bytes after the received ones.
+    // Returns false if the message being received is too large.
+    bool Reserve(Connection& conn, size_t free)
+    {
+        if (conn.rx.size() - conn.rxEnd >= free)
+        {
+            return true;
+        }
+        // Keep the unprocessed bytes at the front; grow if they fill the
+        // buffer
+        std::memmove(conn.rx.data(), conn.rx.data() + conn.rxBegin, conn.rxEnd - conn.rxBegin);
+        conn.rxEnd -= conn.rxBegin;
+        conn.rxBegin = 0;
+        if (conn.rx.size() - conn.rxEnd < free)
+        {
+            if (conn.rx.size() >= MAX_MESSAGE_BYTES)
+            {
+                return false;
+            }
+            conn.rx.resize(std::max(conn.rx.size() * 2, conn.rxEnd + free));
+        }
+        return true;
+    }
+
+    // Reads what has arrived and answers every complete request. Returns
+    // false once the connection is closed or breaks the protocol.
+    bool Receive(Connection& conn)
+    {
+        for (;;)
+        {
+            if (conn.tx.size() - conn.txBegin >= MAX_MESSAGE_BYTES)
+            {
+                // The client is not reading its replies; Flush() stops
+                // reading until it does
+                return true;
+            }
+            if (!Reserve(conn, conn.seqpacket ? mlfw::SEQPACKET_MESSAGE_SIZE : 1))
+            {
+                return false;
+            }
+            ssize_t n = recv(conn.fd, conn.rx.data() + conn.rxEnd, conn.rx.size() - conn.rxEnd, 0);
+            if (n == 0)
+            {
+                return false;
+            }
+            if (n < 0)
+            {
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            }
+            conn.rxEnd += n;
+            if (!Process(conn))
+            {
+                return false;
+            }
+        }
+    }
+
+    // Answers the complete requests in the receive buffer
+    bool Process(Connection& conn)
+    {
+        for (;;)
+        {
+            const char* begin = conn.rx.data() + conn.rxBegin;
+            size_t available = conn.rxEnd - conn.rxBegin;
+            if (conn.binary)
+            {
+                uint32_t count;
+                if (available < mlfw::HEADER_SIZE)
+                {
+                    break;
+                }
+                if (!mlfw::DecodeHeader(reinterpret_cast<const uint8_t*>(begin),
+                                        mlfw::MSG_SCORE_REQUEST, count))
+                {
+                    return false;
+                }
+                size_t size = mlfw::HEADER_SIZE + count * mlfw::FLOW_RECORD_SIZE;
+                if (available < size)
+                {
+                    break;
+                }
+                AnswerFrame(conn, reinterpret_cast<const uint8_t*>(begin), count);
+                conn.rxBegin += size;
+            }
+            else
+            {
+                const char* newline =
+                    static_cast<const char*>(std::memchr(begin, '\n', available));
+                if (!newline)
+                {
+                    break;
+                }
+                AnswerLine(conn, begin, newline);
+                conn.rxBegin += newline - begin + 1;
+            }
+            m_requests++;
+        }
+        if (conn.rxBegin == conn.rxEnd)
+        {
+            conn.rxBegin = conn.rxEnd = 0;
+        }
+        return true;
+    }
+
+    void AnswerLine(Connection& conn, const char* begin, const char* end)
+    {
+        JsonCursor json{begin, end};
+        std::string_view key;
+        if (json.Consume('{') && json.String(key) && json.Consume(':'))
+        {
+            if (key == "hello")
+            {
+                // Switch only to the binary protocol this server speaks; a
+                // client asking for another stays on JSON
+                double version = 0.0;
+                bool valid = json.SkipValue();
+                while (valid && json.Consume(','))
+                {
+                    valid = json.String(key) && json.Consume(':') &&
+                            (key == "binaryVersion" ? json.Number(version) : json.SkipValue());
+                }
+                if (!valid || version != mlfw::VERSION)
+                {
+                    conn.tx += "{\"error\":\"unsupported binaryVersion\"}\n";
+                    return;
+                }
+                conn.tx += "{";
+                conn.tx += mlfw::HELLO_ACK;
+                conn.tx += "}\n";
+                conn.binary = true;
+                return;
+            }
+            if (key == "batch")
+            {
+                m_queries.clear();
+                bool valid = json.Consume('[');
+                if (valid && !json.Consume(']'))
+                {
+                    do
+                    {
+                        m_queries.emplace_back();
+                        valid = ParseFlow(json, m_queries.back());
+                    } while (valid && json.Consume(','));
+                    valid = valid && json.Consume(']');
+                }
+                if (!valid || !json.Consume('}'))
+                {
+                    conn.tx += "{\"error\":\"malformed batch\"}\n";
+                    return;
+                }
+                Score();
+                conn.tx += "{\"shouldBlock\":[";
+                for (size_t i = 0; i < m_queries.size(); i++)
+                {
+                    conn.tx += i == 0 ? "" : ",";
+                    conn.tx += m_verdicts[i].shouldBlock ? "true" : "false";
+                }
+                conn.tx += "],\"isoScore\":[";
+                for (size_t i = 0; i < m_queries.size(); i++)
+                {
+                    conn.tx += i == 0 ? "" : ",";
+                    AppendNumber(conn.tx, m_verdicts[i].isoScore);
+                }
+                conn.tx += "],\"lofFactor\":[";
+                for (size_t i = 0; i < m_queries.size(); i++)
+                {
+                    conn.tx += i == 0 ? "" : ",";
+                    AppendNumber(conn.tx, m_verdicts[i].lofFactor);
+                }
+                conn.tx += "]}\n";
+                return;
+            }
+        }
+
+        json = JsonCursor{begin, end};
+        m_queries.resize(1);
+        if (!ParseFlow(json, m_queries[0]))
+        {
+            conn.tx += "{\"error\":\"malformed request\"}\n";
+            return;
+        }
+        Score();
+        const FlowVerdict& verdict = m_verdicts[0];
+        conn.tx += "{\"flowId\":";
+        AppendNumber(conn.tx, verdict.flowId);
+        conn.tx += verdict.shouldBlock ? ",\"shouldBlock\":true" : ",\"shouldBlock\":false";
+        conn.tx += ",\"isoScore\":";
+        AppendNumber(conn.tx, verdict.isoScore);
+        conn.tx += ",\"lofFactor\":";
+        AppendNumber(conn.tx, verdict.lofFactor);
+        conn.tx += "}\n";
+    }
+
+    void AnswerFrame(Connection& conn, const uint8_t* frame, uint32_t count)
+    {
+        m_queries.resize(count);
+        mlfw::FlowRecordV1 record;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            mlfw::DecodeFlowRecord(frame + mlfw::HEADER_SIZE + i * mlfw::FLOW_RECORD_SIZE,
+                                   record);
+            m_queries[i] = QueryFromRecord(record);
+        }
+        Score();
+
+        size_t offset = conn.tx.size();
+        conn.tx.resize(offset + mlfw::HEADER_SIZE + count * mlfw::VERDICT_RECORD_SIZE);
+        uint8_t* p = reinterpret_cast<uint8_t*>(&conn.tx[offset]);
+        mlfw::EncodeHeader(p, mlfw::MSG_SCORE_REPLY, count);
+        mlfw::VerdictRecordV1 reply;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            reply.flowId = m_verdicts[i].flowId;
+            reply.isoScore = m_verdicts[i].isoScore;
+            reply.lofFactor = m_verdicts[i].lofFactor;
+            reply.shouldBlock = m_verdicts[i].shouldBlock;
+            reply.flags = 0;
+            mlfw::EncodeVerdictRecord(p + mlfw::HEADER_SIZE + i * mlfw::VERDICT_RECORD_SIZE,
+                                      reply);
+        }
+    }
+
+    // Scores m_queries into m_verdicts
+    void Score()
+    {
+        m_verdicts.resize(m_queries.size());
+        m_scorer.ScoreBatch(m_queries.data(), m_queries.size(), m_verdicts.data(), m_scratch);
+        m_flows += m_queries.size();
+    }
+
+    // Sends what it can of the replies; waits for EPOLLOUT while the socket
+    // is full. Returns false if the connection broke.
+    bool Flush(Connection& conn)
+    {
+        while (conn.txBegin < conn.tx.size())
+        {
+            size_t chunk = conn.tx.size() - conn.txBegin;
+            if (conn.seqpacket)
+            {
+                chunk = std::min(chunk, mlfw::SEQPACKET_MESSAGE_SIZE);
+            }
+            ssize_t n = send(conn.fd, conn.tx.data() + conn.txBegin, chunk, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            conn.txBegin += n;
+        }
+        if (conn.txBegin == conn.tx.size())
+        {
+            conn.tx.clear();
+            conn.txBegin = 0;
+        }
+        bool writing = !conn.tx.empty();
+        bool reading = conn.tx.size() - conn.txBegin < MAX_MESSAGE_BYTES;
+        if (writing != conn.writing || reading != conn.reading)
+        {
+            struct epoll_event event;
+            event.events = EPOLLRDHUP | (reading ? uint32_t(EPOLLIN) : 0u) |
+                           (writing ? uint32_t(EPOLLOUT) : 0u);
+            event.data.fd = conn.fd;
+            epoll_ctl(m_epoll, EPOLL_CTL_MOD, conn.fd, &event);
+            conn.writing = writing;
+            conn.reading = reading;
+        }
+        return true;
+    }
+
+    const NativeScorer& m_scorer;
+    int m_listener = -1;
+    int m_unixListener = -1; // shared, owned by main()
+    int m_epoll = -1;
+    std::unordered_map<int, std::unique_ptr<Connection>> m_connections;
+    std::vector<FlowQuery> m_queries; // of the request being answered
+    std::vector<FlowVerdict> m_verdicts;
+    NativeScorer::Scratch m_scratch; // what m_scorer scores in
+    uint64_t m_accepted = 0;
+    uint64_t m_requests = 0;
+    uint64_t m_flows = 0;
+};
+
+// Listening SOCK_SEQPACKET socket at path, replacing a stale one; -1 on
+// failure
+int
+ListenUnix(const std::string& path)
+{
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_un local;
+    std::memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    if (listener < 0 || path.size() >= sizeof(local.sun_path))
+    {
+        close(listener);
+        return -1;
+    }
+    std::strncpy(local.sun_path, path.c_str(), sizeof(local.sun_path) - 1);
+    unlink(path.c_str());
+    if (bind(listener, (struct sockaddr*)&local, sizeof(local)) != 0 ||
+        listen(listener, SOMAXCONN) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    std::string address = "127.0.0.1";
+    uint16_t port = 8888;
+    uint32_t threads = 0;
+    std::string bundlePath;
+    std::string unixPath;
+    std::string shmName;
+    bool valid = true;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+        {
+            address = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        {
+            port = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            threads = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            bundlePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+        {
+            unixPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+        {
+            shmName = argv[++i];
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+
+    NativeScorer scorer;
+    bool loaded =
+        bundlePath.empty()
+            ? scorer.Load("saved_models/isolation_forest.txt", "saved_models/model_metadata.json")
+            : scorer.LoadBundle(bundlePath);
+    if (!valid || !loaded)
+    {
+        std::cerr << "usage: " << argv[0] << " [-a ADDRESS] [-p PORT] [-t THREADS] [-b BUNDLE] "
+                  << "[-u PATH] [-m NAME] "
+                  << "(run from the repository root after export_models.py)" << std::endl;
+        return 2;
+    }
+    if (bundlePath.empty() && !scorer.LoadLof("saved_models/lof_model.txt"))
+    {
+        std::cout << "No LOF model; verdicts carry Isolation Forest scores only" << std::endl;
+    }
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    int unixListener = -1;
+    if (!unixPath.empty() && (unixListener = ListenUnix(unixPath)) < 0)
+    {
+        std::cerr << "Cannot listen on " << unixPath << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    mlfw::ShmRingPair shm;
+    if (!shmName.empty() && !shm.Create(shmName))
+    {
+        std::cerr << "Cannot create " << shmName << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        workers.emplace_back(new Worker(scorer));
+        if (!workers.back()->Listen(address, port))
+        {
+            std::cerr << "Cannot listen on " << address << ":" << port << ": "
+                      << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        if (unixListener >= 0 && !workers.back()->ListenUnix(unixListener))
+        {
+            std::cerr << "Cannot listen on " << unixPath << ": " << std::strerror(errno)
+                      << std::endl;
+            return 1;
+        }
+    }
+    std::signal(SIGINT, Stop);
+    std::signal(SIGTERM, Stop);
+    std::signal(SIGPIPE, SIG_IGN);
+    std::cout << "Serving " << address << ":" << port << " with " << threads
+              << " threads; Isolation Forest of " << scorer.GetForest().GetTrees() << " trees"
+              << (scorer.GetLof().IsLoaded() ? " and LOF" : "") << ", model "
+              << scorer.GetModelVersion() << std::endl;
+    if (unixListener >= 0)
+    {
+        std::cout << "Serving " << unixPath << std::endl;
+    }
+    if (shm.IsOpen())
+    {
+        std::cout << "Serving shared memory " << shmName << std::endl;
+    }
+
+    std::vector<std::thread> running;
+    for (auto& worker : workers)
+    {
+        running.emplace_back(&Worker::Run, worker.get());
+    }
+    Worker shmWorker(scorer);
+    if (shm.IsOpen())
+    {
+        running.emplace_back(&Worker::RunShm, &shmWorker, std::ref(shm));
+    }
+    for (std::thread& thread : running)
+    {
+        thread.join();
+    }
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        std::cout << "Thread " << t << ": " << workers[t]->GetConnections() << " connections, "
+                  << workers[t]->GetRequests() << " requests, " << workers[t]->GetFlows()
+                  << " flows" << std::endl;
+    }
+    if (shm.IsOpen())
+    {
+        std::cout << "Shared memory: " << shmWorker.GetConnections() << " clients, "
+                  << shmWorker.GetRequests() << " requests, " << shmWorker.GetFlows() << " flows"
+                  << std::endl;
+    }
+    if (unixListener >= 0)
+    {
+        close(unixListener);
+        unlink(unixPath.c_str());
+    }
+    return 0;
+}
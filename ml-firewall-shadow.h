@@ -0,0 +1,222 @@
+#ifndef ML_FIREWALL_SHADOW_H
+#define ML_FIREWALL_SHADOW_H
+
+#include "ml-firewall-native.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Verdicts of the model in service and of the candidate for one flow
+struct ShadowComparison
+{
+    FlowVerdict production;
+    FlowVerdict candidate;
+
+    bool Disagrees() const
+    {
+        return production.shouldBlock != candidate.shouldBlock;
+    }
+};
+
+// Scores the flows the firewall has decided with a candidate model, off the
+// verdict path, to see how it would have decided them before it is
+// promoted. Submit() copies the flows and their production verdicts into a
+// queue and returns; a thread of its own scores the queue in batches with
+// the candidate and keeps the latest comparison of every flow. Production
+// never waits for the candidate: when the queue is full, flows are dropped
+// and counted instead.
+//
+// Degraded production verdicts are not compared, as they come from the
+// fallback and not from a model. The candidate is only read, so it may be
+// shared with other threads.
+class ShadowScorer
+{
+  public:
+    explicit ShadowScorer(std::shared_ptr<const NativeScorer> candidate,
+                          size_t maxPending = 1 << 16,
+                          size_t batchSize = 256)
+        : m_candidate(candidate),
+          m_maxPending(maxPending),
+          m_batchSize(std::max<size_t>(1, batchSize)),
+          m_worker(&ShadowScorer::Work, this)
+    {
+    }
+
+    // Scores what is still queued first
+    ~ShadowScorer()
+    {
+        Drain();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        m_worker.join();
+    }
+
+    ShadowScorer(const ShadowScorer&) = delete;
+    ShadowScorer& operator=(const ShadowScorer&) = delete;
+
+    // Queues count flows with the verdicts production gave them
+    void Submit(const FlowQuery* queries, const FlowVerdict* verdicts, size_t count)
+    {
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t i = 0; i < count; i++)
+            {
+                if (verdicts[i].degraded)
+                {
+                    continue;
+                }
+                if (m_queries.size() >= m_maxPending)
+                {
+                    m_dropped++;
+                    continue;
+                }
+                m_queries.push_back(queries[i]);
+                m_verdicts.push_back(verdicts[i]);
+            }
+            m_submitTime += std::chrono::steady_clock::now() - start;
+        }
+        m_wake.notify_one();
+    }
+
+    // Waits until every queued flow has been compared
+    void Drain()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this] { return m_queries.empty() && !m_busy; });
+    }
+
+    // Latest comparison of the flow; false if it was never compared
+    bool GetComparison(uint32_t flowId, ShadowComparison& comparison) const
+    {
+        std::lock_guard<std::mutex> lock(m_resultsMutex);
+        auto it = m_comparisons.find(flowId);
+        if (it == m_comparisons.end())
+        {
+            return false;
+        }
+        comparison = it->second;
+        return true;
+    }
+
+    const NativeScorer& GetCandidate() const
+    {
+        return *m_candidate;
+    }
+
+    // Flow verdicts compared, every submission of a flow counting
+    uint64_t GetCompared() const
+    {
+        std::lock_guard<std::mutex> lock(m_resultsMutex);
+        return m_compared;
+    }
+
+    // Comparisons in which the candidate decided otherwise
+    uint64_t GetDisagreements() const
+    {
+        std::lock_guard<std::mutex> lock(m_resultsMutex);
+        return m_disagreements;
+    }
+
+    // Flows not compared because the queue was full
+    uint64_t GetDropped() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dropped;
+    }
+
+    // Time callers spent in Submit(), the cost to the verdict path
+    double GetSubmitSeconds() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return std::chrono::duration<double>(m_submitTime).count();
+    }
+
+    // Time the candidate spent scoring, on the shadow thread
+    double GetScoreSeconds() const
+    {
+        std::lock_guard<std::mutex> lock(m_resultsMutex);
+        return std::chrono::duration<double>(m_scoreTime).count();
+    }
+
+  private:
+    void Work()
+    {
+        std::vector<FlowQuery> queries;
+        std::vector<FlowVerdict> production;
+        std::vector<FlowVerdict> candidate;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            m_wake.wait(lock, [this] { return m_stopping || !m_queries.empty(); });
+            if (m_queries.empty())
+            {
+                return;
+            }
+            queries.swap(m_queries);
+            production.swap(m_verdicts);
+            m_queries.clear();
+            m_verdicts.clear();
+            m_busy = true;
+            lock.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+            candidate.resize(queries.size());
+            for (size_t begin = 0; begin < queries.size(); begin += m_batchSize)
+            {
+                m_candidate->ScoreBatch(&queries[begin],
+                                        std::min(m_batchSize, queries.size() - begin),
+                                        &candidate[begin]);
+            }
+            auto scored = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> results(m_resultsMutex);
+                for (size_t i = 0; i < queries.size(); i++)
+                {
+                    ShadowComparison& comparison = m_comparisons[queries[i].flowId];
+                    comparison.production = production[i];
+                    comparison.candidate = candidate[i];
+                    m_disagreements += comparison.Disagrees();
+                }
+                m_compared += queries.size();
+                m_scoreTime += scored - start;
+            }
+
+            lock.lock();
+            m_busy = false;
+            if (m_queries.empty())
+            {
+                m_idle.notify_all();
+            }
+        }
+    }
+
+    std::shared_ptr<const NativeScorer> m_candidate;
+    size_t m_maxPending;
+    size_t m_batchSize;
+    mutable std::mutex m_mutex; // the queue, held only briefly so Submit() does not wait
+    std::condition_variable m_wake; // flows queued, or stopping
+    std::condition_variable m_idle; // the queue is empty and nothing is being scored
+    std::vector<FlowQuery> m_queries; // queued, with their production verdicts
+    std::vector<FlowVerdict> m_verdicts;
+    bool m_busy = false;
+    bool m_stopping = false;
+    std::chrono::steady_clock::duration m_submitTime{0};
+    uint64_t m_dropped = 0;
+    mutable std::mutex m_resultsMutex; // what follows
+    std::unordered_map<uint32_t, ShadowComparison> m_comparisons; // by flow id
+    uint64_t m_compared = 0;
+    uint64_t m_disagreements = 0;
+    std::chrono::steady_clock::duration m_scoreTime{0};
+    std::thread m_worker; // last, so it starts once the rest is constructed
+};
+
+#endif // ML_FIREWALL_SHADOW_H
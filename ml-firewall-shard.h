@@ -0,0 +1,360 @@
+#ifndef ML_FIREWALL_SHARD_H
+#define ML_FIREWALL_SHARD_H
+
+#include "ml-firewall-cache.h"
+#include "ml-firewall-client.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mlfw
+{
+
+// Endpoint of scorer shard i of a fleet whose first shard is at base: the
+// next ports over TCP, the path suffixed with "-i" otherwise. Shard 0 is
+// base itself.
+inline FirewallEndpoint
+GetShardEndpoint(const FirewallEndpoint& base, uint32_t i)
+{
+    FirewallEndpoint endpoint = base;
+    if (i == 0)
+    {
+        return endpoint;
+    }
+    if (base.transport == TRANSPORT_TCP)
+    {
+        endpoint.port = base.port + i;
+    }
+    else
+    {
+        endpoint.path = base.path + "-" + std::to_string(i);
+    }
+    return endpoint;
+}
+
+// Where the endpoint is, as a ring label
+inline std::string
+GetEndpointName(const FirewallEndpoint& endpoint)
+{
+    return endpoint.transport == TRANSPORT_TCP
+               ? endpoint.host + ":" + std::to_string(endpoint.port)
+               : endpoint.path;
+}
+
+// Hash of a flow's 5-tuple
+inline uint64_t
+HashFiveTuple(const FlowQuery& q)
+{
+    uint64_t addresses = uint64_t(q.srcAddress) << 32 | q.dstAddress;
+    uint64_t ports = uint64_t(q.srcPort) << 24 | uint64_t(q.dstPort) << 8 | q.protocol;
+    return Mix64(addresses ^ Mix64(ports));
+}
+
+} // namespace mlfw
+
+// Spreads flows over a fleet of scorers, one MLFirewallClient each, by
+// consistent hashing of the 5-tuple. Every shard owns VIRTUAL_NODES points
+// of a hash ring, placed by hashing its endpoint, and a flow goes to the
+// owner of the first point at or after its hash. A flow therefore always
+// reaches the same scorer, whose per-flow state and caches stay useful, and
+// adding a shard moves only the flows that land on its points.
+//
+// A shard whose client hands back fallback verdicts is taken off the ring
+// for the policy's breaker cooldown: its flows go to the next live point
+// and are scored again there, while every other flow stays where it was.
+// After the cooldown the shard is tried again and, if it answers, gets its
+// flows back. Only when every shard is down do verdicts stay degraded.
+//
+// Has the interface of MLFirewallClient, and like it may be queried from
+// several threads at once; with one endpoint it is a thin wrapper around one.
+class ShardedFirewallClient
+{
+  public:
+    // Ring points per shard
+    static const uint32_t VIRTUAL_NODES = 128;
+
+    ShardedFirewallClient(const std::vector<FirewallEndpoint>& endpoints,
+                          uint32_t maxConnections = 4,
+                          MLFirewallClient::Protocol protocol = MLFirewallClient::PROTOCOL_AUTO,
+                          const FirewallPolicy& policy = FirewallPolicy())
+        : m_cooldown(std::chrono::milliseconds(policy.breakerCooldownMs))
+    {
+        for (uint32_t s = 0; s < endpoints.size(); s++)
+        {
+            m_shards.emplace_back();
+            m_shards.back().client.reset(
+                new MLFirewallClient(endpoints[s], maxConnections, protocol, policy));
+            uint64_t label = mlfw::HashString(mlfw::GetEndpointName(endpoints[s]));
+            for (uint32_t v = 0; v < VIRTUAL_NODES; v++)
+            {
+                m_ring.emplace_back(mlfw::Mix64(label + v), s);
+            }
+        }
+        std::sort(m_ring.begin(), m_ring.end());
+    }
+
+    ShardedFirewallClient(const ShardedFirewallClient&) = delete;
+    ShardedFirewallClient& operator=(const ShardedFirewallClient&) = delete;
+
+    // Scores a single flow on its shard. Returns false if no shard gave a
+    // verdict, in which case it comes from the fallback.
+    bool Query(const FlowQuery& query, FlowVerdict& verdict)
+    {
+        std::vector<FlowVerdict> verdicts;
+        bool scored = QueryBatch(std::vector<FlowQuery>(1, query), verdicts, 1);
+        verdict = verdicts[0];
+        return scored;
+    }
+
+    bool Query(const FlowQuery& query)
+    {
+        FlowVerdict verdict;
+        Query(query, verdict);
+        return verdict.shouldBlock;
+    }
+
+    // Scores all flows, each shard's share with its client's QueryBatch();
+    // verdicts[i] is the verdict of queries[i]. Flows a shard fails to score
+    // move to the next live shard that has not failed during the call, so
+    // each shard fails at most once per call. Returns false if some flows got
+    // fallback verdicts.
+    bool QueryBatch(const std::vector<FlowQuery>& queries,
+                    std::vector<FlowVerdict>& verdicts,
+                    uint32_t batchSize = 256)
+    {
+        verdicts.assign(queries.size(), FlowVerdict());
+        if (m_shards.empty())
+        {
+            return queries.empty();
+        }
+        std::vector<size_t> pending(queries.size());
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            pending[i] = i;
+        }
+        std::vector<std::vector<size_t>> assigned(m_shards.size());
+        std::vector<bool> failedShards(m_shards.size(), false);
+        std::vector<FlowQuery> shardQueries;
+        std::vector<FlowVerdict> shardVerdicts;
+        while (!pending.empty())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (size_t i : pending)
+                {
+                    // Flows with no shard left keep their fallback verdict
+                    uint32_t s = Route(queries[i], failedShards);
+                    if (s < m_shards.size())
+                    {
+                        assigned[s].push_back(i);
+                    }
+                }
+            }
+            pending.clear();
+            for (uint32_t s = 0; s < m_shards.size(); s++)
+            {
+                if (assigned[s].empty())
+                {
+                    continue;
+                }
+                shardQueries.clear();
+                for (size_t i : assigned[s])
+                {
+                    shardQueries.push_back(queries[i]);
+                }
+                Shard& shard = m_shards[s];
+                bool wasUp = IsShardUp(s);
+                shard.client->QueryBatch(shardQueries, shardVerdicts, batchSize);
+                bool failed = false;
+                uint64_t scored = 0;
+                for (size_t k = 0; k < assigned[s].size(); k++)
+                {
+                    verdicts[assigned[s][k]] = shardVerdicts[k];
+                    failed = failed || shardVerdicts[k].degraded;
+                    // Rerouted while another shard is live; otherwise keep
+                    // the fallback verdict
+                    if (shardVerdicts[k].degraded && wasUp)
+                    {
+                        pending.push_back(assigned[s][k]);
+                    }
+                    scored += !shardVerdicts[k].degraded;
+                }
+                assigned[s].clear();
+                failedShards[s] = failedShards[s] || failed;
+                std::lock_guard<std::mutex> lock(m_mutex);
+                shard.flows += scored;
+                if (failed && wasUp)
+                {
+                    shard.downUntil = FirewallClock::now() + m_cooldown;
+                    m_outages++;
+                }
+            }
+            if (GetLiveShards() == 0)
+            {
+                break;
+            }
+        }
+        for (const FlowVerdict& verdict : verdicts)
+        {
+            if (verdict.degraded)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void SetFallback(FallbackScorer fallback)
+    {
+        for (Shard& shard : m_shards)
+        {
+            shard.client->SetFallback(fallback);
+        }
+    }
+
+    // Set before the first query; every shard then scores in-process
+    void SetLocalScorer(LocalScorer scorer)
+    {
+        for (Shard& shard : m_shards)
+        {
+            shard.client->SetLocalScorer(scorer);
+        }
+    }
+
+    void CloseIdle()
+    {
+        for (Shard& shard : m_shards)
+        {
+            shard.client->CloseIdle();
+        }
+    }
+
+    uint32_t GetShards() const
+    {
+        return m_shards.size();
+    }
+
+    // Shard that owns the flow's point of the ring, whether it is up or not
+    uint32_t GetOwner(const FlowQuery& query) const
+    {
+        return Successor(mlfw::HashFiveTuple(query))->second;
+    }
+
+    bool IsShardUp(uint32_t s) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return IsUp(s);
+    }
+
+    uint32_t GetLiveShards() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint32_t live = 0;
+        for (uint32_t s = 0; s < m_shards.size(); s++)
+        {
+            live += IsUp(s);
+        }
+        return live;
+    }
+
+    // Flows shard s has scored
+    uint64_t GetShardFlows(uint32_t s) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_shards[s].flows;
+    }
+
+    // Times a shard was taken off the ring
+    uint32_t GetOutages() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_outages;
+    }
+
+    uint32_t GetConnectionsOpened() const
+    {
+        return Sum(&MLFirewallClient::GetConnectionsOpened);
+    }
+
+    uint32_t GetBinaryConnections() const
+    {
+        return Sum(&MLFirewallClient::GetBinaryConnections);
+    }
+
+    uint32_t GetDegradedVerdicts() const
+    {
+        return Sum(&MLFirewallClient::GetDegradedVerdicts);
+    }
+
+    uint32_t GetBreakerTrips() const
+    {
+        return Sum(&MLFirewallClient::GetBreakerTrips);
+    }
+
+  private:
+    struct Shard
+    {
+        std::unique_ptr<MLFirewallClient> client;
+        FirewallClock::time_point downUntil; // off the ring until then
+        uint64_t flows = 0;
+    };
+
+    typedef std::vector<std::pair<uint64_t, uint32_t>> Ring; // point, shard
+
+    // First point at or after hash, wrapping around
+    Ring::const_iterator Successor(uint64_t hash) const
+    {
+        auto it = std::lower_bound(m_ring.begin(), m_ring.end(), std::make_pair(hash, 0u));
+        return it == m_ring.end() ? m_ring.begin() : it;
+    }
+
+    // Callers hold m_mutex
+    bool IsUp(uint32_t s) const
+    {
+        return FirewallClock::now() >= m_shards[s].downUntil;
+    }
+
+    // Shard of the first live point from the flow's, skipping shards that
+    // failed; else its owner if it has not failed, else GetShards().
+    // Callers hold m_mutex.
+    uint32_t Route(const FlowQuery& query, const std::vector<bool>& failed) const
+    {
+        Ring::const_iterator first = Successor(mlfw::HashFiveTuple(query));
+        Ring::const_iterator it = first;
+        do
+        {
+            if (!failed[it->second] && IsUp(it->second))
+            {
+                return it->second;
+            }
+            if (++it == m_ring.end())
+            {
+                it = m_ring.begin();
+            }
+        } while (it != first);
+        return failed[first->second] ? GetShards() : first->second;
+    }
+
+    uint32_t Sum(uint32_t (MLFirewallClient::*get)() const) const
+    {
+        uint32_t sum = 0;
+        for (const Shard& shard : m_shards)
+        {
+            sum += (*shard.client.*get)();
+        }
+        return sum;
+    }
+
+    std::vector<Shard> m_shards;
+    Ring m_ring;
+    FirewallClock::duration m_cooldown;
+    mutable std::mutex m_mutex; // guards downUntil, flows and m_outages
+    uint32_t m_outages = 0;
+};
+
+#endif // ML_FIREWALL_SHARD_H
@@ -0,0 +1,379 @@
+// Threshold sweeps over the scores a simulation run saved.
+//
+//   g++ -O2 -std=c++17 -o ml-firewall-sweep ml-firewall-sweep.cc
+//   ./ml-firewall-sweep [-i MIN:MAX:STEP] [-l MIN:MAX:STEP] [-c MIN:MAX:STEP] *-flow-scores.csv
+//
+// Reads the per-flow Isolation Forest scores, LOF factors and labels that
+// enhanced-smart-city-socket writes next to its flow CSV, and reports the
+// precision, recall, F1 and number of blocked flows of every point of three
+// grids: iso_threshold (-i, blocking flows scoring at or below it),
+// lof_threshold (-l, blocking factors at or above it) and contamination (-c,
+// blocking that fraction of the flows with the lowest scores). Each score column is sorted
+// once and every grid is then read off in a single pass over it, so a sweep
+// of any size takes milliseconds where each point used to take a simulation.
+//
+// Also reports the thresholds of saved_models/model_metadata.json, when run
+// from the repository root, and the best F1 any threshold reaches. Flows the
+// scorer gave no score (degraded verdicts, a JSON service without scores, no
+// LOF model) are never blocked by that score; their attacks count as missed.
+// Flows a cascade settled before its last tree are left out and counted, as
+// their scores are extrapolated; sweep a run with cascade=false for all.
+
+#include "ml-firewall-cache.h"
+#include "ml-firewall-cascade.h"
+#include "ml-firewall-dataset.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+
+// One row of a flow scores CSV
+struct ScoredFlow
+{
+    int label = 0; // 1 = attack
+    double isoScore = NAN;
+    double lofFactor = NAN;
+};
+
+// Appends the rows of a flow scores CSV to flows, counting those with
+// extrapolated scores in estimated instead. Returns false if the file cannot
+// be read or its header is not the simulation's.
+bool
+LoadScoreCsv(const std::string& path, std::vector<ScoredFlow>& flows, uint64_t& estimated)
+{
+    static const char* const HEADER =
+        "FlowId,District,TrafficType,Label,IsoScore,LofFactor,Blocked,Degraded";
+
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) || line.compare(0, std::strlen(HEADER), HEADER) != 0)
+    {
+        return false;
+    }
+
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> cells;
+        std::stringstream row(line);
+        std::string cell;
+        while (std::getline(row, cell, ','))
+        {
+            cells.push_back(cell);
+        }
+        if (cells.size() < 8)
+        {
+            continue;
+        }
+        if (cells.size() > 8 && cells[8] == mlfw::GetCascadeStageName(mlfw::STAGE_TREES))
+        {
+            estimated++;
+            continue;
+        }
+        // Not CsvNumber(): a missing score must stay NaN, not become 0
+        ScoredFlow flow;
+        flow.label = mlfw::CsvNumber(cells[3]) != 0;
+        flow.isoScore = std::strtod(cells[4].c_str(), nullptr);
+        flow.lofFactor = std::strtod(cells[5].c_str(), nullptr);
+        flows.push_back(flow);
+    }
+    return true;
+}
+
+// Parses MIN:MAX:STEP into the grid's points
+bool
+ParseGrid(const char* spec, std::vector<double>& grid)
+{
+    double min, max, step;
+    if (std::sscanf(spec, "%lf:%lf:%lf", &min, &max, &step) != 3 || step <= 0 || max < min)
+    {
+        return false;
+    }
+    grid.clear();
+    for (size_t i = 0; min + i * step <= max + step * 1e-9; i++)
+    {
+        grid.push_back(min + i * step);
+    }
+    return true;
+}
+
+// Flows blocked at one threshold, and the attacks among them
+struct Point
+{
+    uint64_t blocked = 0;
+    uint64_t attacks = 0;
+};
+
+// Score column sorted with its labels; NaN scores left out
+class SortedScores
+{
+  public:
+    // high: flows are blocked at or above a threshold instead of at or below
+    SortedScores(const std::vector<ScoredFlow>& flows, double ScoredFlow::*column, bool high)
+        : m_sign(high ? -1.0 : 1.0)
+    {
+        for (const ScoredFlow& flow : flows)
+        {
+            if (!std::isnan(flow.*column))
+            {
+                m_rows.emplace_back(m_sign * (flow.*column), flow.label);
+            }
+        }
+        std::sort(m_rows.begin(), m_rows.end());
+    }
+
+    // Points of thresholds, which must be in blocking order (ascending, or
+    // descending if high), in one pass over the column
+    std::vector<Point> Sweep(const std::vector<double>& thresholds) const
+    {
+        std::vector<Point> points;
+        Point point;
+        size_t row = 0;
+        for (double threshold : thresholds)
+        {
+            for (; row < m_rows.size() && m_rows[row].first <= m_sign * threshold; row++)
+            {
+                point.blocked++;
+                point.attacks += m_rows[row].second;
+            }
+            points.push_back(point);
+        }
+        return points;
+    }
+
+    // Threshold blocking the fraction of all flows with the lowest scores
+    double Quantile(double fraction, size_t flows) const
+    {
+        size_t blocked = std::llround(fraction * flows);
+        if (blocked == 0 || m_rows.empty())
+        {
+            return m_sign * -INFINITY;
+        }
+        return m_sign * m_rows[std::min(blocked, m_rows.size()) - 1].first;
+    }
+
+    // Threshold with the highest F1 and its point, ties kept together
+    std::pair<double, Point> Best(uint64_t attacks) const
+    {
+        std::pair<double, Point> best(NAN, Point());
+        double bestF1 = -1.0;
+        Point point;
+        for (size_t row = 0; row < m_rows.size(); row++)
+        {
+            point.blocked++;
+            point.attacks += m_rows[row].second;
+            if (row + 1 < m_rows.size() && m_rows[row + 1].first == m_rows[row].first)
+            {
+                continue;
+            }
+            double f1 = 2.0 * point.attacks / (point.blocked + attacks);
+            if (f1 > bestF1)
+            {
+                bestF1 = f1;
+                best = std::make_pair(m_sign * m_rows[row].first, point);
+            }
+        }
+        return best;
+    }
+
+    size_t GetSize() const
+    {
+        return m_rows.size();
+    }
+
+  private:
+    double m_sign;
+    std::vector<std::pair<double, int>> m_rows; // sign * score, label
+};
+
+void
+PrintHeader(std::ostream& out,
+            const char* title,
+            const char* parameter,
+            uint64_t scored,
+            uint64_t flows)
+{
+    out << "\n" << title << " (" << scored << " of " << flows << " flows scored)\n"
+        << std::setw(14) << parameter << std::setw(12) << "blocked" << std::setw(11) << "precision"
+        << std::setw(9) << "recall" << std::setw(9) << "F1" << std::endl;
+}
+
+void
+PrintPoint(std::ostream& out, const std::string& label, const Point& point, uint64_t attacks)
+{
+    double precision = point.blocked > 0 ? double(point.attacks) / point.blocked : 0.0;
+    double recall = attacks > 0 ? double(point.attacks) / attacks : 0.0;
+    double f1 = 2.0 * point.attacks / std::max<uint64_t>(1, point.blocked + attacks);
+    out << std::setw(14) << label << std::setw(12) << point.blocked << std::fixed
+        << std::setprecision(4) << std::setw(11) << precision << std::setw(9) << recall
+        << std::setw(9) << f1 << std::defaultfloat << std::endl;
+}
+
+std::string
+FormatThreshold(double threshold)
+{
+    std::ostringstream text;
+    text << std::setprecision(5) << threshold;
+    return text.str();
+}
+
+// Prints the points of grid, the model's threshold and the best threshold
+void
+Report(std::ostream& out,
+       const char* title,
+       const SortedScores& column,
+       std::vector<double> grid,
+       bool high,
+       double modelThreshold,
+       size_t flows,
+       uint64_t attacks)
+{
+    if (high)
+    {
+        std::reverse(grid.begin(), grid.end());
+    }
+    std::vector<Point> points = column.Sweep(grid);
+    if (high)
+    {
+        std::reverse(grid.begin(), grid.end());
+        std::reverse(points.begin(), points.end());
+    }
+    PrintHeader(out, title, "threshold", column.GetSize(), flows);
+    for (size_t i = 0; i < grid.size(); i++)
+    {
+        PrintPoint(out, FormatThreshold(grid[i]), points[i], attacks);
+    }
+    if (!std::isnan(modelThreshold))
+    {
+        PrintPoint(out,
+                   "model " + FormatThreshold(modelThreshold),
+                   column.Sweep(std::vector<double>(1, modelThreshold))[0],
+                   attacks);
+    }
+    std::pair<double, Point> best = column.Best(attacks);
+    if (!std::isnan(best.first))
+    {
+        PrintPoint(out, "best " + FormatThreshold(best.first), best.second, attacks);
+    }
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    std::vector<double> isoGrid, lofGrid, contaminationGrid;
+    ParseGrid("-0.2:0.1:0.01", isoGrid);
+    ParseGrid("1:3:0.1", lofGrid);
+    ParseGrid("0.05:0.6:0.05", contaminationGrid);
+    std::vector<ScoredFlow> flows;
+    uint64_t estimated = 0;
+    bool valid = true;
+    for (int i = 1; valid && i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+        {
+            valid = ParseGrid(argv[++i], isoGrid);
+        }
+        else if (std::strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+        {
+            valid = ParseGrid(argv[++i], lofGrid);
+        }
+        else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            valid = ParseGrid(argv[++i], contaminationGrid);
+        }
+        else if (!LoadScoreCsv(argv[i], flows, estimated))
+        {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+    if (!valid || flows.empty())
+    {
+        std::cerr << "usage: " << argv[0]
+                  << " [-i MIN:MAX:STEP] [-l MIN:MAX:STEP] [-c MIN:MAX:STEP] "
+                  << "SCENARIO-flow-scores.csv..." << std::endl;
+        return 2;
+    }
+
+    std::ifstream metadata("saved_models/model_metadata.json");
+    std::stringstream text;
+    text << metadata.rdbuf();
+    double isoThreshold = mlfw::JsonNumberField(text.str(), "iso_threshold");
+    double lofThreshold = mlfw::JsonNumberField(text.str(), "lof_threshold");
+    double contamination = mlfw::JsonNumberField(text.str(), "contamination_rate");
+
+    // Everything from sorting to formatting the tables is timed
+    auto start = std::chrono::steady_clock::now();
+    uint64_t attacks = 0;
+    for (const ScoredFlow& flow : flows)
+    {
+        attacks += flow.label;
+    }
+    SortedScores iso(flows, &ScoredFlow::isoScore, false);
+    SortedScores lof(flows, &ScoredFlow::lofFactor, true);
+
+    std::ostringstream out;
+    out << "Flows: " << flows.size() << " (" << attacks << " attacks)" << std::endl;
+    if (estimated > 0)
+    {
+        out << "Left out " << estimated << " flows a cascade settled early, with extrapolated "
+            << "scores" << std::endl;
+    }
+    Report(out,
+           "Isolation Forest score, blocked at or below",
+           iso,
+           isoGrid,
+           false,
+           isoThreshold,
+           flows.size(),
+           attacks);
+    if (lof.GetSize() > 0)
+    {
+        Report(out,
+               "LOF factor, blocked at or above",
+               lof,
+               lofGrid,
+               true,
+               lofThreshold,
+               flows.size(),
+               attacks);
+    }
+
+    std::vector<double> quantiles;
+    for (double fraction : contaminationGrid)
+    {
+        quantiles.push_back(iso.Quantile(fraction, flows.size()));
+    }
+    std::vector<Point> points = iso.Sweep(quantiles);
+    PrintHeader(out,
+                "Contamination, lowest Isolation Forest scores blocked",
+                "fraction",
+                iso.GetSize(),
+                flows.size());
+    for (size_t i = 0; i < contaminationGrid.size(); i++)
+    {
+        PrintPoint(out, FormatThreshold(contaminationGrid[i]), points[i], attacks);
+    }
+    if (!std::isnan(contamination))
+    {
+        double threshold = iso.Quantile(contamination, flows.size());
+        PrintPoint(out,
+                   "model " + FormatThreshold(contamination),
+                   iso.Sweep(std::vector<double>(1, threshold))[0],
+                   attacks);
+    }
+    double sweepMs =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+
+    std::cout << out.str() << "\nSwept " << isoGrid.size() + lofGrid.size() + quantiles.size()
+              << " grid points in " << std::fixed << std::setprecision(2) << sweepMs << " ms"
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,541 @@
+#ifndef ML_FIREWALL_TRANSPORT_H
+#define ML_FIREWALL_TRANSPORT_H
+
+#include "ml-firewall-resilience.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Ways of reaching a scorer running on the same host
+enum FirewallTransport
+{
+    TRANSPORT_TCP,  // loopback TCP, host:port
+    TRANSPORT_UNIX, // AF_UNIX SOCK_SEQPACKET socket at path, see below
+    TRANSPORT_SHM   // shared-memory ring pair named path (binary protocol only)
+};
+
+struct FirewallEndpoint
+{
+    FirewallTransport transport = TRANSPORT_TCP;
+    std::string host = "127.0.0.1";
+    uint16_t port = 8888;
+    std::string path; // socket path or shared-memory object name
+
+    // Builds an endpoint from the simulation's transport option. An empty
+    // path selects the default location for the transport.
+    static bool Parse(const std::string& transport,
+                      const std::string& path,
+                      FirewallEndpoint& endpoint)
+    {
+        if (transport == "tcp")
+        {
+            endpoint.transport = TRANSPORT_TCP;
+        }
+        else if (transport == "unix")
+        {
+            endpoint.transport = TRANSPORT_UNIX;
+            endpoint.path = path.empty() ? "/tmp/ml-firewall.sock" : path;
+        }
+        else if (transport == "shm")
+        {
+            endpoint.transport = TRANSPORT_SHM;
+            endpoint.path = path.empty() ? "/ml-firewall" : path;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+};
+
+namespace mlfw
+{
+
+// Largest message written to a SOCK_SEQPACKET socket. Both sides treat the
+// messages as consecutive pieces of one byte stream, so a frame may span
+// messages and one message may hold several frames; the size only has to stay
+// below the socket send buffer.
+const size_t SEQPACKET_MESSAGE_SIZE = 65536;
+
+inline int
+FutexWait(std::atomic<uint32_t>* word, uint32_t expected, int timeoutMs)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+    return syscall(SYS_futex,
+                   reinterpret_cast<uint32_t*>(word),
+                   FUTEX_WAIT,
+                   expected,
+                   timeoutMs < 0 ? nullptr : &timeout,
+                   nullptr,
+                   0);
+}
+
+inline void
+FutexWake(std::atomic<uint32_t>* word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// Single-producer/single-consumer byte ring living in shared memory. head and
+// tail are free-running byte counters; the data area follows the struct.
+// Waiters sleep on a futex word that the other side bumps after every update,
+// and are only woken when they announced themselves as waiting.
+struct ShmRing
+{
+    alignas(64) std::atomic<uint64_t> head; // next byte to read
+    alignas(64) std::atomic<uint64_t> tail; // next byte to write
+    alignas(64) std::atomic<uint32_t> dataSeq;
+    std::atomic<uint32_t> readerWaiting;
+    std::atomic<uint32_t> spaceSeq;
+    std::atomic<uint32_t> writerWaiting;
+    uint64_t capacity; // power of two
+
+    uint8_t* Data()
+    {
+        return reinterpret_cast<uint8_t*>(this + 1);
+    }
+
+    size_t TryWrite(const uint8_t* src, size_t length)
+    {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        size_t n = std::min<uint64_t>(length, capacity - (t - h));
+        for (size_t done = 0; done < n;)
+        {
+            size_t offset = (t + done) & (capacity - 1);
+            size_t chunk = std::min<size_t>(n - done, capacity - offset);
+            std::memcpy(Data() + offset, src + done, chunk);
+            done += chunk;
+        }
+        if (n > 0)
+        {
+            tail.store(t + n, std::memory_order_seq_cst);
+            dataSeq.fetch_add(1, std::memory_order_seq_cst);
+            if (readerWaiting.load(std::memory_order_seq_cst))
+            {
+                FutexWake(&dataSeq);
+            }
+        }
+        return n;
+    }
+
+    size_t TryRead(uint8_t* dst, size_t length)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t t = tail.load(std::memory_order_acquire);
+        size_t n = std::min<uint64_t>(length, t - h);
+        for (size_t done = 0; done < n;)
+        {
+            size_t offset = (h + done) & (capacity - 1);
+            size_t chunk = std::min<size_t>(n - done, capacity - offset);
+            std::memcpy(dst + done, Data() + offset, chunk);
+            done += chunk;
+        }
+        if (n > 0)
+        {
+            head.store(h + n, std::memory_order_seq_cst);
+            spaceSeq.fetch_add(1, std::memory_order_seq_cst);
+            if (writerWaiting.load(std::memory_order_seq_cst))
+            {
+                FutexWake(&spaceSeq);
+            }
+        }
+        return n;
+    }
+
+    bool Empty() const
+    {
+        return head.load(std::memory_order_seq_cst) == tail.load(std::memory_order_seq_cst);
+    }
+
+    bool Full() const
+    {
+        return tail.load(std::memory_order_seq_cst) - head.load(std::memory_order_seq_cst) ==
+               capacity;
+    }
+
+    // Sleeps until the ring holds data or timeoutMs expires
+    void WaitReadable(int timeoutMs)
+    {
+        readerWaiting.store(1, std::memory_order_seq_cst);
+        uint32_t seq = dataSeq.load(std::memory_order_seq_cst);
+        if (Empty())
+        {
+            FutexWait(&dataSeq, seq, timeoutMs);
+        }
+        readerWaiting.store(0, std::memory_order_seq_cst);
+    }
+
+    // Sleeps until the ring has free space or timeoutMs expires
+    void WaitWritable(int timeoutMs)
+    {
+        writerWaiting.store(1, std::memory_order_seq_cst);
+        uint32_t seq = spaceSeq.load(std::memory_order_seq_cst);
+        if (Full())
+        {
+            FutexWait(&spaceSeq, seq, timeoutMs);
+        }
+        writerWaiting.store(0, std::memory_order_seq_cst);
+    }
+};
+
+const uint32_t SHM_MAGIC = 0x4d48534d; // "MSHM"
+const uint16_t SHM_VERSION = 2;
+
+// Layout of the shared-memory object: this header, the request ring and the
+// verdict ring, each ring aligned to 64 bytes. The scorer creates the object
+// and one client at a time attaches to it. Every attach starts a generation;
+// the client sends nothing until the scorer has emptied both rings of what
+// earlier generations left there and acknowledged it.
+struct ShmRegionHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint64_t ringCapacity;
+    std::atomic<int32_t> serverPid;
+    std::atomic<uint32_t> clientAttached;
+    std::atomic<uint32_t> attachGeneration; // bumped by every Attach()
+    std::atomic<uint32_t> servedGeneration; // the last one AcceptClient() let in
+};
+
+// One side of a request/verdict ring pair. The client writes requests and
+// reads verdicts; the scorer does the opposite. Both rings carry the binary
+// frames of ml-firewall-protocol.h.
+class ShmRingPair
+{
+  public:
+    ShmRingPair() = default;
+
+    ~ShmRingPair()
+    {
+        Close();
+    }
+
+    ShmRingPair(const ShmRingPair&) = delete;
+    ShmRingPair& operator=(const ShmRingPair&) = delete;
+
+    // Scorer side: creates (or replaces) the object with rings of
+    // ringCapacity bytes, which must be a power of two
+    bool Create(const std::string& name, uint64_t ringCapacity = 1 << 20)
+    {
+        if (ringCapacity == 0 || (ringCapacity & (ringCapacity - 1)) != 0)
+        {
+            return false;
+        }
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+        {
+            return false;
+        }
+        size_t size = RegionSize(ringCapacity);
+        if (ftruncate(fd, size) != 0 || !Map(fd, size))
+        {
+            close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        close(fd);
+
+        m_header->magic = SHM_MAGIC;
+        m_header->version = SHM_VERSION;
+        m_header->ringCapacity = ringCapacity;
+        m_header->clientAttached.store(0);
+        m_header->attachGeneration.store(0);
+        m_header->servedGeneration.store(0);
+        for (ShmRing* ring : {RequestRing(), VerdictRing()})
+        {
+            new (ring) ShmRing();
+            ring->head.store(0);
+            ring->tail.store(0);
+            ring->dataSeq.store(0);
+            ring->readerWaiting.store(0);
+            ring->spaceSeq.store(0);
+            ring->writerWaiting.store(0);
+            ring->capacity = ringCapacity;
+        }
+        m_header->serverPid.store(getpid(), std::memory_order_release);
+
+        m_name = name;
+        m_server = true;
+        m_tx = VerdictRing();
+        m_rx = RequestRing();
+        return true;
+    }
+
+    // Client side: attaches to an object created by a running scorer and
+    // waits for it to accept the new generation. Fails if another client is
+    // attached, and with errno ETIMEDOUT if the scorer has not accepted it
+    // by deadline.
+    bool Attach(const std::string& name,
+                FirewallClock::time_point deadline = FirewallClock::time_point::max())
+    {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ShmRegionHeader) ||
+            !Map(fd, st.st_size))
+        {
+            close(fd);
+            return false;
+        }
+        close(fd);
+
+        if (m_header->magic != SHM_MAGIC || m_header->version != SHM_VERSION ||
+            RegionSize(m_header->ringCapacity) > m_size || !ServerAlive())
+        {
+            Close();
+            return false;
+        }
+        uint32_t expected = 0;
+        if (!m_header->clientAttached.compare_exchange_strong(expected, 1))
+        {
+            Close();
+            return false;
+        }
+
+        m_attached = true;
+        m_server = false;
+        m_tx = RequestRing();
+        m_rx = VerdictRing();
+
+        // Wake the scorer wherever it sleeps, then wait for it to drop the
+        // partial request or the verdicts a previous client may have left
+        uint32_t generation = m_header->attachGeneration.fetch_add(1) + 1;
+        for (std::atomic<uint32_t>* seq : {&m_tx->dataSeq, &m_rx->spaceSeq})
+        {
+            seq->fetch_add(1);
+            FutexWake(seq);
+        }
+        while (true)
+        {
+            uint32_t served = m_header->servedGeneration.load();
+            if (served == generation)
+            {
+                return true;
+            }
+            int waitMs = RemainingMs(deadline, PEER_CHECK_INTERVAL_MS);
+            if (waitMs == 0 || !ServerAlive())
+            {
+                errno = waitMs == 0 ? ETIMEDOUT : ECONNRESET;
+                Close();
+                return false;
+            }
+            FutexWait(&m_header->servedGeneration, served, waitMs);
+        }
+    }
+
+    // Scorer side: true when a client has attached since the last
+    // AcceptClient() and waits to be accepted
+    bool ClientWaiting() const
+    {
+        return m_header->attachGeneration.load() != m_header->servedGeneration.load();
+    }
+
+    // Scorer side: empties both rings and lets the waiting client send. Its
+    // requests and verdicts are then the only ones in the rings, as it
+    // writes and reads nothing before, and earlier clients have detached.
+    void AcceptClient()
+    {
+        uint32_t generation = m_header->attachGeneration.load();
+        uint8_t scratch[4096];
+        for (ShmRing* ring : {RequestRing(), VerdictRing()})
+        {
+            while (ring->TryRead(scratch, sizeof(scratch)) > 0)
+            {
+            }
+        }
+        m_header->servedGeneration.store(generation);
+        FutexWake(&m_header->servedGeneration);
+    }
+
+    void Close()
+    {
+        if (!m_header)
+        {
+            return;
+        }
+        if (m_attached)
+        {
+            m_header->clientAttached.store(0);
+        }
+        munmap(m_header, m_size);
+        if (m_server)
+        {
+            shm_unlink(m_name.c_str());
+        }
+        m_header = nullptr;
+        m_tx = m_rx = nullptr;
+        m_attached = m_server = false;
+    }
+
+    bool IsOpen() const
+    {
+        return m_header != nullptr;
+    }
+
+    // True while the scorer that created the object is running
+    bool ServerAlive() const
+    {
+        int32_t pid = m_header->serverPid.load(std::memory_order_acquire);
+        return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+    }
+
+    // True while a client is attached (scorer side)
+    bool ClientAttached() const
+    {
+        return m_header->clientAttached.load() != 0;
+    }
+
+    size_t TryWrite(const uint8_t* data, size_t length)
+    {
+        return m_tx->TryWrite(data, length);
+    }
+
+    size_t TryRead(uint8_t* data, size_t length)
+    {
+        return m_rx->TryRead(data, length);
+    }
+
+    void WaitReadable(int timeoutMs)
+    {
+        m_rx->WaitReadable(timeoutMs);
+    }
+
+    void WaitWritable(int timeoutMs)
+    {
+        m_tx->WaitWritable(timeoutMs);
+    }
+
+    // Writes all bytes, sleeping while the ring is full. Fails with errno
+    // ETIMEDOUT once deadline passes and ECONNRESET if the peer goes away.
+    bool WriteAll(const uint8_t* data,
+                  size_t length,
+                  FirewallClock::time_point deadline = FirewallClock::time_point::max())
+    {
+        size_t written = 0;
+        while (written < length)
+        {
+            written += m_tx->TryWrite(data + written, length - written);
+            if (written < length)
+            {
+                int waitMs = RemainingMs(deadline, PEER_CHECK_INTERVAL_MS);
+                if (waitMs == 0)
+                {
+                    errno = ETIMEDOUT;
+                    return false;
+                }
+                m_tx->WaitWritable(waitMs);
+                if (!m_server && !ServerAlive())
+                {
+                    errno = ECONNRESET;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Reads at least one byte and at most length bytes, sleeping while the
+    // ring is empty. Returns 0 with errno ETIMEDOUT once deadline passes and
+    // ECONNRESET if the peer goes away.
+    size_t ReadSome(uint8_t* data,
+                    size_t length,
+                    FirewallClock::time_point deadline = FirewallClock::time_point::max())
+    {
+        while (true)
+        {
+            size_t n = m_rx->TryRead(data, length);
+            if (n > 0)
+            {
+                return n;
+            }
+            int waitMs = RemainingMs(deadline, PEER_CHECK_INTERVAL_MS);
+            if (waitMs == 0)
+            {
+                errno = ETIMEDOUT;
+                return 0;
+            }
+            m_rx->WaitReadable(waitMs);
+            if (m_server ? !ClientAttached() && m_rx->Empty() : !ServerAlive())
+            {
+                errno = ECONNRESET;
+                return 0;
+            }
+        }
+    }
+
+  private:
+    static const int PEER_CHECK_INTERVAL_MS = 100;
+
+    static size_t RingOffset()
+    {
+        return (sizeof(ShmRegionHeader) + 63) & ~size_t(63);
+    }
+
+    static size_t RingStride(uint64_t capacity)
+    {
+        return (sizeof(ShmRing) + capacity + 63) & ~size_t(63);
+    }
+
+    static size_t RegionSize(uint64_t capacity)
+    {
+        return RingOffset() + 2 * RingStride(capacity);
+    }
+
+    bool Map(int fd, size_t size)
+    {
+        void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            return false;
+        }
+        m_header = static_cast<ShmRegionHeader*>(base);
+        m_size = size;
+        return true;
+    }
+
+    ShmRing* RequestRing()
+    {
+        return reinterpret_cast<ShmRing*>(reinterpret_cast<uint8_t*>(m_header) + RingOffset());
+    }
+
+    ShmRing* VerdictRing()
+    {
+        return reinterpret_cast<ShmRing*>(reinterpret_cast<uint8_t*>(m_header) + RingOffset() +
+                                          RingStride(m_header->ringCapacity));
+    }
+
+    ShmRegionHeader* m_header = nullptr;
+    size_t m_size = 0;
+    std::string m_name;
+    bool m_server = false;
+    bool m_attached = false;
+    ShmRing* m_tx = nullptr;
+    ShmRing* m_rx = nullptr;
+};
+
+} // namespace mlfw
+
+#endif // ML_FIREWALL_TRANSPORT_H
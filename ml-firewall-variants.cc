@@ -0,0 +1,233 @@
+// Accuracy and latency of reduced Isolation Forest variants.
+//
+//   g++ -O2 -std=c++17 -o ml-firewall-variants ml-firewall-variants.cc
+//   ./ml-firewall-variants [-n SYNTHETIC_ROWS] Dataset/*.csv
+//
+// Builds variants of the saved forest: trimmed to its first trees, cut to a
+// maximum depth, and with 16-bit split codes (QuantizedForest). For each it
+// reports F1 against the Label column of the CSVs at iso_threshold, the best
+// F1 any threshold would give, the ROC AUC of its scores (how well they rank
+// attacks whatever the threshold), how many block decisions differ from the
+// full forest, the bytes its nodes take, and ns/flow scoring one flow at a
+// time and batched, on a synthetic set (1M rows by default) made by
+// perturbing the flows. Exits with status 1 if the 16-bit codes of the full
+// forest change any score.
+
+#include "ml-firewall-dataset.h"
+#include "ml-firewall-native.h"
+#include "ml-firewall-quantized.h"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+
+namespace
+{
+
+typedef std::function<void(const float*, size_t, double*)> BatchScorer;
+
+struct Variant
+{
+    std::string name;
+    size_t bytes;
+    BatchScorer scalar; // one flow at a time
+    BatchScorer batch;
+};
+
+// Highest F1 any threshold on the scores reaches, blocking flows at or
+// below it: what the variant could do with a threshold tuned to the data
+double
+BestF1(const std::vector<double>& scores, const std::vector<LabeledFlow>& flows)
+{
+    std::vector<size_t> order(scores.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return scores[a] < scores[b];
+    });
+    double attacks = 0.0;
+    for (const LabeledFlow& flow : flows)
+    {
+        attacks += flow.label == 1;
+    }
+    double best = 0.0, truePositives = 0.0;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        truePositives += flows[order[i]].label == 1;
+        if (i + 1 == order.size() || scores[order[i + 1]] != scores[order[i]])
+        {
+            best = std::max(best, 2 * truePositives / (i + 1 + attacks));
+        }
+    }
+    return best;
+}
+
+// Best of three timed passes over rows, in ns/flow
+double
+Time(const BatchScorer& score, const std::vector<float>& rows)
+{
+    size_t count = rows.size() / mlfw::N_FEATURES;
+    std::vector<double> scores(count);
+    double best = 0.0;
+    for (int pass = 0; pass < 3; pass++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        score(rows.data(), count, scores.data());
+        double ns = std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count();
+        best = pass == 0 ? ns : std::min(best, ns);
+    }
+    return best / count;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    uint64_t syntheticRows = 1000000;
+    std::vector<LabeledFlow> flows;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            syntheticRows = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (!LoadFlowCsv(argv[i], flows))
+        {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    NativeScorer scorer;
+    if (flows.empty() ||
+        !scorer.Load("saved_models/isolation_forest.txt", "saved_models/model_metadata.json"))
+    {
+        std::cerr << "usage: " << argv[0] << " [-n SYNTHETIC_ROWS] FLOWS.csv... "
+                  << "(run from the repository root after export_models.py)" << std::endl;
+        return 2;
+    }
+    const IsolationForest& full = scorer.GetForest();
+    double threshold = scorer.GetIsoThreshold();
+
+    auto scale = [&](const FlowQuery& q, float* row) {
+        double features[mlfw::N_FEATURES];
+        ComputeModelFeatures(q, features);
+        full.GetScaler().Transform(features, row);
+    };
+    std::vector<float> dataset(flows.size() * mlfw::N_FEATURES);
+    for (size_t i = 0; i < flows.size(); i++)
+    {
+        scale(flows[i].query, &dataset[i * mlfw::N_FEATURES]);
+    }
+    std::vector<float> synthetic(syntheticRows * mlfw::N_FEATURES);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, flows.size() - 1);
+    for (uint64_t i = 0; i < syntheticRows; i++)
+    {
+        FlowQuery q = flows[pick(rng)].query;
+        mlfw::PerturbFlow(q, rng);
+        scale(q, &synthetic[i * mlfw::N_FEATURES]);
+    }
+
+    // Forests and quantized forests the variants score with; kept alive here
+    std::vector<std::unique_ptr<IsolationForest>> forests;
+    std::vector<std::unique_ptr<QuantizedForest>> quantized;
+    std::vector<Variant> variants;
+    auto addForest = [&](const std::string& name, uint32_t trees, uint32_t depth) {
+        forests.emplace_back(new IsolationForest(full));
+        IsolationForest* forest = forests.back().get();
+        forest->Prune(trees, depth);
+        variants.push_back({name + " float32",
+                            forest->GetModelBytes(),
+                            [forest](const float* x, size_t count, double* scores) {
+                                for (size_t i = 0; i < count; i++)
+                                {
+                                    scores[i] = forest->DecisionFunction(x + i * mlfw::N_FEATURES);
+                                }
+                            },
+                            [forest](const float* x, size_t count, double* scores) {
+                                forest->DecisionFunctionBatch(x, count, scores);
+                            }});
+        quantized.emplace_back(new QuantizedForest);
+        QuantizedForest* q = quantized.back().get();
+        q->Build(*forest);
+        variants.push_back({name + " int16",
+                            q->GetModelBytes(),
+                            [q](const float* x, size_t count, double* scores) {
+                                for (size_t i = 0; i < count; i++)
+                                {
+                                    scores[i] = q->DecisionFunction(x + i * mlfw::N_FEATURES);
+                                }
+                            },
+                            [q](const float* x, size_t count, double* scores) {
+                                q->DecisionFunctionBatch(x, count, scores);
+                            }});
+    };
+    uint32_t trees = full.GetTrees();
+    addForest(std::to_string(trees) + " trees", 0, 0);
+    addForest(std::to_string(trees / 2) + " trees", trees / 2, 0);
+    addForest(std::to_string(trees / 4) + " trees", trees / 4, 0);
+    addForest(std::to_string(trees) + " trees depth 6", 0, 6);
+    addForest(std::to_string(trees) + " trees depth 4", 0, 4);
+    addForest(std::to_string(trees / 2) + " trees depth 6", trees / 2, 6);
+
+    std::cout << "Forest: " << trees << " trees, " << full.GetNodes() << " nodes, kernel "
+              << IsolationForest::GetKernelName(full.GetKernel()) << "; " << flows.size()
+              << " labeled flows, " << syntheticRows << " synthetic" << std::endl;
+    std::cout << std::left << std::setw(26) << "variant" << std::right << std::setw(8) << "bytes"
+              << std::setw(7) << "F1" << std::setw(11) << "precision" << std::setw(8) << "recall"
+              << std::setw(8) << "best F1" << std::setw(7) << "AUC" << std::setw(9) << "changed"
+              << std::setw(11) << "scalar ns" << std::setw(10) << "batch ns" << std::endl;
+
+    size_t count = flows.size();
+    std::vector<int> labels;
+    for (const LabeledFlow& flow : flows)
+    {
+        labels.push_back(flow.label);
+    }
+    std::vector<double> reference(count), scores(count);
+    full.DecisionFunctionBatch(dataset.data(), count, reference.data());
+    bool exact = true;
+    for (size_t v = 0; v < variants.size(); v++)
+    {
+        const Variant& variant = variants[v];
+        variant.batch(dataset.data(), count, scores.data());
+        uint32_t truePositives = 0, falsePositives = 0, falseNegatives = 0, changed = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            bool blocked = scores[i] <= threshold;
+            truePositives += blocked && flows[i].label == 1;
+            falsePositives += blocked && flows[i].label != 1;
+            falseNegatives += !blocked && flows[i].label == 1;
+            changed += blocked != (reference[i] <= threshold);
+        }
+        // Neither copying the whole forest nor coding it may change a score
+        if (v < 2)
+        {
+            exact = exact &&
+                    std::memcmp(scores.data(), reference.data(), count * sizeof(double)) == 0;
+        }
+        double precision = truePositives + falsePositives > 0
+                               ? double(truePositives) / (truePositives + falsePositives)
+                               : 0.0;
+        double recall = truePositives + falseNegatives > 0
+                            ? double(truePositives) / (truePositives + falseNegatives)
+                            : 0.0;
+        double f1 = precision + recall > 0 ? 2 * precision * recall / (precision + recall) : 0.0;
+        std::cout << std::left << std::setw(26) << variant.name << std::right << std::setw(8)
+                  << variant.bytes << std::fixed << std::setprecision(3) << std::setw(7) << f1
+                  << std::setw(11) << precision << std::setw(8) << recall << std::setw(8)
+                  << BestF1(scores, flows) << std::setw(7) << mlfw::RocAuc(scores, labels)
+                  << std::setw(9) << changed << std::setprecision(1) << std::setw(11)
+                  << Time(variant.scalar, synthetic) << std::setw(10)
+                  << Time(variant.batch, synthetic) << std::defaultfloat << std::endl;
+    }
+    if (!exact)
+    {
+        std::cout << "The full forest's copy or its 16-bit codes change scores" << std::endl;
+    }
+    return exact ? 0 : 1;
+}